@@ -0,0 +1,362 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+// Benchmark of the NAG NLP plugins on scalable problems.
+//
+// Each run is printed as a single JSON object per line, so that the
+// output can easily be compared between versions of the plugin or of
+// the NAG library.
+
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/detail/atomic_count.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/program_options.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/variant/get.hpp>
+
+#include <roboptim/core/differentiable-function.hh>
+#include <roboptim/core/solver.hh>
+#include <roboptim/core/solver-factory.hh>
+
+using namespace roboptim;
+
+// Allocation counter: the calls to operator new of the process are
+// counted, including the ones done by the plugins (STL containers,
+// roboptim objects). Eigen (aligned_malloc) and NAG call malloc
+// directly, so their allocations are not counted here: the Eigen
+// allocations of the NAG callbacks are reported separately by the
+// allocation audit builds ("callback_allocations", see
+// nag-allocation-audit.hh). Pool threads allocate too, so the counter
+// is atomic.
+static boost::detail::atomic_count allocations (0);
+
+void* operator new (std::size_t size) throw (std::bad_alloc)
+{
+  ++allocations;
+  void* p = std::malloc (size ? size : 1);
+  if (!p) throw std::bad_alloc ();
+  return p;
+}
+
+void* operator new[] (std::size_t size) throw (std::bad_alloc)
+{
+  return operator new (size);
+}
+
+void operator delete (void* p) throw ()
+{
+  std::free (p);
+}
+
+void operator delete[] (void* p) throw ()
+{
+  std::free (p);
+}
+
+namespace
+{
+  double now ()
+  {
+    static const boost::posix_time::ptime epoch =
+      boost::posix_time::microsec_clock::universal_time ();
+    return static_cast<double>
+      ((boost::posix_time::microsec_clock::universal_time () - epoch)
+       .total_microseconds ()) * 1e-6;
+  }
+
+  /// \brief Chained Rosenbrock function.
+  ///
+  /// f(x) = sum_i 100 (x_{i+1} - x_i^2)^2 + (1 - x_i)^2
+  template <typename T>
+  struct ChainedRosenbrock : public GenericDifferentiableFunction<T>
+  {
+    ROBOPTIM_DIFFERENTIABLE_FUNCTION_FWD_TYPEDEFS_
+    (GenericDifferentiableFunction<T>);
+
+    explicit ChainedRosenbrock (size_type n)
+      : GenericDifferentiableFunction<T> (n, 1, "chained Rosenbrock")
+    {
+    }
+
+    void impl_compute (result_ref result, const_argument_ref x) const
+    {
+      result[0] = 0.;
+      for (size_type i = 0; i + 1 < this->inputSize (); ++i)
+        result[0] += 100. * (x[i + 1] - x[i] * x[i]) * (x[i + 1] - x[i] * x[i])
+          + (1. - x[i]) * (1. - x[i]);
+    }
+
+    void impl_gradient (gradient_ref grad, const_argument_ref x,
+                        size_type) const
+    {
+      for (size_type i = 0; i < this->inputSize (); ++i)
+      {
+        value_type g = 0.;
+        if (i + 1 < this->inputSize ())
+          g += -400. * x[i] * (x[i + 1] - x[i] * x[i]) - 2. * (1. - x[i]);
+        if (i > 0)
+          g += 200. * (x[i] - x[i - 1] * x[i - 1]);
+        grad.coeffRef (i) = g;
+      }
+    }
+  };
+
+  /// \brief Chained nonlinear constraints.
+  ///
+  /// g_i(x) = x_i^2 + x_{i+1}^2, for i in [0, n - 2]
+  template <typename T>
+  struct ChainedConstraint : public GenericDifferentiableFunction<T>
+  {
+    ROBOPTIM_DIFFERENTIABLE_FUNCTION_FWD_TYPEDEFS_
+    (GenericDifferentiableFunction<T>);
+
+    explicit ChainedConstraint (size_type n)
+      : GenericDifferentiableFunction<T> (n, n - 1, "chained constraint")
+    {
+    }
+
+    void impl_compute (result_ref result, const_argument_ref x) const
+    {
+      for (size_type i = 0; i < this->outputSize (); ++i)
+        result[i] = x[i] * x[i] + x[i + 1] * x[i + 1];
+    }
+
+    void impl_gradient (gradient_ref grad, const_argument_ref x,
+                        size_type i) const
+    {
+      grad.coeffRef (i) = 2. * x[i];
+      grad.coeffRef (i + 1) = 2. * x[i + 1];
+    }
+
+    void impl_jacobian (jacobian_ref jac, const_argument_ref x) const
+    {
+      for (size_type i = 0; i < this->outputSize (); ++i)
+      {
+        jac.coeffRef (i, i) = 2. * x[i];
+        jac.coeffRef (i, i + 1) = 2. * x[i + 1];
+      }
+    }
+  };
+
+  /// \brief Benchmark options.
+  struct Options
+  {
+    std::vector<int> sizes;
+    int repeat;
+    int threads;
+    bool warmStart;
+  };
+
+  /// \brief Keep a pointer to the solver state filled by the plugin.
+  template <typename P, typename S>
+  void storeState (S*& state, const P&, S& current)
+  {
+    state = &current;
+  }
+
+  template <typename S>
+  double stateValue (S* state, const std::string& key)
+  {
+    if (!state || state->parameters ().find (key) == state->parameters ().end ())
+      return 0.;
+    const typename S::parameters_t::mapped_type& p = state->parameters ()[key];
+    if (const int* i = boost::get<int> (&p.value))
+      return *i;
+    if (const double* d = boost::get<double> (&p.value))
+      return *d;
+    return 0.;
+  }
+
+  /// \brief Benchmark a plugin on the chained problem of size n.
+  template <typename T>
+  void run (std::ostream& out, const std::string& plugin,
+            int n, const Options& options)
+  {
+    typedef Solver<T> solver_t;
+    typedef typename solver_t::problem_t problem_t;
+    typedef typename solver_t::solverState_t solverState_t;
+
+    ChainedRosenbrock<T> cost (n);
+    boost::shared_ptr<ChainedConstraint<T> > cstr
+      (new ChainedConstraint<T> (n));
+
+    problem_t pb (cost);
+    typename problem_t::intervals_t bounds
+      (static_cast<std::size_t> (n - 1),
+       ChainedConstraint<T>::makeInterval (-ChainedConstraint<T>::infinity (),
+                                           4.));
+    pb.addConstraint (cstr, bounds);
+
+    typename problem_t::vector_t x0 (n);
+    for (int i = 0; i < n; ++i)
+      x0[i] = (i % 2 == 0) ? -1.2 : 1.;
+    pb.startingPoint () = x0;
+
+    double start = now ();
+    SolverFactory<solver_t> factory (plugin, pb);
+    solver_t& solver = factory ();
+    const double loadTime = now () - start;
+
+    solver.parameters ()["nag.statistics"].value = 1;
+    solver.parameters ()["nag.eval-threads"].value = options.threads;
+    solver.parameters ()["nag.warm-start"].value = options.warmStart ? 1 : 0;
+
+    solverState_t* state = 0;
+    solver.setIterationCallback
+      (boost::bind (&storeState<problem_t, solverState_t>,
+                    boost::ref (state), _1, _2));
+
+    for (int k = 0; k < options.repeat; ++k)
+    {
+      const long allocs = allocations;
+      start = now ();
+      solver.solve ();
+      const double totalTime = now () - start;
+      const long solveAllocs = allocations - allocs;
+
+      const typename solver_t::result_t& res = solver.minimum ();
+      std::string status = "error";
+      double value = 0.;
+      if (res.which () == solver_t::SOLVER_VALUE)
+      {
+        status = "ok";
+        value = boost::get<Result> (res).value[0];
+      }
+      else if (res.which () == solver_t::SOLVER_VALUE_WARNINGS)
+      {
+        status = "warnings";
+        value = boost::get<ResultWithWarnings> (res).value[0];
+      }
+
+      out << "{\"plugin\": \"" << plugin << "\""
+          << ", \"problem\": \"chained-rosenbrock\""
+          << ", \"n\": " << n
+          << ", \"nnz\": " << 2 * (n - 1)
+          << ", \"solve\": " << k
+          << ", \"status\": \"" << status << "\""
+          << ", \"cost\": " << value
+          << ", \"load_time\": " << ((k == 0) ? loadTime : 0.)
+          << ", \"total_time\": " << totalTime
+          << ", \"setup_time\": "
+          << stateValue (state, "nag.statistics.setup.time")
+          << ", \"cost_time\": "
+          << stateValue (state, "nag.statistics.cost.time")
+          << ", \"constraints_time\": "
+          << stateValue (state, "nag.statistics.constraints.time")
+          << ", \"jacobian_time\": "
+          << stateValue (state, "nag.statistics.jacobian.time")
+          << ", \"callback_time\": "
+          << stateValue (state, "nag.statistics.callback.time")
+          << ", \"cost_evaluations\": "
+          << stateValue (state, "nag.statistics.cost.count")
+          << ", \"constraint_evaluations\": "
+          << stateValue (state, "nag.statistics.constraints.count")
+          << ", \"jacobian_evaluations\": "
+          << stateValue (state, "nag.statistics.jacobian.count")
+          << ", \"allocations\": " << solveAllocs
+          << ", \"callback_allocations\": "
+          << stateValue (state, "nag.statistics.evaluation.allocations")
+          << "}" << std::endl;
+    }
+  }
+} // end of unnamed namespace
+
+int main (int argc, char** argv)
+{
+  namespace po = boost::program_options;
+
+  Options options;
+  std::string output;
+  std::vector<std::string> plugins;
+
+  po::options_description desc ("Options");
+  desc.add_options ()
+    ("help,h", "display this help")
+    ("plugin,p", po::value<std::vector<std::string> > (&plugins),
+     "plugins to benchmark (nag-nlp, nag-nlp-sparse)")
+    ("size,n", po::value<std::vector<int> > (&options.sizes),
+     "problem sizes")
+    ("repeat,r", po::value<int> (&options.repeat)->default_value (5),
+     "number of solves per problem (same solver instance)")
+    ("threads,t", po::value<int> (&options.threads)->default_value (1),
+     "number of threads evaluating the constraints")
+    ("warm-start,w", po::bool_switch (&options.warmStart),
+     "warm start the repeated solves")
+    ("output,o", po::value<std::string> (&output),
+     "output file (default: standard output)");
+
+  po::variables_map vm;
+  po::store (po::parse_command_line (argc, argv, desc), vm);
+  po::notify (vm);
+
+  if (vm.count ("help"))
+  {
+    std::cout << desc << std::endl;
+    return 0;
+  }
+
+  if (plugins.empty ())
+  {
+    plugins.push_back ("nag-nlp");
+    plugins.push_back ("nag-nlp-sparse");
+  }
+
+  if (options.sizes.empty ())
+  {
+    options.sizes.push_back (10);
+    options.sizes.push_back (50);
+    options.sizes.push_back (100);
+    options.sizes.push_back (200);
+    options.sizes.push_back (500);
+  }
+
+#ifdef PLUGIN_PATH
+  // Load the plugins from the build tree.
+  setenv ("LTDL_LIBRARY_PATH", PLUGIN_PATH, 0);
+#endif //! PLUGIN_PATH
+
+  std::ofstream file;
+  if (!output.empty ())
+    file.open (output.c_str ());
+  std::ostream& out = output.empty () ? std::cout : file;
+
+  for (std::size_t p = 0; p < plugins.size (); ++p)
+    for (std::size_t i = 0; i < options.sizes.size (); ++i)
+    {
+      try
+      {
+        if (plugins[p] == "nag-nlp-sparse")
+          run<EigenMatrixSparse> (out, plugins[p], options.sizes[i], options);
+        else
+          run<EigenMatrixDense> (out, plugins[p], options.sizes[i], options);
+      }
+      catch (const std::exception& e)
+      {
+        std::cerr << plugins[p] << " (n = " << options.sizes[i]
+                  << "): " << e.what () << std::endl;
+      }
+    }
+
+  return 0;
+}
@@ -0,0 +1,496 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+// Replay a snapshot recorded by the nag-nlp or nag-nlp-sparse plugins
+// ("nag.snapshot" parameter).
+//
+// NAG is called with the recorded inputs, and the user functions are
+// replaced by the recorded evaluations, so that the time spent in NAG
+// can be measured without the problem code. The replay stops if NAG
+// requests an evaluation at a different point than during the
+// recording (e.g. after a change of the NAG library or of the
+// options). The result is printed as a single JSON object.
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/program_options.hpp>
+
+#include <nag.h>
+#include <nage04.h>
+
+#include <roboptim/core/plugin/nag/nag-snapshot.hh>
+
+using namespace roboptim;
+
+namespace
+{
+  double now ()
+  {
+    static const boost::posix_time::ptime epoch =
+      boost::posix_time::microsec_clock::universal_time ();
+    return static_cast<double>
+      ((boost::posix_time::microsec_clock::universal_time () - epoch)
+       .total_microseconds ()) * 1e-6;
+  }
+
+  /// \brief Recorded evaluations of one user function.
+  struct Evaluations
+  {
+    Evaluations (const NagSnapshot& snapshot, NagSnapshot::tag_t tag)
+      : records (snapshot.sections (tag)),
+        next (0)
+    {
+    }
+
+    std::vector<const NagSnapshot::Section*> records;
+    std::size_t next;
+  };
+
+  /// \brief State of a replay, given to the NAG callbacks.
+  struct Replay
+  {
+    Replay (const NagSnapshot& s, double tol)
+      : snapshot (s),
+        tolerance (tol),
+        nonlinearRows (0),
+        nonlinearEntries (0),
+        evaluations (s, NagSnapshot::EVALUATION),
+        constraints (s, NagSnapshot::CONSTRAINTS_EVALUATION),
+        cost (s, NagSnapshot::COST_EVALUATION),
+        divergence ()
+    {
+    }
+
+    /// \brief Next record of a user function, null on divergence.
+    /// \param e recorded evaluations.
+    /// \param flags flags of the request (needf/needg or mode).
+    /// \param n size of x.
+    /// \param x point requested by NAG.
+    /// \param size expected size of the record.
+    const double* next (Evaluations& e, const std::vector<double>& flags,
+                        Integer n, const double x[], std::size_t size)
+    {
+      if (!divergence.empty ()) return 0;
+
+      if (e.next >= e.records.size ())
+      {
+        divergence = "more evaluations than recorded";
+        return 0;
+      }
+
+      const NagSnapshot::Section& s = *e.records[e.next++];
+      const double* d = s.reals ();
+      if (s.size != size ||
+          !std::equal (flags.begin (), flags.end (), d))
+      {
+        divergence = "different evaluation request";
+        return 0;
+      }
+
+      d += flags.size ();
+      for (Integer i = 0; i < n; ++i)
+        if (std::abs (d[i] - x[i]) > tolerance)
+        {
+          divergence = "different evaluation point";
+          return 0;
+        }
+
+      return d + n;
+    }
+
+    /// \brief Number of replayed evaluations.
+    std::size_t replayed () const
+    {
+      return evaluations.next + constraints.next + cost.next;
+    }
+
+    /// \brief Number of recorded evaluations.
+    std::size_t recorded () const
+    {
+      return evaluations.records.size () + constraints.records.size () +
+             cost.records.size ();
+    }
+
+    const NagSnapshot& snapshot;
+    double tolerance;
+    /// \brief Number of rows of f recorded by usrfun (sparse solver).
+    std::size_t nonlinearRows;
+    /// \brief Number of entries of g recorded by usrfun (sparse solver).
+    std::size_t nonlinearEntries;
+    Evaluations evaluations;
+    Evaluations constraints;
+    Evaluations cost;
+    /// \brief Reason of the divergence, empty if none.
+    std::string divergence;
+  };
+
+  /// \brief Result of a replay.
+  struct Outcome
+  {
+    std::string message;
+    bool ok;
+    double cost;
+    double solveTime;
+  };
+
+  void usrfun (Integer* status, Integer n, const double x[], Integer needf,
+               Integer /*nf*/, double f[], Integer needg,
+               Integer /*leng*/, double g[], Nag_Comm* comm)
+  {
+    if (*status >= 2) return;
+    Replay* replay = static_cast<Replay*> (comm->p);
+
+    std::vector<double> flags (2);
+    flags[0] = static_cast<double> (needf);
+    flags[1] = static_cast<double> (needg);
+    const std::size_t nf_ = (needf > 0) ? replay->nonlinearRows : 0;
+    const std::size_t ng_ = (needg > 0) ? replay->nonlinearEntries : 0;
+
+    const double* d =
+      replay->next (replay->evaluations, flags, n, x,
+                    2 + static_cast<std::size_t> (n) + nf_ + ng_);
+    if (!d)
+    {
+      *status = -2;
+      return;
+    }
+
+    std::copy (d, d + nf_, f);
+    std::copy (d + nf_, d + nf_ + ng_, g);
+  }
+
+  void confun (Integer* mode, Integer ncnln, Integer n, Integer tdcj,
+               const Integer needc[], const double x[], double ccon[],
+               double cjac[], Integer, Nag_Comm* comm)
+  {
+    Replay* replay = static_cast<Replay*> (comm->p);
+
+    std::vector<double> flags (1, static_cast<double> (*mode));
+    flags.insert (flags.end (), needc, needc + ncnln);
+    const std::size_t ncnln_ = static_cast<std::size_t> (ncnln);
+    const std::size_t nc = (*mode == 0 || *mode == 2) ? ncnln_ : 0;
+    const std::size_t nj =
+      (*mode == 1 || *mode == 2) ? ncnln_ * static_cast<std::size_t> (tdcj)
+                                 : 0;
+
+    const double* d =
+      replay->next (replay->constraints, flags, n, x,
+                    flags.size () + static_cast<std::size_t> (n) + nc + nj);
+    if (!d)
+    {
+      *mode = -1;
+      return;
+    }
+
+    std::copy (d, d + nc, ccon);
+    std::copy (d + nc, d + nc + nj, cjac);
+  }
+
+  void objfun (Integer* mode, Integer n, const double x[], double* objf,
+               double grad[], Integer, Nag_Comm* comm)
+  {
+    Replay* replay = static_cast<Replay*> (comm->p);
+
+    std::vector<double> flags (1, static_cast<double> (*mode));
+    const std::size_t nf = (*mode == 0 || *mode == 2) ? 1 : 0;
+    const std::size_t ng =
+      (*mode == 1 || *mode == 2) ? static_cast<std::size_t> (n) : 0;
+
+    const double* d =
+      replay->next (replay->cost, flags, n, x,
+                    1 + static_cast<std::size_t> (n) + nf + ng);
+    if (!d)
+    {
+      *mode = -1;
+      return;
+    }
+
+    std::copy (d, d + nf, objf);
+    std::copy (d + nf, d + nf + ng, grad);
+  }
+
+  void checkNagError (const NagError& fail, const std::string& what)
+  {
+    if (fail.code != NE_NOERROR)
+      throw std::runtime_error (what + ": " + fail.message);
+  }
+
+  /// \brief Options of the snapshot followed by the extra ones.
+  std::vector<std::string> options (const NagSnapshot& snapshot,
+                                    const std::vector<std::string>& extra)
+  {
+    std::vector<std::string> res;
+    std::vector<const NagSnapshot::Section*> sections =
+      snapshot.sections (NagSnapshot::OPTION);
+    for (std::size_t i = 0; i < sections.size (); ++i)
+      res.push_back (sections[i]->text ());
+    res.insert (res.end (), extra.begin (), extra.end ());
+    return res;
+  }
+
+  /// \brief Replay a nag_opt_sparse_nlp_solve snapshot.
+  Outcome replaySparse (Replay& replay, const std::vector<std::string>& extra)
+  {
+    const NagSnapshot& s = replay.snapshot;
+    const NagSnapshot::Section& dims = s.section (NagSnapshot::DIMENSIONS);
+    if (dims.size < 10) throw std::runtime_error ("invalid dimensions");
+    const Integer nf = dims.integers ()[0];
+    const Integer n = dims.integers ()[1];
+    const Integer objrow = dims.integers ()[2];
+    const Integer lena = dims.integers ()[3];
+    const Integer nea = dims.integers ()[4];
+    const Integer leng = dims.integers ()[5];
+    const Integer neg = dims.integers ()[6];
+    const Nag_Start start = static_cast<Nag_Start> (dims.integers ()[7]);
+    Integer ns = dims.integers ()[8];
+    replay.nonlinearRows = static_cast<std::size_t> (dims.integers ()[9]);
+    replay.nonlinearEntries = static_cast<std::size_t> (neg);
+
+    // Arrays modified by NAG are copied, the others are mapped.
+    std::vector<Integer> iafun = s.section (NagSnapshot::IAFUN).toIntegers ();
+    std::vector<Integer> javar = s.section (NagSnapshot::JAVAR).toIntegers ();
+    std::vector<double> a = s.section (NagSnapshot::A).toReals ();
+    std::vector<Integer> igfun = s.section (NagSnapshot::IGFUN).toIntegers ();
+    std::vector<Integer> jgvar = s.section (NagSnapshot::JGVAR).toIntegers ();
+    std::vector<double> x = s.section (NagSnapshot::X).toReals ();
+    std::vector<Integer> xstate =
+      s.section (NagSnapshot::XSTATE).toIntegers ();
+    std::vector<double> xmul = s.section (NagSnapshot::XMUL).toReals ();
+    std::vector<double> f (static_cast<std::size_t> (nf), 0.);
+    std::vector<Integer> fstate =
+      s.section (NagSnapshot::FSTATE).toIntegers ();
+    std::vector<double> fmul = s.section (NagSnapshot::FMUL).toReals ();
+    Integer ninf = 0;
+    double sinf = 0.;
+
+    NagError fail;
+    std::memset (&fail, 0, sizeof (NagError));
+    INIT_FAIL (fail);
+    Nag_E04State state;
+    std::memset (&state, 0, sizeof (Nag_E04State));
+    nag_opt_sparse_nlp_init (&state, &fail);
+    checkNagError (fail, "cannot initialize NAG");
+
+    std::vector<std::string> opts = options (s, extra);
+    for (std::size_t i = 0; i < opts.size (); ++i)
+    {
+      nag_opt_sparse_nlp_option_set_string (opts[i].c_str (), &state, &fail);
+      checkNagError (fail, "invalid option " + opts[i]);
+    }
+
+    Nag_Comm comm;
+    std::memset (&comm, 0, sizeof (Nag_Comm));
+    comm.p = &replay;
+
+    const double t0 = now ();
+    nag_opt_sparse_nlp_solve (
+      start, nf, n, 1, 1, 0., objrow, "RobOptim problem", usrfun,
+      iafun.data (), javar.data (), a.data (), lena, nea, igfun.data (),
+      jgvar.data (), leng, neg, s.section (NagSnapshot::XLOW).reals (),
+      s.section (NagSnapshot::XUPP).reals (), 0,
+      s.section (NagSnapshot::FLOW).reals (),
+      s.section (NagSnapshot::FUPP).reals (), 0, x.data (), xstate.data (),
+      xmul.data (), f.data (), fstate.data (), fmul.data (), &ns, &ninf,
+      &sinf, &state, &comm, &fail);
+
+    Outcome res;
+    res.solveTime = now () - t0;
+    res.ok = fail.code == NE_NOERROR;
+    res.message = res.ok ? "" : fail.message;
+    res.cost = f[static_cast<std::size_t> (objrow - 1)];
+    return res;
+  }
+
+  /// \brief Replay a nag_opt_nlp_solve snapshot.
+  Outcome replayDense (Replay& replay, const std::vector<std::string>& extra)
+  {
+    const NagSnapshot& s = replay.snapshot;
+    const NagSnapshot::Section& dims = s.section (NagSnapshot::DIMENSIONS);
+    if (dims.size < 6) throw std::runtime_error ("invalid dimensions");
+    const Integer n = dims.integers ()[0];
+    const Integer nclin = dims.integers ()[1];
+    const Integer ncnln = dims.integers ()[2];
+    const Integer tda = dims.integers ()[3];
+    const Integer tdcj = dims.integers ()[4];
+    const Integer tdh = dims.integers ()[5];
+
+    // NAG expects valid pointers even for empty arrays.
+    const double dummy = 0.;
+    const NagSnapshot::Section& a = s.section (NagSnapshot::A);
+    std::vector<Integer> istate =
+      s.section (NagSnapshot::ISTATE).toIntegers ();
+    std::vector<double> clamda = s.section (NagSnapshot::CLAMDA).toReals ();
+    std::vector<double> h = s.section (NagSnapshot::H).toReals ();
+    std::vector<double> x = s.section (NagSnapshot::X).toReals ();
+    std::vector<double> ccon (static_cast<std::size_t> (ncnln) + 1, 0.);
+    std::vector<double> cjac
+      (static_cast<std::size_t> (ncnln * tdcj) + 1, 0.);
+    std::vector<double> grad (static_cast<std::size_t> (n), 0.);
+    double objf = 0.;
+    Integer majits = 0;
+
+    NagError fail;
+    std::memset (&fail, 0, sizeof (NagError));
+    INIT_FAIL (fail);
+    Nag_E04State state;
+    std::memset (&state, 0, sizeof (Nag_E04State));
+    nag_opt_nlp_init (&state, &fail);
+    checkNagError (fail, "cannot initialize NAG");
+
+    std::vector<std::string> opts = options (s, extra);
+    for (std::size_t i = 0; i < opts.size (); ++i)
+    {
+      nag_opt_nlp_option_set_string (opts[i].c_str (), &state, &fail);
+      checkNagError (fail, "invalid option " + opts[i]);
+    }
+
+    Nag_Comm comm;
+    std::memset (&comm, 0, sizeof (Nag_Comm));
+    comm.p = &replay;
+
+    const double t0 = now ();
+    nag_opt_nlp_solve (n, nclin, ncnln, tda, tdcj, tdh,
+                       a.size ? a.reals () : &dummy,
+                       s.section (NagSnapshot::BL).reals (),
+                       s.section (NagSnapshot::BU).reals (), confun, objfun,
+                       &majits, istate.data (), ccon.data (), cjac.data (),
+                       clamda.data (), &objf, grad.data (), h.data (),
+                       x.data (), &state, &comm, &fail);
+
+    Outcome res;
+    res.solveTime = now () - t0;
+    res.ok = fail.code == NE_NOERROR;
+    res.message = res.ok ? "" : fail.message;
+    res.cost = objf;
+    return res;
+  }
+
+  /// \brief Print the sections of a snapshot.
+  void summary (std::ostream& out, const NagSnapshot& s)
+  {
+    out << "solver: "
+        << ((s.solver () == NagSnapshot::SPARSE_NLP) ? "nag-nlp-sparse"
+                                                     : "nag-nlp")
+        << std::endl;
+
+    std::vector<const NagSnapshot::Section*> options =
+      s.sections (NagSnapshot::OPTION);
+    for (std::size_t i = 0; i < options.size (); ++i)
+      out << "option: " << options[i]->text () << std::endl;
+
+    std::size_t evaluations = 0;
+    std::size_t bytes = 0;
+    for (std::size_t i = 0; i < s.sections ().size (); ++i)
+    {
+      const NagSnapshot::Section& section = s.sections ()[i];
+      if (section.tag == NagSnapshot::EVALUATION ||
+          section.tag == NagSnapshot::CONSTRAINTS_EVALUATION ||
+          section.tag == NagSnapshot::COST_EVALUATION)
+      {
+        ++evaluations;
+        bytes += section.size * sizeof (double);
+      }
+      else if (section.tag != NagSnapshot::OPTION)
+        out << "section " << section.tag << ": " << section.size
+            << " elements" << std::endl;
+    }
+    out << "evaluations: " << evaluations << " (" << bytes << " bytes)"
+        << std::endl;
+  }
+} // end of unnamed namespace
+
+int main (int argc, char** argv)
+{
+  namespace po = boost::program_options;
+
+  std::string filename;
+  std::vector<std::string> extra;
+  double tolerance;
+
+  po::options_description desc ("Options");
+  desc.add_options ()
+    ("help,h", "display this help")
+    ("snapshot,s", po::value<std::string> (&filename), "snapshot file")
+    ("option,O", po::value<std::vector<std::string> > (&extra),
+     "additional NAG option (e.g. \"Major Print Level = 1\")")
+    ("tolerance", po::value<double> (&tolerance)->default_value (0.),
+     "tolerance on the evaluation points")
+    ("summary", "only print the content of the snapshot");
+
+  po::positional_options_description positional;
+  positional.add ("snapshot", 1);
+
+  po::variables_map vm;
+  po::store (po::command_line_parser (argc, argv)
+             .options (desc).positional (positional).run (), vm);
+  po::notify (vm);
+
+  if (vm.count ("help") || filename.empty ())
+  {
+    std::cout << "Usage: " << argv[0] << " [options] snapshot" << std::endl
+              << desc << std::endl;
+    return vm.count ("help") ? 0 : 1;
+  }
+
+  try
+  {
+    NagSnapshot snapshot (filename);
+
+    if (vm.count ("summary"))
+    {
+      summary (std::cout, snapshot);
+      return 0;
+    }
+
+    Replay replay (snapshot, tolerance);
+    if (replay.recorded () == 0)
+      throw std::runtime_error ("no evaluation recorded in " + filename +
+                                " (see nag.snapshot-evaluations)");
+
+    const Outcome res = (snapshot.solver () == NagSnapshot::SPARSE_NLP)
+                          ? replaySparse (replay, extra)
+                          : replayDense (replay, extra);
+
+    std::cout << "{\"snapshot\": \"" << filename << "\""
+              << ", \"status\": \"" << (res.ok ? "ok" : "error") << "\""
+              << ", \"cost\": " << res.cost
+              << ", \"solve_time\": " << res.solveTime
+              << ", \"evaluations\": " << replay.replayed ()
+              << ", \"recorded_evaluations\": " << replay.recorded ()
+              << ", \"diverged\": "
+              << (replay.divergence.empty () ? "false" : "true")
+              << "}" << std::endl;
+
+    if (!replay.divergence.empty ())
+      std::cerr << "replay diverged: " << replay.divergence << std::endl;
+    else if (!res.ok)
+      std::cerr << "NAG error: " << res.message << std::endl;
+    return replay.divergence.empty () ? 0 : 2;
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << e.what () << std::endl;
+    return 1;
+  }
+}
@@ -0,0 +1,152 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef ROBOPTIM_CORE_NAG_ALLOCATION_AUDIT_HH
+# define ROBOPTIM_CORE_NAG_ALLOCATION_AUDIT_HH
+
+// Audit of the heap allocations made in the NAG callbacks.
+//
+// The NAG_ALLOCATION_AUDIT CMake option defines
+// ROBOPTIM_NAG_ALLOCATION_AUDIT to 1 (COUNT) or 2 (TRAP). Eigen is then
+// compiled with EIGEN_RUNTIME_NO_MALLOC, and its allocations are
+// forbidden in the scope of NagAllocationScope:
+//  - COUNT: the allocations are counted, and published with the
+//    statistics ("nag.statistics.evaluation.allocations"),
+//  - TRAP: the first allocation aborts the program.
+//
+// Eigen reports forbidden allocations through eigen_assert, which is
+// redefined here: this header must be included before any Eigen
+// header. Only the Eigen allocations of the plugin code are seen:
+// STL containers, and user functions compiled in other modules, are
+// not audited. The Eigen switch is global to the plugin, so solves
+// must not run concurrently in audit builds.
+//
+// The Eigen templates instantiated by the plugin are weak symbols: at
+// load time, they could be resolved to the unaudited copies of a
+// library loaded before (e.g. libroboptim-core) and miss allocations.
+// Audit builds link the plugins with -Bsymbolic to keep their own
+// copies. On platforms without this flag, the counts are only lower
+// bounds.
+
+# ifdef ROBOPTIM_NAG_ALLOCATION_AUDIT
+#  ifdef EIGEN_WORLD_VERSION
+#   error "nag-allocation-audit.hh must be included before Eigen"
+#  endif
+
+#  ifndef EIGEN_RUNTIME_NO_MALLOC
+#   define EIGEN_RUNTIME_NO_MALLOC
+#  endif
+
+#  include <cstdio>
+#  include <cstdlib>
+#  include <cstring>
+
+#  include <boost/detail/atomic_count.hpp>
+
+namespace roboptim
+{
+  /// \brief Number of forbidden Eigen allocations (all threads).
+  inline boost::detail::atomic_count& nagForbiddenAllocations ()
+  {
+    static boost::detail::atomic_count count (0);
+    return count;
+  }
+
+  /// \brief Replacement of eigen_assert.
+  ///
+  /// Forbidden allocations are counted (COUNT) or abort (TRAP). Other
+  /// assertions keep their usual behavior.
+  inline void nagEigenAssert (bool condition, const char* expression,
+                              const char* file, int line)
+  {
+    if (condition) return;
+
+    const bool allocation =
+      !!std::strstr (expression, "heap allocation is forbidden");
+    if (allocation && ROBOPTIM_NAG_ALLOCATION_AUDIT == 1)
+    {
+      ++nagForbiddenAllocations ();
+      return;
+    }
+
+#  ifdef NDEBUG
+    if (!allocation) return;
+    std::fprintf (stderr, "%s:%d: heap allocation in a NAG callback\n",
+                  file, line);
+#  else
+    std::fprintf (stderr, "%s:%d: Eigen assertion failed: %s\n",
+                  file, line, expression);
+#  endif //! NDEBUG
+    std::abort ();
+  }
+} // end of namespace roboptim
+
+#  define eigen_assert(x)                                               \
+  ::roboptim::nagEigenAssert (static_cast<bool> (x), #x, __FILE__, __LINE__)
+# endif //! ROBOPTIM_NAG_ALLOCATION_AUDIT
+
+# include <boost/noncopyable.hpp>
+
+# include <Eigen/Core>
+
+# include "roboptim/core/plugin/nag/nag-statistics.hh"
+
+namespace roboptim
+{
+  /// \brief Scope in which the Eigen allocations are audited.
+  ///
+  /// Allocations are added to the given counter. This does nothing
+  /// unless the plugins are built with NAG_ALLOCATION_AUDIT.
+  class NagAllocationScope : private boost::noncopyable
+  {
+  public:
+    explicit NagAllocationScope (NagStatistics::Counter& counter)
+# ifdef ROBOPTIM_NAG_ALLOCATION_AUDIT
+      : counter_ (counter),
+        start_ (nagForbiddenAllocations ()),
+        allowed_ (Eigen::internal::is_malloc_allowed ())
+    {
+      Eigen::internal::set_is_malloc_allowed (false);
+    }
+# else
+    {
+      (void) counter;
+    }
+# endif //! ROBOPTIM_NAG_ALLOCATION_AUDIT
+
+    ~NagAllocationScope ()
+    {
+# ifdef ROBOPTIM_NAG_ALLOCATION_AUDIT
+      Eigen::internal::set_is_malloc_allowed (allowed_);
+      counter_.allocations += static_cast<std::size_t>
+        (nagForbiddenAllocations () - start_);
+# endif //! ROBOPTIM_NAG_ALLOCATION_AUDIT
+    }
+
+# ifdef ROBOPTIM_NAG_ALLOCATION_AUDIT
+  private:
+    /// \brief Updated counter.
+    NagStatistics::Counter& counter_;
+    /// \brief Forbidden allocations before the scope.
+    long start_;
+    /// \brief Whether allocations were allowed before the scope.
+    bool allowed_;
+# endif //! ROBOPTIM_NAG_ALLOCATION_AUDIT
+  };
+} // end of namespace roboptim
+
+#endif //! ROBOPTIM_CORE_NAG_ALLOCATION_AUDIT_HH
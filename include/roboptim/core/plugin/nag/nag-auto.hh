@@ -0,0 +1,161 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef ROBOPTIM_CORE_PLUGIN_NAG_NAG_AUTO_HH
+# define ROBOPTIM_CORE_PLUGIN_NAG_NAG_AUTO_HH
+
+# include <set>
+# include <string>
+# include <vector>
+
+# include <boost/shared_ptr.hpp>
+
+# include <roboptim/core/portability.hh>
+# include <roboptim/core/function.hh>
+# include <roboptim/core/differentiable-function.hh>
+# include <roboptim/core/solver-factory.hh>
+
+# include "roboptim/core/plugin/nag/nag-common.hh"
+
+namespace roboptim
+{
+  /// \addtogroup roboptim_solver
+  /// @{
+
+  /// \brief Solver choosing the NAG plugin suited to the problem.
+  ///
+  /// The problem is inspected once, when the solver is created:
+  ///  - cost functions without gradient are given to nag (one bounded
+  ///    variable) or nag-simplex (no bounds, no constraints),
+  ///  - differentiable cost functions of one bounded variable without
+  ///    constraints are given to nag-differentiable,
+  ///  - other problems are given to nag-nlp, unless they are large or
+  ///    their constraint Jacobian is sparse. They are then converted
+  ///    once to a sparse problem solved by nag-nlp-sparse.
+  ///
+  /// The densities of the linear and of the nonlinear constraint rows
+  /// are computed apart, and the Jacobian is sparse when each of them
+  /// is: a problem with only sparse linear constraints is sparse
+  /// whatever its nonlinear part would have been, while one dense
+  /// nonlinear constraint keeps the problem on nag-nlp even among many
+  /// sparse linear rows. The nonlinear rows are sampled at the starting
+  /// point and at a few points around it (see NagPatternProbes). The
+  /// sampled patterns are only used for this choice, since they may
+  /// miss entries: when the problem is converted, nonlinear constraints
+  /// declaring their pattern (NagJacobianPattern) keep it, and the
+  /// other ones are passed as dense blocks (NagSparseAdapter).
+  ///
+  /// The parameters of this solver are the ones of the chosen plugin,
+  /// and they are forwarded to it before each solve, as well as the
+  /// bound and starting point updates. Other "nag.*" options set on
+  /// this solver are added to the plugin (and removed from it when they
+  /// are erased here). The choice is reported by the
+  /// "nag.auto.backend", "nag.auto.reason", "nag.auto.density",
+  /// "nag.auto.linear-density" and "nag.auto.nonlinear-density"
+  /// parameters, which are not forwarded. Results follow the
+  /// conventions of the chosen plugin.
+  class ROBOPTIM_DLLEXPORT NagSolverAuto
+    : public NagSolverCommon<EigenMatrixDense>
+  {
+  public:
+    typedef NagSolverCommon<EigenMatrixDense> parent_t;
+
+    /// \brief Sparse solver used for large or sparse problems.
+    typedef Solver<EigenMatrixSparse> sparseSolver_t;
+
+    explicit NagSolverAuto (const problem_t& pb);
+    virtual ~NagSolverAuto ();
+
+    /// \brief Solve the problem with the chosen plugin.
+    void solve ();
+
+    /// \brief Ask the current (or next) solve of the plugin to stop.
+    void cancel ();
+
+    /// \brief Name of the chosen plugin.
+    const std::string& backend () const
+    {
+      return backend_;
+    }
+
+    void setIterationCallback (callback_t callback)
+    {
+      callback_ = callback;
+    }
+
+    const callback_t& callback () const
+    {
+      return callback_;
+    }
+
+    solverState_t& solverState ()
+    {
+      return solverState_;
+    }
+
+  private:
+    /// \brief Choose the plugin, and convert the problem if needed.
+    void chooseBackend ();
+
+    /// \brief Convert the problem for nag-nlp-sparse.
+    void convertToSparse ();
+
+    /// \brief Copy the parameters of the chosen plugin.
+    void copyBackendParameters (const parameters_t& parameters);
+
+    /// \brief Give the parameters and the updates to the chosen plugin.
+    template <typename T>
+    void forwardUpdates (Solver<T>& solver);
+
+    /// \brief Solve the problem with the chosen plugin.
+    template <typename T>
+    void solveWith (Solver<T>& solver);
+
+    /// \brief Forward the iteration callback of the chosen plugin.
+    template <typename P, typename S>
+    void forwardCallback (const P& pb, S& state);
+
+    /// \brief Name of the chosen plugin.
+    std::string backend_;
+
+    /// \brief Plugin solving the problem as is.
+    boost::shared_ptr<SolverFactory<solver_t> > denseFactory_;
+
+    /// \brief Sparse version of the cost function.
+    boost::shared_ptr<GenericDifferentiableFunction<EigenMatrixSparse> >
+      sparseCost_;
+
+    /// \brief Sparse version of the problem.
+    boost::shared_ptr<sparseSolver_t::problem_t> sparseProblem_;
+
+    /// \brief Plugin solving the sparse version of the problem.
+    boost::shared_ptr<SolverFactory<sparseSolver_t> > sparseFactory_;
+
+    /// \brief NAG options added to the plugin by forwardUpdates.
+    std::set<std::string> forwardedParameters_;
+
+    /// \brief Per-iteration callback function.
+    callback_t callback_;
+
+    /// \brief Current solver state used by callback.
+    solverState_t solverState_;
+  };
+
+  /// @}
+} // end of namespace roboptim
+
+#endif //! ROBOPTIM_CORE_PLUGIN_NAG_NAG_AUTO_HH
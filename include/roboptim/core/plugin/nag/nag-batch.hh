@@ -0,0 +1,238 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef ROBOPTIM_CORE_NAG_BATCH_HH
+# define ROBOPTIM_CORE_NAG_BATCH_HH
+
+# include <algorithm>
+# include <string>
+# include <vector>
+# include <stdexcept>
+
+# include <boost/shared_ptr.hpp>
+# include <boost/variant/get.hpp>
+
+# include <roboptim/core/portability.hh>
+# include <roboptim/core/solver.hh>
+# include <roboptim/core/solver-factory.hh>
+
+# include "roboptim/core/plugin/nag/nag-thread-pool.hh"
+
+namespace roboptim
+{
+  /// \addtogroup roboptim_solver
+  /// @{
+
+  /// \brief Solve a batch of problems sharing the same structure.
+  ///
+  /// Typical use is a multi-start strategy: the same problem is solved
+  /// from several starting points to escape local minima. Each problem
+  /// gets its own solver instance (and thus its own NAG state and
+  /// communication object), so the solves can run concurrently.
+  ///
+  /// The plugin is loaded once per problem by the calling thread, then
+  /// the solves are distributed over a thread pool.
+  ///
+  /// Problems only refer to their cost and constraint functions. In
+  /// multi-start mode, all the solves share the functions of the given
+  /// problem, and the same holds for problems built from the same
+  /// functions: with more than one thread, these functions are evaluated
+  /// concurrently and must be thread-safe (no mutable caches shared
+  /// between calls). Otherwise, give each problem its own functions.
+  ///
+  /// \tparam T matrix type (EigenMatrixDense or EigenMatrixSparse).
+  template <typename T>
+  class NagBatchSolver
+  {
+  public:
+    typedef Solver<T> solver_t;
+    typedef typename solver_t::problem_t problem_t;
+    typedef typename solver_t::result_t result_t;
+    typedef typename solver_t::parameters_t parameters_t;
+    typedef typename problem_t::vector_t vector_t;
+    typedef SolverFactory<solver_t> factory_t;
+
+    /// \brief Create a batch solver.
+    /// \param plugin name of the plugin (e.g. "nag-nlp-sparse").
+    /// \param threads number of concurrent solves.
+    explicit NagBatchSolver (const std::string& plugin,
+                             std::size_t threads = 1)
+      : plugin_ (plugin),
+        threads_ (threads),
+        parameters_ (),
+        problems_ (),
+        factories_ (),
+        results_ (),
+        best_ (0)
+    {
+    }
+
+    /// \brief Parameters applied to every solver of the batch.
+    ///
+    /// Parameters not set here keep the plugin default values.
+    parameters_t& parameters ()
+    {
+      return parameters_;
+    }
+
+    /// \brief Solve a problem from several starting points.
+    ///
+    /// The functions of the problem are shared by all the solves (see
+    /// the thread-safety requirements above).
+    /// \param pb problem to solve.
+    /// \param startingPoints starting points, one solve per point.
+    void solve (const problem_t& pb,
+                const std::vector<vector_t>& startingPoints)
+    {
+      std::vector<problem_t> problems;
+      problems.reserve (startingPoints.size ());
+      for (std::size_t i = 0; i < startingPoints.size (); ++i)
+      {
+        problems.push_back (pb);
+        problems.back ().startingPoint () = startingPoints[i];
+      }
+      solve (problems);
+    }
+
+    /// \brief Solve several problems sharing the same structure.
+    /// \param problems problems to solve.
+    void solve (const std::vector<problem_t>& problems)
+    {
+      problems_ = problems;
+      factories_.clear ();
+      results_.clear ();
+      best_ = 0;
+
+      // Plugin loading is done sequentially.
+      for (std::size_t i = 0; i < problems_.size (); ++i)
+      {
+        factories_.push_back (
+          boost::shared_ptr<factory_t> (new factory_t (plugin_, problems_[i])));
+
+        solver_t& solver = (*factories_.back ()) ();
+        typedef typename parameters_t::const_iterator citer_t;
+        for (citer_t it = parameters_.begin (); it != parameters_.end (); ++it)
+          solver.parameters ()[it->first] = it->second;
+      }
+
+      results_.resize (problems_.size ());
+
+      NagThreadPool pool (std::max (std::size_t (1), threads_));
+      pool.run (problems_.size (), Task (this));
+
+      // Find the best solution.
+      best_ = results_.size ();
+      for (std::size_t i = 0; i < results_.size (); ++i)
+      {
+        const Result* res = result (i);
+        if (!res) continue;
+
+        if (best_ == results_.size () || res->value[0] < result (best_)->value[0])
+          best_ = i;
+      }
+
+      // Release the solvers, results are kept.
+      factories_.clear ();
+    }
+
+    /// \brief Results of the last batch, in the order of the problems.
+    const std::vector<result_t>& results () const
+    {
+      return results_;
+    }
+
+    /// \brief Index of the best result.
+    /// \return index of the successful solve with the lowest cost, or
+    /// results ().size () if no solve succeeded.
+    std::size_t bestIndex () const
+    {
+      return best_;
+    }
+
+    /// \brief Best result of the last batch.
+    /// \throw std::runtime_error if no solve succeeded.
+    const result_t& best () const
+    {
+      if (best_ >= results_.size ())
+        throw std::runtime_error ("no solution found in the batch");
+      return results_[best_];
+    }
+
+  private:
+    /// \brief Task running one solve of the batch.
+    struct Task
+    {
+      explicit Task (NagBatchSolver* batch)
+        : batch_ (batch)
+      {
+      }
+
+      void operator() (std::size_t i) const
+      {
+        try
+        {
+          batch_->results_[i] = (*batch_->factories_[i]) ().minimum ();
+        }
+        catch (const std::exception& e)
+        {
+          batch_->results_[i] = SolverError (e.what ());
+        }
+      }
+
+      NagBatchSolver* batch_;
+    };
+
+    /// \brief Successful result, null if the solve failed.
+    const Result* result (std::size_t i) const
+    {
+      switch (results_[i].which ())
+      {
+        case solver_t::SOLVER_VALUE:
+          return &boost::get<Result> (results_[i]);
+        case solver_t::SOLVER_VALUE_WARNINGS:
+          return &boost::get<ResultWithWarnings> (results_[i]);
+        default:
+          return 0;
+      }
+    }
+
+    /// \brief Name of the plugin.
+    std::string plugin_;
+
+    /// \brief Number of concurrent solves.
+    std::size_t threads_;
+
+    /// \brief Parameters applied to every solver.
+    parameters_t parameters_;
+
+    /// \brief Problems of the batch (solvers keep references to them).
+    std::vector<problem_t> problems_;
+
+    /// \brief Solver factories, one per problem.
+    std::vector<boost::shared_ptr<factory_t> > factories_;
+
+    /// \brief Results of the batch.
+    std::vector<result_t> results_;
+
+    /// \brief Index of the best result.
+    std::size_t best_;
+  };
+
+  /// @}
+} // end of namespace roboptim
+
+#endif //! ROBOPTIM_CORE_NAG_BATCH_HH
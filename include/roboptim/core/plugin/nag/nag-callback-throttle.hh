@@ -0,0 +1,92 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef ROBOPTIM_CORE_NAG_CALLBACK_THROTTLE_HH
+# define ROBOPTIM_CORE_NAG_CALLBACK_THROTTLE_HH
+
+# include <cstddef>
+
+# include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace roboptim
+{
+  /// \brief Decide whether the user callback should be called.
+  ///
+  /// NAG calls the evaluation callbacks many times per iteration (line
+  /// search, finite differences...), and the user callback is called
+  /// from there. The throttle decimates these calls: the callback is only
+  /// called every n evaluations and/or if some time elapsed since the
+  /// last call. The first evaluation always triggers the callback.
+  class NagCallbackThrottle
+  {
+  public:
+    NagCallbackThrottle ()
+      : every_ (1),
+        period_ (0.),
+        count_ (0),
+        last_ ()
+    {
+    }
+
+    /// \brief Reset the throttle before a solve.
+    /// \param every call the callback every n evaluations (n >= 1).
+    /// \param period minimum time (in seconds) between two calls.
+    void reset (int every, double period)
+    {
+      every_ = (every < 1) ? 1 : static_cast<std::size_t> (every);
+      period_ = period;
+      count_ = 0;
+      last_ = boost::posix_time::ptime ();
+    }
+
+    /// \brief Register an evaluation.
+    /// \return whether the user callback should be called.
+    bool operator() ()
+    {
+      // Default behavior: call the callback at every evaluation.
+      if (every_ == 1 && period_ <= 0.) return true;
+
+      if (count_++ % every_ != 0) return false;
+      if (period_ <= 0.) return true;
+
+      boost::posix_time::ptime now =
+        boost::posix_time::microsec_clock::universal_time ();
+      if (!last_.is_not_a_date_time () &&
+          static_cast<double> ((now - last_).total_microseconds ()) * 1e-6 <
+          period_)
+        return false;
+
+      last_ = now;
+      return true;
+    }
+
+  private:
+    /// \brief Call the callback every n evaluations.
+    std::size_t every_;
+
+    /// \brief Minimum time (in seconds) between two calls.
+    double period_;
+
+    /// \brief Number of evaluations since the last reset.
+    std::size_t count_;
+
+    /// \brief Time of the last call.
+    boost::posix_time::ptime last_;
+  };
+} // end of namespace roboptim
+
+#endif //! ROBOPTIM_CORE_NAG_CALLBACK_THROTTLE_HH
@@ -19,6 +19,13 @@
 # define ROBOPTIM_CORE_NAG_COMMON_HH
 
 # include <fstream>
+# include <map>
+# include <string>
+# include <vector>
+
+# include <boost/shared_ptr.hpp>
+# include <boost/thread/mutex.hpp>
+# include <boost/date_time/posix_time/posix_time_types.hpp>
 
 # include <nag.h>
 # include <nage04.h>
@@ -30,20 +37,54 @@
 # include <roboptim/core/differentiable-function.hh>
 # include <roboptim/core/twice-differentiable-function.hh>
 
+# include "roboptim/core/plugin/nag/nag-callback-throttle.hh"
+# include "roboptim/core/plugin/nag/nag-statistics.hh"
+
 namespace roboptim
 {
   /// \brief Error handler for NAG API.
+  ///
+  /// This handler throws a std::runtime_error. It is not installed by
+  /// the plugins anymore: exceptions must not be thrown through NAG's
+  /// C frames, and NAG errors are read from the NagError structure of
+  /// each call instead.
   /// \param s error message.
   /// \param code error code.
   /// \param name error name.
   void errorHandler (const char* s, int code, const char* name);
 
+/// \brief Catch the exceptions thrown in a NAG callback.
+///
+/// Exceptions must not propagate through NAG's C frames: the message is
+/// recorded in the solver instance, and ABORT is executed to ask NAG to
+/// stop (or to skip the evaluation).
+# define ROBOPTIM_NAG_CATCH_CALLBACK(SOLVER, ABORT)       \
+  catch (const std::exception& e)                         \
+  {                                                       \
+    (SOLVER)->setCallbackError (e.what ());               \
+    ABORT;                                                \
+  }                                                       \
+  catch (...)                                             \
+  {                                                       \
+    (SOLVER)->setCallbackError ("unknown exception");     \
+    ABORT;                                                \
+  }
+
+  template <typename T>
+  class NagSolveHandle;
+
   /// \addtogroup roboptim_problem
   /// @{
 
   /// \brief NAG common solver.
   ///
   /// This solver shares common piece of code of the different NAG solvers.
+  ///
+  /// Distinct solver instances can be used concurrently on different
+  /// threads: errors are captured per instance, and each instance owns
+  /// its log file ("nag.output_file", which must then differ between
+  /// instances). A single instance must not be used by several threads
+  /// at the same time.
   template <typename T>
   class ROBOPTIM_DLLEXPORT NagSolverCommon : public Solver<T>
   {
@@ -70,11 +111,169 @@ namespace roboptim
     /// \brief Problem type.
     typedef typename solver_t::problem_t problem_t;
 
+    typedef typename problem_t::size_type size_type;
+    typedef typename problem_t::vector_t vector_t;
+    typedef typename problem_t::interval_t interval_t;
+    typedef typename problem_t::intervals_t intervals_t;
+    typedef typename problem_t::intervalsVect_t intervalsVect_t;
+    typedef typename problem_t::startingPoint_t startingPoint_t;
+
     /// \brief Instantiate the solver from a problem.
     /// \param problem problem that will be solved
     explicit NagSolverCommon (const problem_t& pb);
     virtual ~NagSolverCommon ();
 
+    /// \brief Evaluation statistics of the last solve.
+    ///
+    /// Only collected if the "nag.statistics" parameter is enabled.
+    const NagStatistics& statistics () const
+    {
+      return statistics_;
+    }
+
+    /// \brief Evaluation statistics (callback use only).
+    NagStatistics& statistics ()
+    {
+      return statistics_;
+    }
+
+    /// \brief Register an evaluation (callback use only).
+    /// \return whether the user callback should be called.
+    bool throttleCallback ()
+    {
+      return callbackThrottle_ ();
+    }
+
+    /// \brief Record an evaluated point (callback use only).
+    ///
+    /// Solvers that NAG cannot interrupt record their evaluations: if
+    /// the solve is interrupted, the best recorded point is returned
+    /// instead of the point reached by NAG on skipped evaluations.
+    /// \param x evaluated point.
+    /// \param value cost function value.
+    template <typename V>
+    void recordEvaluation (const V& x, double value)
+    {
+      if (!(value < bestValue_)) return;
+      bestX_ = x;
+      bestValue_ = value;
+    }
+
+    /// \brief Record an error raised in a callback (callback use only).
+    ///
+    /// Only the first error of a solve is kept.
+    /// \param message error message.
+    void setCallbackError (const std::string& message)
+    {
+      if (callbackError_.empty ())
+        callbackError_ = message.empty () ? "unknown error" : message;
+    }
+
+    /// \name Incremental updates
+    ///
+    /// The bounds and the starting point of the problem can be changed
+    /// between two solves without creating a new solver: the cached
+    /// problem structure and the NAG state are kept. The updates
+    /// persist until resetUpdates () is called.
+    /// \{
+
+    /// \brief Replace the bounds of an argument.
+    /// \param i argument index.
+    /// \param bounds new bounds.
+    void updateArgumentBounds (size_type i, const interval_t& bounds);
+
+    /// \brief Replace the bounds of all the arguments.
+    /// \param bounds new bounds.
+    void updateArgumentBounds (const intervals_t& bounds);
+
+    /// \brief Replace the bounds of one output of a constraint.
+    /// \param constraint constraint index.
+    /// \param row output of the constraint.
+    /// \param bounds new bounds.
+    void updateConstraintBounds (std::size_t constraint, size_type row,
+                                 const interval_t& bounds);
+
+    /// \brief Replace the bounds of all the outputs of a constraint.
+    /// \param constraint constraint index.
+    /// \param bounds new bounds.
+    void updateConstraintBounds (std::size_t constraint,
+                                 const intervals_t& bounds);
+
+    /// \brief Replace the starting point.
+    /// \param x new starting point.
+    void updateStartingPoint (const vector_t& x);
+
+    /// \brief Go back to the bounds and starting point of the problem.
+    void resetUpdates ();
+
+    /// \brief Argument bounds used by the next solve.
+    const intervals_t& argumentBounds () const
+    {
+      return argumentBounds_;
+    }
+
+    /// \brief Constraint bounds used by the next solve.
+    const intervalsVect_t& boundsVector () const
+    {
+      return boundsVector_;
+    }
+
+    /// \brief Starting point used by the next solve.
+    const startingPoint_t& startingPoint () const
+    {
+      return startingPoint_;
+    }
+
+    /// \}
+
+    /// \brief Solve the problem on a worker thread.
+    ///
+    /// The solver must not be used until the returned handle is ready.
+    /// \param timeLimit time limit (in seconds) of the solve. If
+    /// positive, it replaces the "max-time" parameter (see
+    /// setTimeLimit).
+    /// \return handle giving access to the result.
+    boost::shared_ptr<NagSolveHandle<T> > solveAsync (double timeLimit = 0.);
+
+    /// \brief Ask the current (or next) solve to stop.
+    ///
+    /// This can be called from any thread. The solve stops at the next
+    /// function evaluation, and the last iterate is returned as a
+    /// result with a warning.
+    virtual void cancel ()
+    {
+      boost::mutex::scoped_lock lock (stopMutex_);
+      cancelRequested_ = true;
+    }
+
+    /// \brief Set the wall-clock time limit of the solves.
+    ///
+    /// This sets the "max-time" parameter. When the limit is exceeded,
+    /// the solve stops at the next function evaluation and the last
+    /// iterate is returned as a result with a warning.
+    /// \param seconds time limit in seconds, 0 for none.
+    void setTimeLimit (double seconds)
+    {
+      this->parameters_["max-time"].value = seconds;
+    }
+
+    /// \brief Whether the solve should stop (callback use only).
+    ///
+    /// This checks the cancel flag and the time limit.
+    bool stopRequested ();
+
+    /// \brief Whether a callback failed during the current solve.
+    bool hasCallbackError () const
+    {
+      return !callbackError_.empty ();
+    }
+
+    /// \brief Error raised in a callback during the last solve.
+    const std::string& callbackError () const
+    {
+      return callbackError_;
+    }
+
   protected:
     /// \brief Initialize parameters.
     /// Add solver parameters. Called during construction.
@@ -82,18 +281,149 @@ namespace roboptim
 
     /// \brief Read parameters and update associated options in NAG.
     /// Called before solving problem.
+    ///
+    /// Only the parameters that changed since the last call are given
+    /// to NAG, so the same state has to be passed to all the calls
+    /// until invalidateParameters () is called. If a parameter given to
+    /// the state has been erased, the NAG options are reset to their
+    /// default values first.
     /// \param state internal information required for NAG functions.
     /// \param fail NAG error argument
-    void updateParameters (Nag_E04State* state, NagError* fail);
+    /// \param options if not null, the option strings of all the
+    /// parameters given to this state are appended to this vector. The
+    /// log file is not included.
+    void updateParameters (Nag_E04State* state, NagError* fail,
+                           std::vector<std::string>* options = 0);
+
+    /// \brief Forget the parameters given to NAG.
+    /// To be called when a new NAG state is initialized.
+    void invalidateParameters ()
+    {
+      appliedParameters_.clear ();
+      appliedOptions_.clear ();
+    }
+
+    /// \brief Reset the statistics before a solve.
+    /// Statistics are enabled according to the "nag.statistics" parameter.
+    void resetStatistics ()
+    {
+      typename solver_t::parameters_t::const_iterator it =
+        this->parameters_.find ("nag.statistics");
+      statistics_.enabled = it != this->parameters_.end () &&
+                            boost::get<int> (it->second.value) != 0;
+      statistics_.reset ();
+    }
+
+    /// \brief Reset the user callback throttle before a solve.
+    /// It is configured by the "nag.callback-every" and
+    /// "nag.callback-period" parameters.
+    void resetCallbackThrottle ()
+    {
+      typename solver_t::parameters_t::const_iterator every =
+        this->parameters_.find ("nag.callback-every");
+      typename solver_t::parameters_t::const_iterator period =
+        this->parameters_.find ("nag.callback-period");
+      callbackThrottle_.reset (
+        (every != this->parameters_.end ())
+          ? boost::get<int> (every->second.value) : 1,
+        (period != this->parameters_.end ())
+          ? boost::get<double> (period->second.value) : 0.);
+    }
+
+    /// \brief Forget the callback error of a previous solve.
+    void resetCallbackError ()
+    {
+      callbackError_.clear ();
+    }
+
+    /// \brief Start the time limit and forget a previous interruption.
+    /// The time limit is given by the "max-time" parameter. The best
+    /// recorded point is forgotten as well.
+    void resetInterruption ();
+
+    /// \brief Turn the result of an interrupted solve into a warning.
+    ///
+    /// The best recorded point (see recordEvaluation), or else the last
+    /// iterate, is returned as a ResultWithWarnings. The cancel flag is
+    /// cleared.
+    void checkInterruption ();
+
+    /// \brief Replace the result by an error if a callback failed.
+    ///
+    /// The current result, if any, is kept as the last state.
+    void checkCallbackError ();
+
+    /// \brief Evaluation statistics.
+    NagStatistics statistics_;
+
+    /// \brief Decimation of the user callback calls.
+    NagCallbackThrottle callbackThrottle_;
 
   private:
+    /// \brief Open the log file if its name changed.
+    /// \param force whether the log file has to be given to NAG even
+    /// if it was not reopened.
+    void updateLogFile (Nag_E04State* state, NagError* fail, bool force);
+
+    /// \brief Give a parameter to NAG if it changed since the last call.
+    /// \param key RobOptim parameter name.
+    /// \param option NAG option name.
+    /// \param state NAG state.
+    /// \param fail NAG error argument.
+    /// \return whether the parameter was given to NAG.
+    bool updateParameter (const std::string& key, const std::string& option,
+                          Nag_E04State* state, NagError* fail);
+
+    /// \brief Close the log file, if any.
+    void closeLogFile ();
+
+    /// \brief First error raised in a callback during the solve.
+    std::string callbackError_;
+
+    /// \brief Mutex protecting the cancel flag.
+    boost::mutex stopMutex_;
+
+    /// \brief Whether cancel () was called.
+    bool cancelRequested_;
+
+    /// \brief Deadline of the current solve.
+    boost::posix_time::ptime deadline_;
+
+    /// \brief Reason of the interruption, empty if not interrupted.
+    std::string interruption_;
+
+    /// \brief Best recorded point of the current solve.
+    vector_t bestX_;
+
+    /// \brief Cost of bestX_ (infinity if none).
+    double bestValue_;
+
+    /// \brief Argument bounds (including updates).
+    intervals_t argumentBounds_;
+
+    /// \brief Constraint bounds (including updates).
+    intervalsVect_t boundsVector_;
+
+    /// \brief Starting point (including updates).
+    startingPoint_t startingPoint_;
+
     /// \brief File descriptor for logging.
     Nag_FileID fdLog_;
+
+    /// \brief Name of the opened log file.
+    std::string logFilename_;
+
+    /// \brief Parameter values given to the NAG state.
+    std::map<std::string, Parameter::parameterValues_t> appliedParameters_;
+
+    /// \brief Option strings given to the NAG state, per parameter.
+    std::map<std::string, std::string> appliedOptions_;
   };
 
   /// @}
 } // end of namespace roboptim
 
 # include "roboptim/core/plugin/nag/nag-common.hxx"
+# include "roboptim/core/plugin/nag/nag-solve-handle.hh"
 
 #endif //! ROBOPTIM_CORE_NAG_COMMON_HH
@@ -18,11 +18,13 @@
 #ifndef ROBOPTIM_CORE_NAG_COMMON_HXX
 # define ROBOPTIM_CORE_NAG_COMMON_HXX
 
+# include <cstring>
 # include <string>
 # include <stdexcept>
 
 # include <boost/variant/apply_visitor.hpp>
 # include <boost/format.hpp>
+# include <boost/thread/mutex.hpp>
 
 # include <nagx04.h>
 
@@ -41,15 +43,279 @@ namespace roboptim
     throw std::runtime_error (msg);
   }
 
+  namespace detail
+  {
+    /// \brief Mutex protecting the opening and closing of NAG files.
+    ///
+    /// NAG file identifiers come from a table shared by the process.
+    inline boost::mutex& nagFileMutex ()
+    {
+      static boost::mutex mutex;
+      return mutex;
+    }
+
+    /// \brief Throw if a NAG call failed.
+    ///
+    /// This is only used outside of NAG calls, so the exception does not
+    /// go through NAG's C frames.
+    inline void checkNagError (const NagError* fail, const std::string& what)
+    {
+      if (fail->code == NE_NOERROR) return;
+      throw std::runtime_error (
+        (boost::format ("%s: %s") % what % fail->message).str ());
+    }
+  } // end of namespace detail
+
   template <typename T>
   NagSolverCommon<T>::NagSolverCommon (const problem_t& pb)
-    : solver_t (pb), fdLog_ (-1)
+    : solver_t (pb),
+      statistics_ (),
+      callbackThrottle_ (),
+      callbackError_ (),
+      stopMutex_ (),
+      cancelRequested_ (false),
+      deadline_ (),
+      interruption_ (),
+      bestX_ (pb.function ().inputSize ()),
+      bestValue_ (Function::infinity ()),
+      argumentBounds_ (pb.argumentBounds ()),
+      boundsVector_ (pb.boundsVector ()),
+      startingPoint_ (pb.startingPoint ()),
+      fdLog_ (-1),
+      logFilename_ (),
+      appliedParameters_ (),
+      appliedOptions_ ()
   {
   }
 
   template <typename T>
   NagSolverCommon<T>::~NagSolverCommon ()
   {
+    closeLogFile ();
+  }
+
+  template <typename T>
+  void NagSolverCommon<T>::checkCallbackError ()
+  {
+    if (callbackError_.empty ()) return;
+
+    SolverError error ("error in a function evaluation: " + callbackError_);
+    switch (this->result_.which ())
+    {
+      case solver_t::SOLVER_VALUE:
+        error.lastState () = boost::get<Result> (this->result_);
+        break;
+      case solver_t::SOLVER_VALUE_WARNINGS:
+        error.lastState () = boost::get<ResultWithWarnings> (this->result_);
+        break;
+      case solver_t::SOLVER_ERROR:
+        error.lastState () =
+          boost::get<SolverError> (this->result_).lastState ();
+        break;
+      default:
+        break;
+    }
+    this->result_ = error;
+  }
+
+  template <typename T>
+  void NagSolverCommon<T>::updateArgumentBounds (size_type i,
+                                                 const interval_t& bounds)
+  {
+    if (i < 0 || static_cast<std::size_t> (i) >= argumentBounds_.size ())
+      throw std::runtime_error
+        ((boost::format ("invalid argument index: %1%") % i).str ());
+    if (bounds.first > bounds.second)
+      throw std::runtime_error
+        ((boost::format ("invalid bounds for argument %1%") % i).str ());
+
+    argumentBounds_[static_cast<std::size_t> (i)] = bounds;
+  }
+
+  template <typename T>
+  void NagSolverCommon<T>::updateArgumentBounds (const intervals_t& bounds)
+  {
+    if (bounds.size () != argumentBounds_.size ())
+      throw std::runtime_error ("invalid number of argument bounds");
+
+    for (std::size_t i = 0; i < bounds.size (); ++i)
+      updateArgumentBounds (static_cast<size_type> (i), bounds[i]);
+  }
+
+  template <typename T>
+  void NagSolverCommon<T>::updateConstraintBounds (std::size_t constraint,
+                                                   size_type row,
+                                                   const interval_t& bounds)
+  {
+    if (constraint >= boundsVector_.size () || row < 0 ||
+        static_cast<std::size_t> (row) >= boundsVector_[constraint].size ())
+      throw std::runtime_error
+        ((boost::format ("invalid constraint row: %1% (constraint %2%)")
+          % row % constraint).str ());
+    if (bounds.first > bounds.second)
+      throw std::runtime_error
+        ((boost::format ("invalid bounds for constraint %1%")
+          % constraint).str ());
+
+    boundsVector_[constraint][static_cast<std::size_t> (row)] = bounds;
+  }
+
+  template <typename T>
+  void NagSolverCommon<T>::updateConstraintBounds (std::size_t constraint,
+                                                   const intervals_t& bounds)
+  {
+    if (constraint >= boundsVector_.size () ||
+        bounds.size () != boundsVector_[constraint].size ())
+      throw std::runtime_error
+        ((boost::format ("invalid bounds for constraint %1%")
+          % constraint).str ());
+
+    for (std::size_t i = 0; i < bounds.size (); ++i)
+      updateConstraintBounds (constraint, static_cast<size_type> (i),
+                              bounds[i]);
+  }
+
+  template <typename T>
+  void NagSolverCommon<T>::updateStartingPoint (const vector_t& x)
+  {
+    if (x.size () != this->problem ().function ().inputSize ())
+      throw std::runtime_error ("invalid starting point size");
+
+    startingPoint_ = x;
+  }
+
+  template <typename T>
+  void NagSolverCommon<T>::resetUpdates ()
+  {
+    argumentBounds_ = this->problem ().argumentBounds ();
+    boundsVector_ = this->problem ().boundsVector ();
+    startingPoint_ = this->problem ().startingPoint ();
+  }
+
+  template <typename T>
+  bool NagSolverCommon<T>::stopRequested ()
+  {
+    if (!interruption_.empty ()) return true;
+
+    {
+      boost::mutex::scoped_lock lock (stopMutex_);
+      if (cancelRequested_) interruption_ = "solve cancelled";
+    }
+
+    if (interruption_.empty () && !deadline_.is_not_a_date_time () &&
+        boost::posix_time::microsec_clock::universal_time () >= deadline_)
+      interruption_ = "time limit exceeded";
+
+    return !interruption_.empty ();
+  }
+
+  template <typename T>
+  void NagSolverCommon<T>::resetInterruption ()
+  {
+    interruption_.clear ();
+    deadline_ = boost::posix_time::ptime ();
+    bestValue_ = Function::infinity ();
+
+    typename solver_t::parameters_t::const_iterator it =
+      this->parameters_.find ("max-time");
+    const double timeLimit = (it != this->parameters_.end ())
+                             ? boost::get<double> (it->second.value) : 0.;
+    if (timeLimit > 0.)
+      deadline_ = boost::posix_time::microsec_clock::universal_time () +
+                  boost::posix_time::microseconds
+                    (static_cast<long> (timeLimit * 1e6));
+  }
+
+  template <typename T>
+  void NagSolverCommon<T>::checkInterruption ()
+  {
+    {
+      boost::mutex::scoped_lock lock (stopMutex_);
+      cancelRequested_ = false;
+    }
+
+    // Callback errors take precedence over interruptions.
+    if (interruption_.empty () || hasCallbackError ()) return;
+
+    boost::optional<Result> last;
+    if (bestValue_ < Function::infinity ())
+    {
+      // Best point evaluated before the interruption.
+      last = Result (this->problem ().function ().inputSize (),
+                     this->problem ().function ().outputSize ());
+      last->x = bestX_;
+      last->value.setConstant (bestValue_);
+    }
+    else switch (this->result_.which ())
+    {
+      case solver_t::SOLVER_VALUE:
+        last = boost::get<Result> (this->result_);
+        break;
+      case solver_t::SOLVER_VALUE_WARNINGS:
+        last = boost::get<ResultWithWarnings> (this->result_);
+        break;
+      case solver_t::SOLVER_ERROR:
+        last = boost::get<SolverError> (this->result_).lastState ();
+        break;
+      default:
+        break;
+    }
+
+    if (!last)
+    {
+      this->result_ = SolverError (interruption_);
+      return;
+    }
+
+    ResultWithWarnings res (last->inputSize, last->outputSize);
+    static_cast<Result&> (res) = *last;
+    res.warnings.push_back (SolverWarning (interruption_));
+    this->result_ = res;
+  }
+
+  template <typename T>
+  void NagSolverCommon<T>::closeLogFile ()
+  {
+    if (fdLog_ <= 2) return;
+
+    NagError fail;
+    std::memset (&fail, 0, sizeof (NagError));
+    INIT_FAIL (fail);
+
+    boost::mutex::scoped_lock lock (detail::nagFileMutex ());
+    nag_close_file (fdLog_, &fail);
+    fdLog_ = -1;
+    logFilename_.clear ();
+  }
+
+  template <typename T>
+  void NagSolverCommon<T>::updateLogFile (Nag_E04State* state,
+                                          NagError* fail, bool force)
+  {
+    typename solver_t::parameters_t::const_iterator it =
+        this->parameters_.find ("nag.output_file");
+    if (it == this->parameters_.end ()) return;
+
+    std::string filename = boost::get<std::string> (it->second.value);
+    if (filename.empty ()) return;
+
+    // Keep the file opened by a previous solve.
+    if (filename != logFilename_ || fdLog_ <= 2)
+    {
+      closeLogFile ();
+
+      boost::mutex::scoped_lock lock (detail::nagFileMutex ());
+      // 1: open file for writing
+      nag_open_file (filename.c_str (), 1, &fdLog_, fail);
+      detail::checkNagError (fail, "cannot open " + filename);
+      logFilename_ = filename;
+      force = true;
+    }
+
+    if (!force) return;
+    NagParametersUpdater updater ("Print file", state, fail);
+    updater (int(fdLog_));
+    detail::checkNagError (fail, "invalid log file");
   }
 
 #define DEFINE_PARAMETER(KEY, DESCRIPTION, VALUE)     \
@@ -66,6 +332,7 @@ namespace roboptim
 
     // Shared parameters.
     DEFINE_PARAMETER ("max-iterations", "number of iterations", 3000);
+    DEFINE_PARAMETER ("max-time", "time limit (s), 0 means none", 0.);
 
     // NAG specific.
 
@@ -79,49 +346,88 @@ namespace roboptim
 
 #undef DEFINE_PARAMETER
 
+  template <typename T>
+  bool NagSolverCommon<T>::updateParameter (const std::string& key,
+                                            const std::string& option,
+                                            Nag_E04State* state,
+                                            NagError* fail)
+  {
+    const Parameter::parameterValues_t& value = this->parameters_[key].value;
+    std::map<std::string, Parameter::parameterValues_t>::const_iterator
+      applied = appliedParameters_.find (key);
+    if (applied != appliedParameters_.end () && applied->second == value)
+      return false;
+
+    std::vector<std::string> options;
+    boost::apply_visitor (NagParametersUpdater (option, state, fail, &options),
+                          value);
+    detail::checkNagError (fail, "invalid parameter " + key);
+
+    appliedParameters_[key] = value;
+    if (!options.empty ()) appliedOptions_[key] = options.back ();
+    return true;
+  }
+
   template <typename T>
   void NagSolverCommon<T>::updateParameters (Nag_E04State* state,
-                                             NagError* fail)
+                                             NagError* fail,
+                                             std::vector<std::string>* options)
   {
+    // NAG cannot unset a single option: if a parameter given to this
+    // state has been erased since, all the options are reset to their
+    // default and given again.
+    typedef std::map<std::string, Parameter::parameterValues_t>::const_iterator
+      applied_t;
+    for (applied_t it = appliedParameters_.begin ();
+         it != appliedParameters_.end (); ++it)
+    {
+      if (this->parameters_.find (it->first) != this->parameters_.end ())
+        continue;
+
+      NagParametersUpdater updater ("Defaults", state, fail);
+      updater (std::string ());
+      detail::checkNagError (fail, "cannot reset the NAG options");
+      invalidateParameters ();
+      break;
+    }
+
+    // A new state has to be given everything, including the log file.
+    bool force = appliedParameters_.empty ();
+
+    // Without log file, NAG has to be given "nag.print-file" again.
+    typename solver_t::parameters_t::const_iterator log =
+      this->parameters_.find ("nag.output_file");
+    if (!logFilename_.empty () &&
+        (log == this->parameters_.end () ||
+         boost::get<std::string> (log->second.value).empty ()))
+    {
+      closeLogFile ();
+      appliedParameters_.erase ("nag.print-file");
+    }
+
     const std::string prefix = "nag.";
     typedef const std::pair<const std::string, Parameter> const_iterator_t;
     BOOST_FOREACH (const_iterator_t& it, this->parameters_)
     {
-      if (it.first.substr (0, prefix.size ()) == prefix)
+      if (it.first.substr (0, prefix.size ()) == prefix &&
+          updateParameter (it.first, it.first.substr (prefix.size ()), state,
+                           fail))
       {
-        boost::apply_visitor (
-            NagParametersUpdater (it.first.substr (prefix.size ()), state,
-                                  fail),
-            it.second.value);
+        // "nag.print-file" overrides the log file.
+        force = force || it.first == "nag.print-file";
       }
     }
 
     // Remap standardized parameters.
-    boost::apply_visitor (
-        NagParametersUpdater ("Major Iterations Limit", state, fail),
-        this->parameters_["max-iterations"].value);
+    updateParameter ("max-iterations", "Major Iterations Limit", state, fail);
 
     // If the user specified a log filename
-    typename solver_t::parameters_t::const_iterator it =
-        this->parameters_.find ("nag.output_file");
-    if (it != this->parameters_.end ())
-    {
-      std::string filename = boost::get<std::string> (it->second.value);
-      if (!filename.empty ())
-      {
-        if (fdLog_ > 2)
-        {
-          nag_close_file (fdLog_, fail);
-          fdLog_ = -1;
-        }
+    updateLogFile (state, fail, force);
 
-        // 1: open file for writing
-        nag_open_file (filename.c_str (), 1, &fdLog_, fail);
-
-        NagParametersUpdater updater ("Print file", state, fail);
-        updater (int(fdLog_));
-      }
-    }
+    if (!options) return;
+    typedef const std::pair<const std::string, std::string> option_t;
+    BOOST_FOREACH (option_t& it, appliedOptions_)
+      options->push_back (it.second);
   }
 } // end of namespace roboptim
 
@@ -23,6 +23,8 @@
 # include <roboptim/core/solver.hh>
 # include <roboptim/core/differentiable-function.hh>
 
+# include "roboptim/core/plugin/nag/nag-common.hh"
+
 namespace roboptim
 {
   /// \addtogroup roboptim_solver
@@ -38,15 +40,20 @@ namespace roboptim
   /// first derivative (although it will usually work if the
   /// derivative has occasional discontinuities).
   ///
+  /// If "nag.grid-points" is set, the function is first evaluated on a
+  /// uniform grid of the interval (see NagBatchEvaluation), and the
+  /// search is restricted to the neighbourhood of the best grid point.
+  ///
   /// \see http://www.nag.com/numeric/CL/nagdoc_cl23/html/E04/e04bbc.html
   class ROBOPTIM_DLLEXPORT NagSolverDifferentiable
-    : public Solver<EigenMatrixDense>
+    : public NagSolverCommon<EigenMatrixDense>
   {
   public:
-    typedef Solver<EigenMatrixDense> parent_t;
+    typedef NagSolverCommon<EigenMatrixDense> parent_t;
     typedef Function::argument_t argument_t;
     typedef Function::result_t result_t;
     typedef DifferentiableFunction::gradient_t gradient_t;
+    typedef DifferentiableFunction differentiableFunction_t;
 
     explicit NagSolverDifferentiable (const problem_t& pb);
     virtual ~NagSolverDifferentiable ();
@@ -69,7 +76,16 @@ namespace roboptim
       return this->solverState_;
     }
 
+    /// \brief Cost function (callback use only).
+    const differentiableFunction_t& cost () const
+    {
+      return *cost_;
+    }
+
   private:
+    /// \brief Solve the problem (without statistics bookkeeping).
+    void impl_solve ();
+
     /// \brief Relative accuracy.
     double e1_;
     /// \brief Absolute accuracy.
@@ -84,6 +100,12 @@ namespace roboptim
     result_t f_;
     /// \brief Current gradient.
     gradient_t g_;
+    /// \brief Cost function.
+    const differentiableFunction_t* cost_;
+    /// \brief Grid bracketing the minimum.
+    Function::matrix_t grid_;
+    /// \brief Cost on the grid.
+    Function::matrix_t gridValues_;
 
     /// \brief Per-iteration callback function.
     callback_t callback_;
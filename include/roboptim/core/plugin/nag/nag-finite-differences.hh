@@ -0,0 +1,267 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef ROBOPTIM_CORE_NAG_FINITE_DIFFERENCES_HH
+# define ROBOPTIM_CORE_NAG_FINITE_DIFFERENCES_HH
+
+# include <algorithm>
+# include <cassert>
+# include <cmath>
+# include <vector>
+
+# include <roboptim/core/portability.hh>
+# include <roboptim/core/differentiable-function.hh>
+
+# include "roboptim/core/plugin/nag/nag-hooks.hh"
+# include "roboptim/core/plugin/nag/nag-statistics.hh"
+
+namespace roboptim
+{
+  /// \brief Jacobian approximated by colored finite differences.
+  ///
+  /// The columns of the sparsity pattern are grouped so that two
+  /// columns of the same group (color) never have a nonzero in the
+  /// same row (Curtis, Powell and Reid). All the variables of a group
+  /// are perturbed at once, so a Jacobian costs one evaluation per
+  /// color instead of one per variable. The evaluations of the
+  /// different colors are independent and write to separate buffers,
+  /// so they can run concurrently (see "nag.eval-threads" in
+  /// NagSolverNlpSparse). The function object is then shared by the
+  /// threads, so its evaluation must be thread-safe (e.g. no mutable
+  /// cache).
+  class NagColoredDifferences
+  {
+  public:
+    typedef GenericDifferentiableFunction<EigenMatrixSparse> function_t;
+    typedef function_t::jacobian_t jacobian_t;
+    typedef jacobian_t::Index index_t;
+    typedef Function::vector_t vector_t;
+    typedef Function::matrix_t matrix_t;
+
+    NagColoredDifferences ()
+      : epsilon_ (0.),
+        colorOf_ (),
+        groups_ (),
+        rows_ (),
+        cols_ (),
+        steps_ (),
+        points_ (),
+        values_ (),
+        counters_ (),
+        batchPoints_ (),
+        batchValues_ ()
+    {
+    }
+
+    /// \brief Compute the coloring of a sparsity pattern.
+    /// \param pattern Jacobian sparsity pattern (compressed).
+    /// \param epsilon relative perturbation.
+    void setPattern (const jacobian_t& pattern, double epsilon)
+    {
+      epsilon_ = epsilon;
+      const index_t m = pattern.rows ();
+      const index_t n = pattern.cols ();
+
+      // Nonzeros in the order of the pattern, and their lists per row
+      // and per column.
+      rows_.clear ();
+      cols_.clear ();
+      std::vector<std::vector<index_t> > rowsOfCol
+        (static_cast<std::size_t> (n));
+      std::vector<std::vector<index_t> > colsOfRow
+        (static_cast<std::size_t> (m));
+      for (index_t k = 0; k < pattern.outerSize (); ++k)
+        for (jacobian_t::InnerIterator it (pattern, k); it; ++it)
+        {
+          rows_.push_back (it.row ());
+          cols_.push_back (it.col ());
+          rowsOfCol[static_cast<std::size_t> (it.col ())]
+            .push_back (it.row ());
+          colsOfRow[static_cast<std::size_t> (it.row ())]
+            .push_back (it.col ());
+        }
+
+      // Greedy coloring: each column gets the first color not used by
+      // a column sharing one of its rows.
+      colorOf_.assign (static_cast<std::size_t> (n), -1);
+      groups_.clear ();
+      std::vector<index_t> forbidden;
+      for (index_t j = 0; j < n; ++j)
+      {
+        const std::vector<index_t>& rows =
+          rowsOfCol[static_cast<std::size_t> (j)];
+        if (rows.empty ()) continue;
+
+        for (std::size_t r = 0; r < rows.size (); ++r)
+        {
+          const std::vector<index_t>& cols =
+            colsOfRow[static_cast<std::size_t> (rows[r])];
+          for (std::size_t c = 0; c < cols.size (); ++c)
+          {
+            const int color = colorOf_[static_cast<std::size_t> (cols[c])];
+            if (color >= 0) forbidden[static_cast<std::size_t> (color)] = j;
+          }
+        }
+
+        std::size_t color = 0;
+        while (color < groups_.size () && forbidden[color] == j) ++color;
+        if (color == groups_.size ())
+        {
+          groups_.push_back (std::vector<index_t> ());
+          forbidden.push_back (-1);
+        }
+        colorOf_[static_cast<std::size_t> (j)] = static_cast<int> (color);
+        groups_[color].push_back (j);
+      }
+
+      steps_.setZero (n);
+      points_.assign (groups_.size (), vector_t::Zero (n));
+      values_.assign (groups_.size (), vector_t::Zero (m));
+      counters_.assign (groups_.size (), NagStatistics::Counter ());
+      batchPoints_.resize (n, static_cast<index_t> (groups_.size ()));
+      batchValues_.resize (m, static_cast<index_t> (groups_.size ()));
+    }
+
+    /// \brief Number of colors, i.e. of evaluations per Jacobian.
+    std::size_t colors () const
+    {
+      return groups_.size ();
+    }
+
+    /// \brief Compute the perturbed points around x.
+    ///
+    /// The perturbed points stay within the bounds: the step is taken
+    /// backwards when a forward step would exceed the upper bound, and
+    /// it is shrunk to the widest side of the interval when neither
+    /// fits. Fixed variables are not perturbed (zero derivative).
+    ///
+    /// \param x point where the Jacobian is evaluated, within the bounds.
+    /// \param lower lower bounds of the variables.
+    /// \param upper upper bounds of the variables.
+    template <typename V, typename B>
+    void perturb (const V& x, const B& lower, const B& upper)
+    {
+      for (std::size_t c = 0; c < groups_.size (); ++c)
+      {
+        points_[c] = x;
+        for (std::size_t k = 0; k < groups_[c].size (); ++k)
+        {
+          const index_t j = groups_[c][k];
+          double h = epsilon_ * std::max (1., std::abs (x[j]));
+          if (x[j] + h > upper[j])
+          {
+            if (x[j] - h >= lower[j])
+              h = -h;
+            else if (upper[j] - x[j] >= x[j] - lower[j])
+              h = upper[j] - x[j];
+            else
+              h = lower[j] - x[j];
+          }
+          // Use a step that is exactly representable around x_j.
+          const double xj = x[j] + h;
+          steps_[j] = xj - x[j];
+          points_[c][j] = xj;
+        }
+      }
+    }
+
+    /// \brief Evaluate the function at the perturbed point of a color.
+    /// \param f function.
+    /// \param color color.
+    /// \param enabled whether statistics are collected.
+    void evaluate (const function_t& f, std::size_t color, bool enabled)
+    {
+      assert (color < groups_.size ());
+      NagScopedTimer timer (enabled, counters_[color]);
+      f (values_[color], points_[color]);
+    }
+
+    /// \brief Evaluate all the perturbed points at once.
+    /// \param f batch interface of the function.
+    /// \param enabled whether statistics are collected.
+    void evaluate (const NagBatchEvaluation& f, bool enabled)
+    {
+      if (groups_.empty ()) return;
+
+      NagScopedTimer timer (enabled, counters_[0]);
+      for (std::size_t c = 0; c < groups_.size (); ++c)
+        batchPoints_.col (static_cast<index_t> (c)) = points_[c];
+      f.computeBatch (batchValues_, batchPoints_);
+      for (std::size_t c = 0; c < groups_.size (); ++c)
+        values_[c] = batchValues_.col (static_cast<index_t> (c));
+    }
+
+    /// \brief Write the Jacobian values in the order of the pattern.
+    /// \param f0 value of the function at the unperturbed point.
+    /// \param out array of size nonZeros () of the pattern.
+    template <typename V>
+    void scatter (const V& f0, double* out) const
+    {
+      for (std::size_t k = 0; k < rows_.size (); ++k)
+      {
+        const index_t i = rows_[k];
+        const index_t j = cols_[k];
+        const std::size_t c =
+          static_cast<std::size_t> (colorOf_[static_cast<std::size_t> (j)]);
+        out[k] = (steps_[j] != 0.)
+          ? (values_[c][i] - f0[i]) / steps_[j] : 0.;
+      }
+    }
+
+    /// \brief Move the evaluation counters to another counter.
+    void collectStatistics (NagStatistics::Counter& counter)
+    {
+      for (std::size_t c = 0; c < counters_.size (); ++c)
+      {
+        counter.add (counters_[c]);
+        counters_[c] = NagStatistics::Counter ();
+      }
+    }
+
+  private:
+    /// \brief Relative perturbation.
+    double epsilon_;
+
+    /// \brief Color of each column (-1 for empty columns).
+    std::vector<int> colorOf_;
+
+    /// \brief Columns of each color.
+    std::vector<std::vector<index_t> > groups_;
+
+    /// \brief Row and column of each nonzero of the pattern.
+    std::vector<index_t> rows_;
+    std::vector<index_t> cols_;
+
+    /// \brief Perturbation of each variable.
+    vector_t steps_;
+
+    /// \brief Perturbed point of each color.
+    std::vector<vector_t> points_;
+
+    /// \brief Value of the function at each perturbed point.
+    std::vector<vector_t> values_;
+
+    /// \brief Evaluation statistics of each color.
+    std::vector<NagStatistics::Counter> counters_;
+
+    /// \brief Buffers of the batch evaluations.
+    matrix_t batchPoints_;
+    matrix_t batchValues_;
+  };
+} // end of namespace roboptim
+
+#endif //! ROBOPTIM_CORE_NAG_FINITE_DIFFERENCES_HH
@@ -0,0 +1,96 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef ROBOPTIM_CORE_NAG_GRID_SEARCH_HH
+# define ROBOPTIM_CORE_NAG_GRID_SEARCH_HH
+
+# include <algorithm>
+
+# include <roboptim/core/portability.hh>
+# include <roboptim/core/function.hh>
+
+# include "roboptim/core/plugin/nag/nag-hooks.hh"
+
+namespace roboptim
+{
+  /// \brief Evaluate a function at several points.
+  ///
+  /// Functions implementing NagBatchEvaluation are evaluated with a
+  /// single call, the other ones point by point.
+  /// \param f function.
+  /// \param values values of the function, one column per point.
+  /// \param points points, one per column.
+  inline void evaluateBatch (const Function& f, Function::matrix_t& values,
+                             const Function::matrix_t& points)
+  {
+    values.resize (f.outputSize (), points.cols ());
+
+    const NagBatchEvaluation* batch =
+      dynamic_cast<const NagBatchEvaluation*> (&f);
+    if (batch)
+    {
+      batch->computeBatch (values, points);
+      return;
+    }
+
+    for (Function::matrix_t::Index k = 0; k < points.cols (); ++k)
+      f (values.col (k), points.col (k));
+  }
+
+  /// \brief Bracket the minimum of a function of one variable.
+  ///
+  /// The function is evaluated on a uniform grid of [a, b], then the
+  /// interval is reduced to the neighbours of the best grid point.
+  /// Nothing is done for fewer than 3 points or for an unbounded
+  /// interval.
+  /// \param f scalar function of one variable.
+  /// \param points number of grid points.
+  /// \param a lower bound of the interval (updated).
+  /// \param b upper bound of the interval (updated).
+  /// \param grid grid buffer.
+  /// \param values values buffer.
+  inline void gridBracket (const Function& f, int points, double& a, double& b,
+                           Function::matrix_t& grid,
+                           Function::matrix_t& values)
+  {
+    if (points < 3 || !(a < b) ||
+        a <= -Function::infinity () || b >= Function::infinity ())
+      return;
+
+    const double h = (b - a) / (points - 1);
+    grid.resize (1, points);
+    for (int k = 0; k < points; ++k)
+      grid (0, k) = a + h * k;
+    grid (0, points - 1) = b;
+
+    evaluateBatch (f, values, grid);
+
+    // A NaN value is replaced by any other one.
+    int best = 0;
+    for (int k = 1; k < points; ++k)
+    {
+      const double best_ = values (0, best);
+      if (values (0, k) < best_ || best_ != best_) best = k;
+    }
+
+    const double center = grid (0, best);
+    a = std::max (a, center - h);
+    b = std::min (b, center + h);
+  }
+} // end of namespace roboptim
+
+#endif //! ROBOPTIM_CORE_NAG_GRID_SEARCH_HH
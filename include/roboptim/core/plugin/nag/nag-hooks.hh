@@ -0,0 +1,139 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef ROBOPTIM_CORE_NAG_HOOKS_HH
+# define ROBOPTIM_CORE_NAG_HOOKS_HH
+
+# include <cmath>
+# include <limits>
+
+# include <roboptim/core/portability.hh>
+# include <roboptim/core/differentiable-function.hh>
+
+namespace roboptim
+{
+  /// \addtogroup roboptim_function
+  /// @{
+
+  /// \brief Optional interface to compute a value and its Jacobian at once.
+  ///
+  /// Functions computing their value and their Jacobian from the same
+  /// intermediate results (e.g. forward kinematics) can also inherit
+  /// from this interface. When the NAG plugins need both the value and
+  /// the Jacobian at the same point, this method is called instead of
+  /// the two separate evaluations.
+  ///
+  /// \tparam T matrix type.
+  template <typename T>
+  class NagValueAndJacobian
+  {
+  public:
+    typedef GenericDifferentiableFunction<T> differentiableFunction_t;
+    typedef typename differentiableFunction_t::result_ref result_ref;
+    typedef typename differentiableFunction_t::jacobian_ref jacobian_ref;
+    typedef typename differentiableFunction_t::const_argument_ref
+      const_argument_ref;
+
+    virtual ~NagValueAndJacobian ()
+    {
+    }
+
+    /// \brief Compute the value and the Jacobian of the function.
+    /// \param result result of the function.
+    /// \param jacobian Jacobian of the function.
+    /// \param x point where the function is evaluated.
+    virtual void valueAndJacobian (result_ref result, jacobian_ref jacobian,
+                                   const_argument_ref x) const = 0;
+  };
+
+  /// \brief Optional interface to declare the Jacobian sparsity pattern.
+  ///
+  /// By default, the sparse NAG plugins discover the pattern by
+  /// evaluating the Jacobian at a few points, which may miss structural
+  /// nonzeros that are numerically zero at all of these points. Functions
+  /// knowing their structure can inherit from this interface: the
+  /// returned pattern is then used as is, and the Jacobian is not
+  /// evaluated during the setup.
+  ///
+  /// \tparam T matrix type.
+  template <typename T>
+  class NagJacobianPattern
+  {
+  public:
+    typedef GenericDifferentiableFunction<T> differentiableFunction_t;
+    typedef typename differentiableFunction_t::jacobian_t jacobian_t;
+
+    virtual ~NagJacobianPattern ()
+    {
+    }
+
+    /// \brief Sparsity pattern of the Jacobian.
+    /// \return matrix whose structure (not values) is the pattern. Its
+    /// size is outputSize () x inputSize ().
+    virtual jacobian_t jacobianPattern () const = 0;
+  };
+
+  /// \brief Optional interface to evaluate a function at several points.
+  ///
+  /// Functions that can be evaluated more efficiently on a whole set of
+  /// points (e.g. vectorized code) can inherit from this interface. It
+  /// is used by the one-dimensional plugins to evaluate the grid
+  /// bracketing the minimum ("nag.grid-points").
+  class NagBatchEvaluation
+  {
+  public:
+    typedef Function::matrix_t matrix_t;
+
+    virtual ~NagBatchEvaluation ()
+    {
+    }
+
+    /// \brief Evaluate the function at several points.
+    /// \param values values of the function, one column per point. It is
+    /// already of size outputSize () x points.cols ().
+    /// \param points points, one per column.
+    virtual void computeBatch (matrix_t& values,
+                               const matrix_t& points) const = 0;
+  };
+
+  /// \brief Optional interface of functions without Jacobian.
+  ///
+  /// Functions that can only be evaluated (e.g. black-box simulators)
+  /// can inherit from this interface: the sparse NAG plugin then never
+  /// calls their Jacobian, and approximates it by colored finite
+  /// differences on its sparsity pattern. The pattern is the one of
+  /// NagJacobianPattern if available. Otherwise, it is detected once by
+  /// perturbing each variable at the probe points. The perturbed points
+  /// are evaluated with NagBatchEvaluation if available.
+  class NagFiniteDifferenceJacobian
+  {
+  public:
+    virtual ~NagFiniteDifferenceJacobian ()
+    {
+    }
+
+    /// \brief Relative perturbation of the variables.
+    virtual double finiteDifferenceStep () const
+    {
+      return std::sqrt (std::numeric_limits<double>::epsilon ());
+    }
+  };
+
+  /// @}
+} // end of namespace roboptim
+
+#endif //! ROBOPTIM_CORE_NAG_HOOKS_HH
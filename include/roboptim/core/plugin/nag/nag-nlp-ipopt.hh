@@ -0,0 +1,227 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef ROBOPTIM_CORE_PLUGIN_NAG_NAG_NLP_IPOPT_HH
+# define ROBOPTIM_CORE_PLUGIN_NAG_NAG_NLP_IPOPT_HH
+
+# include <vector>
+
+# include <roboptim/core/solver.hh>
+# include <roboptim/core/linear-function.hh>
+# include <roboptim/core/differentiable-function.hh>
+# include <roboptim/core/twice-differentiable-function.hh>
+
+# include "roboptim/core/plugin/nag/nag-common.hh"
+# include "roboptim/core/plugin/nag/nag-sparse-block.hh"
+# include "roboptim/core/plugin/nag/nag-sparsity-pattern.hh"
+
+namespace roboptim
+{
+  /// \addtogroup roboptim_solver
+  /// @{
+
+  /// \brief Nonlinear sparse second-order solver.
+  ///
+  /// Minimize a smooth function subject to simple bounds, linear
+  /// constraints and smooth nonlinear constraints using an
+  /// interior-point method (IPOPT) through NAG's handle interface.
+  ///
+  /// Unlike the other NLP plugins, exact second derivatives are used:
+  /// the cost function and the nonlinear constraints have to be twice
+  /// differentiable. The sparsity pattern of the Hessian of the
+  /// Lagrangian is computed once per solve from the Hessians of the
+  /// functions, then its values are assembled at each iteration.
+  ///
+  /// \see http://www.nag.com/numeric/CL/nagdoc_cl26/html/e04/e04stc.html
+  class ROBOPTIM_DLLEXPORT NagSolverNlpIpopt
+    : public NagSolverCommon<EigenMatrixSparse>
+  {
+  public:
+    typedef NagSolverCommon<EigenMatrixSparse> parent_t;
+    typedef GenericLinearFunction<EigenMatrixSparse> linearFunction_t;
+    typedef GenericNumericLinearFunction<EigenMatrixSparse>
+      numericLinearFunction_t;
+    typedef GenericTwiceDifferentiableFunction<EigenMatrixSparse>
+      twiceDifferentiableFunction_t;
+
+    typedef problem_t::function_t function_t;
+    typedef problem_t::vector_t vector_t;
+    typedef twiceDifferentiableFunction_t::jacobian_t jacobian_t;
+    typedef twiceDifferentiableFunction_t::hessian_t hessian_t;
+
+    /// \brief Hessian of one output of a function.
+    struct HessianBlock
+    {
+      /// \brief Output of the function.
+      function_t::size_type output;
+      /// \brief Hessian buffer with the cached sparsity pattern.
+      NagSparseBlock hessian;
+      /// \brief Values scattered from the buffer.
+      std::vector<double> values;
+      /// \brief Position of each value in the Hessian of the Lagrangian.
+      ///
+      /// Entries of the lower triangle are not given to NAG (-1).
+      std::vector<Integer> positions;
+    };
+
+    /// \brief Nonlinear function of the problem.
+    ///
+    /// The cost function and each nonlinear constraint own a block
+    /// whose derivatives are evaluated in place and scattered in the
+    /// NAG arrays according to the cached sparsity patterns.
+    struct NonlinearBlock
+    {
+      /// \brief Function associated with the block.
+      const twiceDifferentiableFunction_t* function;
+      /// \brief Constraint id (-1 for the cost function).
+      int functionId;
+      /// \brief Offset of the function rows in the nonlinear constraints.
+      function_t::size_type rowOffset;
+      /// \brief Offset of the block nonzeros in the constraint Jacobian.
+      Integer gOffset;
+      /// \brief Jacobian buffer with the cached sparsity pattern.
+      NagSparseBlock jacobian;
+      /// \brief Hessians of the outputs with a nonempty pattern.
+      std::vector<HessianBlock> hessians;
+    };
+
+    explicit NagSolverNlpIpopt (const problem_t& pb);
+    virtual ~NagSolverNlpIpopt ();
+
+    /// \brief Solve the problem.
+    void solve ();
+
+    void setIterationCallback (callback_t callback)
+    {
+      callback_ = callback;
+    }
+
+    const callback_t& callback () const { return callback_; }
+    solverState_t& solverState () { return solverState_; }
+
+    /// \brief Cost function block (callback use only).
+    NonlinearBlock& costBlock ()
+    {
+      return costBlock_;
+    }
+
+    /// \brief Nonlinear constraint blocks (callback use only).
+    std::vector<NonlinearBlock>& constraintBlocks ()
+    {
+      return constraintBlocks_;
+    }
+
+    /// \brief Invalidate the cached problem structure.
+    ///
+    /// The Jacobian and Hessian patterns (including the pattern of the
+    /// Hessian of the Lagrangian) are computed once and reused by
+    /// subsequent solves as long as the functions are unchanged. Call
+    /// this method if the structure of the functions changed so that
+    /// it gets recomputed by the next solve.
+    void invalidateStructure ()
+    {
+      structureCached_ = false;
+      structureKey_.clear ();
+    }
+
+  private:
+    /// \brief Solve the problem (without statistics bookkeeping).
+    void impl_solve ();
+
+    /// \brief Check that the problem can be solved by this plugin.
+    /// \return error message, empty if the problem is supported.
+    std::string checkProblem () const;
+
+    /// \brief Whether the cached structure matches the current problem.
+    bool isStructureCached () const;
+
+    /// \brief Compute the problem structure and store it in the cache.
+    void computeStructure ();
+
+    void fill_linear ();
+    void fill_nonlinear ();
+    void fill_hessian ();
+
+    /// \brief Fill the (possibly updated) bounds of the cached structure.
+    void fill_bounds ();
+    void add_hessian_blocks (NonlinearBlock& block,
+                             const NagPatternProbes& probes);
+
+    /// \brief Pass the "nag.*" parameters to NAG.
+    void updateOptions (void* handle, NagError* fail);
+
+    vector_t lookForX () const;
+
+    Integer n_;
+    Integer nclin_;
+    Integer ncnln_;
+
+    /// \brief Bounds on the variables.
+    vector_t bl_;
+    vector_t bu_;
+
+    /// \brief Linear constraints (bounds shifted by -b).
+    vector_t linearLower_;
+    vector_t linearUpper_;
+    std::vector<double> linearShift_;
+    std::vector<Integer> irowb_;
+    std::vector<Integer> icolb_;
+    std::vector<double> b_;
+
+    /// \brief Nonlinear constraints.
+    vector_t nonlinearLower_;
+    vector_t nonlinearUpper_;
+    std::vector<Integer> irowgd_;
+    std::vector<Integer> icolgd_;
+
+    /// \brief Nonzero entries of the cost gradient.
+    std::vector<Integer> idxfd_;
+
+    /// \brief Upper triangle of the Hessian of the Lagrangian.
+    std::vector<Integer> irowh_;
+    std::vector<Integer> icolh_;
+
+    NonlinearBlock costBlock_;
+    std::vector<NonlinearBlock> constraintBlocks_;
+
+    /// \brief First NAG constraint row of each problem constraint.
+    ///
+    /// Linear constraint rows come first, then the nonlinear ones.
+    std::vector<Integer> constraintRows_;
+
+    vector_t x_;
+    vector_t u_;
+    vector_t rinfo_;
+    vector_t stats_;
+
+    callback_t callback_;
+
+    solverState_t solverState_;
+
+    /// \brief Whether the problem structure has been computed.
+    bool structureCached_;
+
+    /// \brief Functions the cached structure was computed for.
+    ///
+    /// The cost function comes first, followed by the constraints.
+    std::vector<const function_t*> structureKey_;
+  };
+
+  /// @}
+} // end of namespace roboptim
+
+#endif //! ROBOPTIM_CORE_PLUGIN_NAG_NAG_NLP_IPOPT_HH
@@ -20,12 +20,20 @@
 
 # include <vector>
 
+# include <boost/shared_ptr.hpp>
+
 # include <roboptim/core/solver.hh>
 # include <roboptim/core/linear-function.hh>
 # include <roboptim/core/differentiable-function.hh>
 # include <roboptim/core/twice-differentiable-function.hh>
 
 # include "roboptim/core/plugin/nag/nag-common.hh"
+# include "roboptim/core/plugin/nag/nag-finite-differences.hh"
+# include "roboptim/core/plugin/nag/nag-hooks.hh"
+# include "roboptim/core/plugin/nag/nag-sparse-adapter.hh"
+# include "roboptim/core/plugin/nag/nag-snapshot.hh"
+# include "roboptim/core/plugin/nag/nag-sparse-block.hh"
+# include "roboptim/core/plugin/nag/nag-thread-pool.hh"
 
 namespace roboptim
 {
@@ -42,6 +50,29 @@ namespace roboptim
   /// are approximated by finite differences. It is not intended for
   /// large sparse problems.
   ///
+  /// Dense constraints can be mixed with sparse ones by wrapping them
+  /// in a NagSparseAdapter: their Jacobians are then evaluated as dense
+  /// matrices and copied into NAG's arrays without any conversion.
+  ///
+  /// Jacobians of functions implementing NagFiniteDifferenceJacobian
+  /// (or of all the sparse functions if "nag.finite-differences" is
+  /// set) are approximated by colored finite differences on their
+  /// cached pattern. The perturbed points of all the blocks are
+  /// evaluated concurrently if "nag.eval-threads" > 1: the same
+  /// function is then called from several threads at once, so its
+  /// evaluation must be thread-safe (e.g. no mutable cache).
+  ///
+  /// If "nag.elastic-retry" is set and a solve ends on an infeasible
+  /// point, NAG is called again from that point (warm start) with the
+  /// given elastic weight, which avoids a second cold solve with
+  /// relaxed bounds. The infeasibility measures of the last solve are
+  /// available through infeasibility ().
+  ///
+  /// If "nag.snapshot" is set, the inputs of the NAG call (and the
+  /// result of each usrfun call, unless "nag.snapshot-evaluations" is
+  /// 0) are written to that file, which can be replayed without the
+  /// problem functions by nag-replay. Elastic retries are not recorded.
+  ///
   /// \see http://www.nag.com/numeric/CL/nagdoc_cl23/html/E04/e04wdc.html
   class ROBOPTIM_DLLEXPORT NagSolverNlpSparse
     : public NagSolverCommon<EigenMatrixSparse>
@@ -62,6 +93,135 @@ namespace roboptim
     static const int linearFunctionId = 0;
     static const int nonlinearFunctionId = 1;
 
+    /// \brief Basis state and multipliers of a previous solve.
+    ///
+    /// When the "nag.warm-start" parameter is enabled, this state is
+    /// given back to NAG so that successive solves of problems sharing
+    /// the same structure start from the previous active set.
+    struct WarmStartState
+    {
+      /// \brief State of the variables (NAG's xstate).
+      std::vector<Integer> xstate;
+      /// \brief State of the problem functions (NAG's fstate).
+      std::vector<Integer> fstate;
+      /// \brief Multipliers associated with the bounds on x.
+      Function::vector_t xmul;
+      /// \brief Multipliers associated with the problem functions.
+      Function::vector_t fmul;
+      /// \brief Number of superbasic variables.
+      Integer ns;
+    };
+
+    /// \brief Infeasibility measures of the last solve.
+    ///
+    /// When a solve fails, these tell how far the last iterate is from
+    /// being feasible, and which rows are at fault.
+    struct Infeasibility
+    {
+      /// \brief Number of constraints violated by more than the
+      /// feasibility tolerance (NAG's ninf).
+      Integer ninf;
+      /// \brief Sum of the infeasibilities (NAG's sinf).
+      double sinf;
+      /// \brief Number of superbasic variables.
+      Integer ns;
+      /// \brief State of the problem functions (NAG's fstate).
+      std::vector<Integer> fstate;
+      /// \brief Multipliers associated with the problem functions.
+      Function::vector_t fmul;
+      /// \brief Whether the solve was retried in elastic mode.
+      bool elasticRetry;
+    };
+
+    /// \brief Nonlinear block of the G array.
+    ///
+    /// The cost function and each nonlinear constraint own a block
+    /// whose Jacobian is evaluated in place and scattered in G
+    /// according to the cached sparsity pattern.
+    struct JacobianBlock
+    {
+      /// \brief Function associated with the block.
+      const differentiableFunction_t* function;
+      /// \brief Combined value and Jacobian interface, if available.
+      const NagValueAndJacobian<EigenMatrixSparse>* combined;
+      /// \brief Dense function wrapped by a NagSparseAdapter, if any.
+      ///
+      /// Dense blocks have a full pattern: their Jacobian is evaluated
+      /// in denseJacobian and copied straight into G.
+      const NagSparseAdapter::denseFunction_t* dense;
+      /// \brief Jacobian buffer of a dense block.
+      NagSparseAdapter::denseFunction_t::jacobian_t denseJacobian;
+      /// \brief Constraint id (-1 for the cost function).
+      int functionId;
+      /// \brief Offset of the function rows in F.
+      function_t::size_type rowOffset;
+      /// \brief Offset of the block nonzeros in G.
+      Integer gOffset;
+      /// \brief Jacobian buffer with the cached sparsity pattern.
+      NagSparseBlock jacobian;
+      /// \brief Evaluation statistics of this block.
+      NagStatistics statistics;
+      /// \brief Whether the Jacobian is approximated by finite
+      /// differences.
+      bool finiteDifferences;
+      /// \brief Coloring and buffers of the finite differences.
+      NagColoredDifferences differences;
+      /// \brief Batch interface of the function, if available.
+      const NagBatchEvaluation* batch;
+      /// \brief Value at the current point (finite differences only).
+      Function::vector_t value;
+    };
+
+    /// \brief Perturbed evaluation of a finite-difference block.
+    ///
+    /// Functions with a batch interface have a single evaluation for
+    /// all their colors.
+    struct DifferenceEvaluation
+    {
+      /// \brief Index of the block.
+      std::size_t block;
+      /// \brief Color of the perturbed point.
+      std::size_t color;
+    };
+
+    /// \brief Evaluations of the nonlinear functions at the last point.
+    ///
+    /// NAG may request the values and the Jacobians at the same point
+    /// in separate calls, so the results are kept to avoid evaluating
+    /// the functions twice.
+    struct EvaluationCache
+    {
+      /// \brief Point of the cached evaluations.
+      Function::vector_t x;
+      /// \brief Nonlinear rows of F.
+      Function::vector_t f;
+      /// \brief Nonlinear entries of G.
+      Function::vector_t g;
+      /// \brief Whether f is valid.
+      bool hasF;
+      /// \brief Whether g is valid.
+      bool hasG;
+    };
+
+    /// \brief Arguments of the current usrfun call.
+    ///
+    /// This is shared with the threads evaluating the nonlinear blocks.
+    struct EvaluationRequest
+    {
+      /// \brief Current point.
+      const double* x;
+      /// \brief Size of x.
+      Integer n;
+      /// \brief F array.
+      double* f;
+      /// \brief G array.
+      double* g;
+      /// \brief Whether values have to be computed.
+      bool computeF;
+      /// \brief Whether Jacobians have to be computed.
+      bool computeG;
+    };
+
     explicit NagSolverNlpSparse (const problem_t& pb);
     virtual ~NagSolverNlpSparse ();
 
@@ -76,16 +236,171 @@ namespace roboptim
     const callback_t& callback () const { return callback_; }
     solverState_t& solverState () { return solverState_; }
 
+    /// \brief Nonlinear blocks of the G array (callback use only).
+    std::vector<JacobianBlock>& jacobianBlocks ()
+    {
+      return jacobianBlocks_;
+    }
+
+    /// \brief Lower bounds of the variables given to NAG.
+    const Function::vector_t& argumentLowerBounds () const
+    {
+      return xlow_;
+    }
+
+    /// \brief Upper bounds of the variables given to NAG.
+    const Function::vector_t& argumentUpperBounds () const
+    {
+      return xupp_;
+    }
+
+    /// \brief Evaluation cache (callback use only).
+    EvaluationCache& evaluationCache ()
+    {
+      return evaluationCache_;
+    }
+
+    /// \brief Current evaluation request (callback use only).
+    EvaluationRequest& evaluationRequest ()
+    {
+      return evaluationRequest_;
+    }
+
+    /// \brief Thread pool, null if blocks are evaluated serially.
+    NagThreadPool* threadPool ()
+    {
+      return threadPool_.get ();
+    }
+
+    /// \brief Task evaluating one nonlinear block (callback use only).
+    const NagThreadPool::task_t& blockTask () const
+    {
+      return blockTask_;
+    }
+
+    /// \brief Perturbed evaluations of the finite-difference blocks
+    /// (callback use only).
+    const std::vector<DifferenceEvaluation>& differenceEvaluations () const
+    {
+      return differenceEvaluations_;
+    }
+
+    /// \brief Task running one perturbed evaluation (callback use only).
+    const NagThreadPool::task_t& differenceTask () const
+    {
+      return differenceTask_;
+    }
+
+    /// \brief Snapshot recording the evaluations, null if none
+    /// (callback use only).
+    NagSnapshotWriter* evaluationSnapshot ()
+    {
+      return snapshotEvaluations_ ? snapshot_.get () : 0;
+    }
+
+    /// \brief Infeasibility measures of the last solve.
+    const Infeasibility& infeasibility () const
+    {
+      return infeasibility_;
+    }
+
+    /// \brief Basis state and multipliers of the last solve.
+    const WarmStartState& warmStartState () const
+    {
+      return warmStartState_;
+    }
+
+    /// \brief Seed the basis state and multipliers of the next solve.
+    ///
+    /// The state is only used if "nag.warm-start" is enabled and if its
+    /// dimensions match the problem.
+    /// \param state state retrieved from a previous solve.
+    void setWarmStartState (const WarmStartState& state)
+    {
+      warmStartState_ = state;
+    }
+
+    /// \brief Seed the multipliers of the next solve from a result.
+    ///
+    /// The basis state is kept, only the constraint multipliers are
+    /// replaced by the ones stored in the result.
+    /// \param res result of a previous solve.
+    void setWarmStartState (const Result& res)
+    {
+      // the cost function row is not part of the result multipliers.
+      if (res.lambda.size () + 1 != warmStartState_.fmul.size ()) return;
+      warmStartState_.fmul.tail (res.lambda.size ()) = res.lambda;
+    }
+
+    /// \brief Invalidate the cached problem structure.
+    ///
+    /// The sparsity structure (A and G patterns, function names) is
+    /// computed once and reused by subsequent solves as long as the
+    /// constraint list is unchanged. Call this method if the structure
+    /// of the functions changed so that it gets recomputed by the next
+    /// solve.
+    void invalidateStructure ()
+    {
+      structureCached_ = false;
+      structureKey_.clear ();
+
+      // The basis state is meaningless for a different structure.
+      warmStartState_ = WarmStartState ();
+      warmStartState_.ns = 0;
+    }
+
   private:
+    /// \brief Solve the problem (without statistics bookkeeping).
+    void impl_solve ();
+
+    /// \brief Whether the cached structure matches the current problem.
+    bool isStructureCached () const;
+
+    /// \brief Compute the problem structure and store it in the cache.
+    void cacheStructure ();
+
+    /// \brief Free the function and variable names.
+    void clear_names ();
+
+    /// \brief Whether the warm start state can be used for this problem.
+    bool canWarmStart () const;
+
+    /// \brief Call NAG's solver with the current arrays.
+    void solveNag (Nag_Start start, Nag_E04State* state, Nag_Comm* comm,
+                   NagError* fail);
+
+    /// \brief Start a snapshot of the NAG inputs ("nag.snapshot").
+    /// \param start start mode of the solve.
+    /// \param options option strings given to NAG.
+    void startSnapshot (Nag_Start start,
+                        const std::vector<std::string>& options);
+
     void compute_nf ();
     void fill_xlow_xupp ();
     void fill_flow_fupp ();
     void fill_iafun_javar_lena_nea ();
     void fill_igfun_jgvar_leng_neg ();
-    void fill_fnames ();
+    void add_jacobian_block (const differentiableFunction_t& f,
+                             int functionId, function_t::size_type offset,
+                             const jacobian_t& pattern);
+
+    /// \brief Select the blocks approximated by finite differences.
+    ///
+    /// The coloring of a block is only computed when it starts using
+    /// finite differences.
+    void updateDifferences ();
+
+    /// \brief Whether names are given to NAG.
+    ///
+    /// Names are only used in NAG's output, so they are only generated
+    /// if "nag.names" is enabled or if a log file is set.
+    bool useNames () const;
+
+    /// \brief Generate or free the names, and set nxname and nfname.
+    void update_names ();
+    void fill_names ();
 
     function_t::vector_t lookForX ();
-    function_t::vector_t lookForX (unsigned constraintId);
 
     Integer nf_;
     Integer n_;
@@ -100,6 +415,9 @@ namespace roboptim
 
     std::vector<double> a_;
 
+    /// \brief Constant terms (b) of the linear constraints.
+    Function::vector_t linearShift_;
+
     Integer lena_;
     Integer nea_;
 
@@ -110,6 +428,35 @@ namespace roboptim
 
     Integer neg_;
 
+    std::vector<JacobianBlock> jacobianBlocks_;
+
+    EvaluationCache evaluationCache_;
+
+    EvaluationRequest evaluationRequest_;
+
+    /// \brief Pool evaluating the blocks ("nag.eval-threads" > 1).
+    boost::shared_ptr<NagThreadPool> threadPool_;
+
+    NagThreadPool::task_t blockTask_;
+
+    /// \brief Perturbed evaluations of the finite-difference blocks.
+    std::vector<DifferenceEvaluation> differenceEvaluations_;
+
+    NagThreadPool::task_t differenceTask_;
+
+    /// \brief Snapshot of the current solve, null if none.
+    boost::shared_ptr<NagSnapshotWriter> snapshot_;
+
+    /// \brief Whether the evaluations are recorded in the snapshot.
+    bool snapshotEvaluations_;
+
+    /// \brief NAG state, kept across solves so that only the options
+    /// that changed are given to NAG.
+    Nag_E04State state_;
+
+    /// \brief Whether state_ has been initialized.
+    bool stateInitialized_;
+
     Function::vector_t xlow_;
     Function::vector_t xupp_;
 
@@ -131,9 +478,22 @@ namespace roboptim
     Integer ninf_;
     double sinf_;
 
+    /// \brief Infeasibility measures of the last solve.
+    Infeasibility infeasibility_;
+
     callback_t callback_;
 
     solverState_t solverState_;
+
+    WarmStartState warmStartState_;
+
+    /// \brief Whether the problem structure has been computed.
+    bool structureCached_;
+
+    /// \brief Functions the cached structure was computed for.
+    ///
+    /// The cost function comes first, followed by the constraints.
+    std::vector<const function_t*> structureKey_;
   };
 
   /// @}
@@ -17,14 +17,22 @@
 
 #ifndef ROBOPTIM_CORE_PLUGING_NAG_NAG_NLP_HH
 # define ROBOPTIM_CORE_PLUGING_NAG_NAG_NLP_HH
+# include <set>
+# include <string>
 # include <vector>
 
+# include <boost/shared_ptr.hpp>
+
 # include <roboptim/core/portability.hh>
 # include <roboptim/core/function.hh>
 # include <roboptim/core/differentiable-function.hh>
 # include <roboptim/core/twice-differentiable-function.hh>
+# include <roboptim/core/solver-factory.hh>
 
 # include "roboptim/core/plugin/nag/nag-common.hh"
+# include "roboptim/core/plugin/nag/nag-snapshot.hh"
+# include "roboptim/core/plugin/nag/nag-sparse-adapter.hh"
+# include "roboptim/core/plugin/nag/nag-thread-pool.hh"
 
 namespace roboptim
 {
@@ -41,6 +49,21 @@ namespace roboptim
   /// are approximated by finite differences. It is not intended for
   /// large sparse problems.
   ///
+  /// Since the dense quasi-Newton Hessian needs O(n^2) memory, problems
+  /// with at least "nag.sparse-threshold" variables can be forwarded to
+  /// the nag-nlp-sparse solver with a limited-memory Hessian. This is a
+  /// different algorithm, so it is disabled by default (0). In that
+  /// case, the result follows the conventions of the sparse solver
+  /// (e.g. for the order of the constraints and multipliers). Bound and
+  /// starting point updates are forwarded to the sparse solver, as well
+  /// as all the "nag.*" parameters: NAG options that e04vh does not
+  /// know make the solve fail instead of being dropped.
+  ///
+  /// If "nag.snapshot" is set, the inputs of the NAG call (and the
+  /// result of each confun and objfun call, unless
+  /// "nag.snapshot-evaluations" is 0) are written to that file, which
+  /// can be replayed without the problem functions by nag-replay.
+  ///
   /// \see http://www.nag.com/numeric/CL/nagdoc_cl23/html/E04/e04wdc.html
   class ROBOPTIM_DLLEXPORT NagSolverNlp
     : public NagSolverCommon<EigenMatrixDense>
@@ -49,12 +72,56 @@ namespace roboptim
     typedef NagSolverCommon<EigenMatrixDense>
       parent_t;
 
+    /// \brief Sparse solver used for large problems.
+    typedef Solver<EigenMatrixSparse> sparseSolver_t;
+
+    /// \brief Nonlinear constraint and its rows in ccon and cjac.
+    struct ConstraintBlock
+    {
+      /// \brief Constraint function.
+      const DifferentiableFunction* function;
+      /// \brief Offset of the constraint rows.
+      Function::size_type offset;
+      /// \brief Jacobian buffer (column-major, unlike cjac).
+      DifferentiableFunction::jacobian_t jacobian;
+      /// \brief Evaluation statistics of this constraint.
+      NagStatistics statistics;
+    };
+
+    /// \brief Arguments of the current confun call.
+    ///
+    /// This is shared with the threads evaluating the constraints.
+    struct EvaluationRequest
+    {
+      /// \brief What has to be computed (NAG's mode).
+      Integer mode;
+      /// \brief Number of nonlinear constraints.
+      Integer ncnln;
+      /// \brief Size of x.
+      Integer n;
+      /// \brief Second dimension of cjac.
+      Integer tdcj;
+      /// \brief Constraints needed by NAG (needc[i] > 0).
+      const Integer* needc;
+      /// \brief Current point.
+      const double* x;
+      /// \brief Constraint values.
+      double* ccon;
+      /// \brief Constraint Jacobian (row-major).
+      double* cjac;
+    };
+
     explicit NagSolverNlp (const problem_t& pb);
     virtual ~NagSolverNlp ();
 
     /// \brief Solve the problem.
     void solve ();
 
+    /// \brief Ask the current (or next) solve to stop.
+    ///
+    /// This is also forwarded to the sparse solver.
+    void cancel ();
+
     void
     setIterationCallback (callback_t callback)
     {
@@ -71,7 +138,73 @@ namespace roboptim
       return solverState_;
     }
 
+    /// \brief Nonlinear constraints (callback use only).
+    std::vector<ConstraintBlock>& constraintBlocks ()
+    {
+      return constraintBlocks_;
+    }
+
+    /// \brief Current evaluation request (callback use only).
+    EvaluationRequest& evaluationRequest ()
+    {
+      return evaluationRequest_;
+    }
+
+    /// \brief Thread pool, null if constraints are evaluated serially.
+    NagThreadPool* threadPool ()
+    {
+      return threadPool_.get ();
+    }
+
+    /// \brief Task evaluating one constraint (callback use only).
+    const NagThreadPool::task_t& constraintTask () const
+    {
+      return constraintTask_;
+    }
+
+    /// \brief Snapshot recording the evaluations, null if none
+    /// (callback use only).
+    NagSnapshotWriter* evaluationSnapshot ()
+    {
+      return snapshotEvaluations_ ? snapshot_.get () : 0;
+    }
+
+    /// \brief Discard the state kept for warm starts.
+    ///
+    /// The next solve will be a cold start, even if "nag.warm-start"
+    /// is enabled.
+    void invalidateWarmStart ()
+    {
+      warmStartValid_ = false;
+    }
+
   private:
+    /// \brief Solve the problem (without statistics bookkeeping).
+    void impl_solve ();
+
+    /// \brief Whether the problem is forwarded to the sparse solver.
+    bool useSparseSolver () const;
+
+    /// \brief Solve the problem with the sparse limited-memory solver.
+    void solveSparse ();
+
+    /// \brief Forward the sparse solver callback to the user callback.
+    void forwardCallback (const sparseSolver_t::problem_t& pb,
+			  sparseSolver_t::solverState_t& state);
+
+    /// \brief Count the constraints and resize the workspace.
+    ///
+    /// The workspace is only reallocated if the dimensions changed.
+    /// \return whether the dimensions are the same as for the last solve.
+    bool updateWorkspace ();
+
+    /// \brief Whether the state of the last solve can be reused.
+    bool canWarmStart () const;
+
+    /// \brief Start a snapshot of the NAG inputs ("nag.snapshot").
+    /// \param options option strings given to NAG.
+    void startSnapshot (const std::vector<std::string>& options);
+
     Integer n_;
     Integer nclin_;
     Integer ncnln_;
@@ -80,7 +213,10 @@ namespace roboptim
     Integer tdh_;
     Function::result_t objf_;
 
-    Function::matrix_t a_;
+    /// \brief Linear constraint matrix (row-major, as expected by NAG).
+    Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> a_;
+    /// \brief b vectors of the linear constraints, used to shift bounds.
+    Function::vector_t linearShift_;
     Function::vector_t bl_;
     Function::vector_t bu_;
 
@@ -92,9 +228,46 @@ namespace roboptim
     TwiceDifferentiableFunction::hessian_t h_;
     Function::argument_t x_;
 
+    /// \brief Constraint states (kept for warm starts).
+    std::vector<Integer> istate_;
+
+    /// \brief Whether istate_, clamda_ and h_ hold the state of the
+    /// last successful solve.
+    bool warmStartValid_;
+
     callback_t callback_;
 
     solverState_t solverState_;
+
+    std::vector<ConstraintBlock> constraintBlocks_;
+
+    EvaluationRequest evaluationRequest_;
+
+    /// \brief Pool evaluating the constraints ("nag.eval-threads" > 1).
+    boost::shared_ptr<NagThreadPool> threadPool_;
+
+    NagThreadPool::task_t constraintTask_;
+
+    /// \brief Snapshot of the current solve, null if none.
+    boost::shared_ptr<NagSnapshotWriter> snapshot_;
+
+    /// \brief Whether the evaluations are recorded in the snapshot.
+    bool snapshotEvaluations_;
+
+    /// \brief Sparse view of the cost function (large problems).
+    boost::shared_ptr<NagSparseAdapter> sparseCost_;
+
+    /// \brief Sparse copy of the problem (large problems).
+    boost::shared_ptr<sparseSolver_t::problem_t> sparseProblem_;
+
+    /// \brief Sparse solver (large problems).
+    boost::shared_ptr<SolverFactory<sparseSolver_t> > sparseFactory_;
+
+    /// \brief Mutex protecting sparseFactory_ against cancel ().
+    boost::mutex sparseMutex_;
+
+    /// \brief NAG options added to the sparse solver by this solver.
+    std::set<std::string> forwardedParameters_;
   };
 
   /// @}
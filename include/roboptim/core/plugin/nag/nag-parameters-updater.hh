@@ -22,7 +22,9 @@
 # include <string>
 # include <set>
 # include <algorithm>
+# include <vector>
 
+# include <boost/format.hpp>
 # include <boost/variant/static_visitor.hpp>
 # include <boost/static_assert.hpp>
 
@@ -33,22 +35,20 @@ namespace roboptim
 {
   struct NagParametersUpdater : public boost::static_visitor<>
   {
+    /// \param key RobOptim or NAG option name.
+    /// \param state NAG state.
+    /// \param fail NAG error argument.
+    /// \param options if not null, the option strings given to NAG are
+    /// also appended to this vector (e.g. for snapshots).
     NagParametersUpdater (const std::string& key, Nag_E04State* state,
-                          NagError* fail)
+                          NagError* fail,
+                          std::vector<std::string>* options = 0)
       : boost::static_visitor<> (),
-        key_ (),
+        key_ (roboptim_to_nag (key)),
         state_ (state),
         fail_ (fail),
-        ignored_ ()
+        options_ (options)
     {
-      // Conversion map from RobOptim whitespace-free strings to
-      // NAG's strings
-      toRoboptim_["max-iterations"] = std::string ("Major Iterations Limit");
-      toRoboptim_["verify-level"] = std::string ("Verify Level");
-      toRoboptim_["print-file"] = std::string ("Print file");
-      key_ = roboptim_to_nag (key);
-
-      ignored_.insert ("output_file");
     }
 
     void operator() (const Function::value_type& val) const
@@ -56,6 +56,7 @@ namespace roboptim
       if (is_ignored (key_)) return;
 
       nag_opt_sparse_nlp_option_set_double (key_.c_str (), val, state_, fail_);
+      record ((boost::format ("%1% = %2$.17g") % key_ % val).str ());
     }
 
     void operator() (const int& val) const
@@ -63,6 +64,7 @@ namespace roboptim
       if (is_ignored (key_)) return;
 
       nag_opt_sparse_nlp_option_set_integer (key_.c_str (), val, state_, fail_);
+      record ((boost::format ("%1% = %2%") % key_ % val).str ());
     }
 
     void operator() (const std::string& val) const
@@ -72,6 +74,7 @@ namespace roboptim
       std::string option = key_;
       if (!val.empty ()) option += " = " + val;
       nag_opt_sparse_nlp_option_set_string (option.c_str (), state_, fail_);
+      record (option);
     }
 
     void operator() (const char* val) const
@@ -88,17 +91,67 @@ namespace roboptim
     }
 
   private:
-    bool is_ignored (const std::string& option) const
+    void record (const std::string& option) const
     {
-      return std::find (ignored_.begin (), ignored_.end (), option) !=
-             ignored_.end ();
+      if (options_) options_->push_back (option);
     }
 
-    std::string roboptim_to_nag (const std::string& option) const
+    static std::set<std::string> makeIgnored ()
+    {
+      std::set<std::string> ignored;
+      ignored.insert ("output_file");
+      ignored.insert ("warm-start");
+      ignored.insert ("eval-threads");
+      ignored.insert ("names");
+      ignored.insert ("sparsity-probes");
+      ignored.insert ("statistics");
+      ignored.insert ("callback-every");
+      ignored.insert ("callback-period");
+      ignored.insert ("elastic-retry");
+      ignored.insert ("bounds-tolerance");
+      ignored.insert ("finite-differences");
+      ignored.insert ("snapshot");
+      ignored.insert ("snapshot-evaluations");
+      return ignored;
+    }
+
+    static std::map<std::string, std::string> makeTranslations ()
+    {
+      std::map<std::string, std::string> translations;
+      translations["max-iterations"] = "Major Iterations Limit";
+      translations["verify-level"] = "Verify Level";
+      translations["print-file"] = "Print file";
+      return translations;
+    }
+
+    /// \brief RobOptim options that are not passed to NAG.
+    ///
+    /// The tables are built once and shared by all the updaters.
+    static const std::set<std::string>& ignored ()
+    {
+      static const std::set<std::string> ignored = makeIgnored ();
+      return ignored;
+    }
+
+    /// \brief Conversion map from RobOptim whitespace-free strings to
+    /// NAG's strings.
+    static const std::map<std::string, std::string>& translations ()
+    {
+      static const std::map<std::string, std::string> translations =
+        makeTranslations ();
+      return translations;
+    }
+
+    static bool is_ignored (const std::string& option)
+    {
+      return ignored ().count (option) > 0;
+    }
+
+    static std::string roboptim_to_nag (const std::string& option)
     {
       std::map<std::string, std::string>::const_iterator it =
-          toRoboptim_.find (option);
-      if (it != toRoboptim_.end ())
+          translations ().find (option);
+      if (it != translations ().end ())
       {
         // element found
         return it->second;
@@ -111,8 +164,7 @@ namespace roboptim
     std::string key_;
     Nag_E04State* state_;
     NagError* fail_;
-    std::set<std::string> ignored_;
-    std::map<std::string, std::string> toRoboptim_;
+    std::vector<std::string>* options_;
   };
 } // end of namespace roboptim.
 
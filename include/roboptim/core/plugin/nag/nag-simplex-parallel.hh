@@ -0,0 +1,181 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef ROBOPTIM_CORE_PLUGIN_NAG_NAG_SIMPLEX_PARALLEL_HH
+# define ROBOPTIM_CORE_PLUGIN_NAG_NAG_SIMPLEX_PARALLEL_HH
+
+# include <string>
+# include <vector>
+
+# include <boost/shared_ptr.hpp>
+
+# include <roboptim/core/solver.hh>
+# include <roboptim/core/differentiable-function.hh>
+
+# include "roboptim/core/plugin/nag/nag-common.hh"
+# include "roboptim/core/plugin/nag/nag-hooks.hh"
+# include "roboptim/core/plugin/nag/nag-thread-pool.hh"
+
+namespace roboptim
+{
+  namespace nag
+  {
+    /// \addtogroup roboptim_solver
+    /// @{
+
+    /// \brief Parallel simplex algorithm: no constraints, no gradient
+    /// needed.
+    ///
+    /// This solver accepts the same problems as Simplex, but it is
+    /// meant for expensive cost functions. nag_opt_simplex_easy
+    /// evaluates one vertex at a time, so this solver implements the
+    /// multi-directional search of Torczon (1991) instead, whose
+    /// candidates are independent.
+    ///
+    /// The initial simplex is made of the starting point and of n
+    /// points moved along each axis. At each iteration, all the
+    /// vertices are reflected through the best one. If one of the
+    /// reflected points improves on the best vertex, the expanded
+    /// simplex is tried as well and the best of both is kept.
+    /// Otherwise, the simplex is contracted towards the best vertex.
+    /// The n points of each step can be evaluated concurrently on
+    /// nag.eval-threads threads (1 by default, 0 means one per core).
+    ///
+    /// With more than one thread, the cost function is called from
+    /// several threads at once, so its evaluation must be thread-safe
+    /// (e.g. no mutable cache). If it implements
+    /// NagBatchEvaluation, each step calls computeBatch once instead,
+    /// and the function is free to dispatch the points to its own
+    /// evaluators (e.g. one simulator instance per thread).
+    ///
+    /// As with Simplex, argument bounds are not taken into account,
+    /// and max-iterations limits the number of cost evaluations. The
+    /// solve stops when the standard deviation of the values at the
+    /// vertices is below nag.tolf and the simplex is within nag.tolx
+    /// of the best vertex.
+    class ROBOPTIM_DLLEXPORT SimplexParallel
+      : public NagSolverCommon<EigenMatrixDense>
+    {
+    public:
+      typedef NagSolverCommon<EigenMatrixDense> parent_t;
+      typedef Function::argument_t argument_t;
+      typedef Function::result_t result_t;
+      typedef Function::vector_t vector_t;
+      typedef Function::matrix_t matrix_t;
+
+      explicit SimplexParallel (const problem_t& pb);
+      virtual ~SimplexParallel ();
+
+      /// \brief Solve the problem.
+      void solve ();
+
+      void setIterationCallback (callback_t callback)
+      {
+        callback_ = callback;
+      }
+
+      const callback_t& callback () const
+      {
+        return callback_;
+      }
+
+      solverState_t& solverState ()
+      {
+        return solverState_;
+      }
+
+      /// \brief Evaluate the cost at the i-th candidate.
+      void evaluateCandidate (std::size_t i);
+
+    private:
+      /// \brief Solve the problem (without statistics bookkeeping).
+      void impl_solve ();
+
+      /// \brief Evaluate the cost at the first candidates.
+      /// \param count number of candidates.
+      /// \return false if an evaluation failed.
+      bool evaluateCandidates (std::size_t count);
+
+      /// \brief Check that count more evaluations fit in max-iterations.
+      /// \param count number of evaluations of the next step.
+      /// \param max_iter maximum number of cost evaluations.
+      /// \param last best point so far, if any.
+      /// \return false if the budget is exceeded: the result is then
+      /// a SolverError keeping last.
+      bool withinBudget (std::size_t count, int max_iter,
+                         const Result* last);
+
+      /// \brief Set the candidates from the vertices.
+      /// \param factor candidate i is v_0 + factor (v_i - v_0).
+      void moveCandidates (double factor);
+
+      /// \brief Replace vertices 1..n by the candidates.
+      void acceptCandidates ();
+
+      /// \brief Put the best vertex first.
+      void sortVertices ();
+
+      /// \brief Whether the simplex satisfies nag.tolx and nag.tolf.
+      bool converged (double tolx, double tolf) const;
+
+      /// \brief Call the user callback at the best vertex.
+      void iterationCallback ();
+
+      /// \brief Vertices of the simplex, one per column (best first).
+      matrix_t vertices_;
+      /// \brief Cost at the vertices.
+      vector_t values_;
+
+      /// \brief Points evaluated by the current step, one per column.
+      matrix_t candidates_;
+      /// \brief Cost at the candidates.
+      matrix_t candidateValues_;
+      /// \brief Reflected points, kept while the expansion is tried.
+      matrix_t reflected_;
+      /// \brief Cost at the reflected points.
+      matrix_t reflectedValues_;
+      /// \brief Batch interface of the cost, if any.
+      const NagBatchEvaluation* batch_;
+      /// \brief Buffers of the batch evaluations.
+      matrix_t batchPoints_;
+      matrix_t batchValues_;
+      /// \brief Evaluation statistics of each candidate.
+      std::vector<NagStatistics::Counter> counters_;
+      /// \brief Error message of each candidate, empty on success.
+      std::vector<std::string> errors_;
+
+      /// \brief Number of cost evaluations of the current solve.
+      int evaluations_;
+
+      /// \brief Thread pool, null if candidates are evaluated serially.
+      boost::shared_ptr<NagThreadPool> threadPool_;
+      /// \brief Task evaluating a candidate.
+      NagThreadPool::task_t candidateTask_;
+
+      /// \brief Per-iteration callback function.
+      callback_t callback_;
+
+      /// \brief Current solver state used by callback.
+      solverState_t solverState_;
+    };
+
+    /// @}
+
+  } // end of namespace nag.
+} // end of namespace roboptim
+
+#endif //! ROBOPTIM_CORE_PLUGIN_NAG_NAG_SIMPLEX_PARALLEL_HH
@@ -23,6 +23,8 @@
 # include <roboptim/core/solver.hh>
 # include <roboptim/core/differentiable-function.hh>
 
+# include "roboptim/core/plugin/nag/nag-common.hh"
+
 namespace roboptim
 {
   namespace nag
@@ -57,10 +59,10 @@ namespace roboptim
     /// useful for functions that are subject to inaccuracies.
     ///
     /// \see http://www.nag.com/numeric/CL/nagdoc_cl23/html/E04/e04ccc.html
-    class ROBOPTIM_DLLEXPORT Simplex : public Solver<EigenMatrixDense>
+    class ROBOPTIM_DLLEXPORT Simplex : public NagSolverCommon<EigenMatrixDense>
     {
     public:
-      typedef Solver<EigenMatrixDense> parent_t;
+      typedef NagSolverCommon<EigenMatrixDense> parent_t;
       typedef Function::argument_t argument_t;
       typedef Function::result_t result_t;
       typedef DifferentiableFunction::gradient_t gradient_t;
@@ -87,6 +89,9 @@ namespace roboptim
       }
 
     private:
+      /// \brief Solve the problem (without statistics bookkeeping).
+      void impl_solve ();
+
       /// \brief Lower bound.
       std::vector<double> a_;
       /// \brief Upper bound.
@@ -0,0 +1,416 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef ROBOPTIM_CORE_NAG_SNAPSHOT_HH
+# define ROBOPTIM_CORE_NAG_SNAPSHOT_HH
+
+# include <cassert>
+# include <cstring>
+# include <fstream>
+# include <stdexcept>
+# include <string>
+# include <vector>
+
+# include <fcntl.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+# include <unistd.h>
+
+# include <boost/cstdint.hpp>
+# include <boost/format.hpp>
+# include <boost/noncopyable.hpp>
+
+# include <nag.h>
+
+namespace roboptim
+{
+  /// \brief Snapshot of the inputs of a NAG solve.
+  ///
+  /// A snapshot stores the arrays given to NAG (structure, bounds,
+  /// starting point, options) and, optionally, the result of each user
+  /// function call. It can then be replayed without the user code
+  /// (see benchmarks/nag-replay.cc).
+  ///
+  /// The file starts with a 16-byte header (magic string, version,
+  /// solver), followed by sections. Each section has a 16-byte header
+  /// (tag, type, number of elements) and a payload padded to 8 bytes,
+  /// so that the arrays of a memory-mapped file are properly aligned.
+  /// Integers are stored as 64-bit values, reals as doubles.
+  ///
+  /// This class reads a snapshot by mapping the file in memory: the
+  /// sections point directly to the mapped data.
+  class NagSnapshot : public boost::noncopyable
+  {
+  public:
+    /// \brief Solver the snapshot was recorded for.
+    enum solver_t
+    {
+      /// \brief nag_opt_sparse_nlp_solve (nag-nlp-sparse).
+      SPARSE_NLP = 1,
+      /// \brief nag_opt_nlp_solve (nag-nlp).
+      DENSE_NLP = 2
+    };
+
+    /// \brief Content of a section.
+    enum tag_t
+    {
+      /// \brief Problem dimensions (solver-specific integers).
+      DIMENSIONS = 1,
+      /// \brief NAG option string.
+      OPTION,
+      /// \brief Sparse solver arrays.
+      IAFUN, JAVAR, A, IGFUN, JGVAR, XLOW, XUPP, FLOW, FUPP,
+      X, XSTATE, XMUL, FSTATE, FMUL,
+      /// \brief usrfun call: needf, needg, x, f (if needf), g (if needg).
+      ///
+      /// Only the entries written by usrfun are stored: the nonlinear
+      /// rows of f and the neg nonlinear Jacobian entries of g.
+      EVALUATION,
+      /// \brief Dense solver arrays.
+      BL, BU, ISTATE, CLAMDA, H,
+      /// \brief confun call: mode, needc, x, ccon and cjac (per mode).
+      CONSTRAINTS_EVALUATION,
+      /// \brief objfun call: mode, x, objf and grad (per mode).
+      COST_EVALUATION
+    };
+
+    /// \brief Type of the section elements.
+    enum type_t
+    {
+      INTEGER = 0,
+      REAL = 1,
+      TEXT = 2
+    };
+
+    /// \brief Section of a mapped snapshot.
+    struct Section
+    {
+      tag_t tag;
+      type_t type;
+      /// \brief Number of elements.
+      std::size_t size;
+      /// \brief First element, in the mapped file.
+      const void* data;
+
+      const boost::int64_t* integers () const
+      {
+        assert (type == INTEGER);
+        return static_cast<const boost::int64_t*> (data);
+      }
+
+      const double* reals () const
+      {
+        assert (type == REAL);
+        return static_cast<const double*> (data);
+      }
+
+      std::string text () const
+      {
+        assert (type == TEXT);
+        return std::string (static_cast<const char*> (data), size);
+      }
+
+      /// \brief Copy integers to NAG integers.
+      std::vector<Integer> toIntegers () const
+      {
+        return std::vector<Integer> (integers (), integers () + size);
+      }
+
+      /// \brief Copy reals.
+      std::vector<double> toReals () const
+      {
+        return std::vector<double> (reals (), reals () + size);
+      }
+    };
+
+    static const char* magic ()
+    {
+      return "RONAGSNP";
+    }
+
+    static const boost::uint32_t version = 1;
+
+    /// \brief Map a snapshot file.
+    /// \param filename snapshot file.
+    explicit NagSnapshot (const std::string& filename)
+      : fd_ (-1),
+        data_ (0),
+        length_ (0),
+        solver_ (),
+        sections_ ()
+    {
+      fd_ = ::open (filename.c_str (), O_RDONLY);
+      if (fd_ < 0) throw std::runtime_error ("cannot open " + filename);
+
+      struct stat st;
+      if (::fstat (fd_, &st) != 0 || st.st_size < 16)
+      {
+        close ();
+        throw std::runtime_error ("invalid snapshot " + filename);
+      }
+
+      length_ = static_cast<std::size_t> (st.st_size);
+      void* data = ::mmap (0, length_, PROT_READ, MAP_PRIVATE, fd_, 0);
+      if (data == MAP_FAILED)
+      {
+        close ();
+        throw std::runtime_error ("cannot map " + filename);
+      }
+      data_ = static_cast<const char*> (data);
+
+      try
+      {
+        parse ();
+      }
+      catch (const std::runtime_error& e)
+      {
+        close ();
+        throw std::runtime_error (filename + ": " + e.what ());
+      }
+    }
+
+    ~NagSnapshot ()
+    {
+      close ();
+    }
+
+    /// \brief Solver the snapshot was recorded for.
+    solver_t solver () const
+    {
+      return solver_;
+    }
+
+    /// \brief All the sections, in file order.
+    const std::vector<Section>& sections () const
+    {
+      return sections_;
+    }
+
+    /// \brief Sections with a given tag, in file order.
+    std::vector<const Section*> sections (tag_t tag) const
+    {
+      std::vector<const Section*> res;
+      for (std::size_t i = 0; i < sections_.size (); ++i)
+        if (sections_[i].tag == tag) res.push_back (&sections_[i]);
+      return res;
+    }
+
+    /// \brief First section with a given tag.
+    /// \throw std::runtime_error if there is no such section.
+    const Section& section (tag_t tag) const
+    {
+      for (std::size_t i = 0; i < sections_.size (); ++i)
+        if (sections_[i].tag == tag) return sections_[i];
+      throw std::runtime_error
+        ((boost::format ("missing snapshot section %1%") % tag).str ());
+    }
+
+  private:
+    void parse ()
+    {
+      if (std::memcmp (data_, magic (), 8) != 0)
+        throw std::runtime_error ("not a NAG snapshot");
+
+      boost::uint32_t header[2];
+      std::memcpy (header, data_ + 8, sizeof (header));
+      if (header[0] != version)
+        throw std::runtime_error
+          ((boost::format ("unsupported snapshot version %1%")
+            % header[0]).str ());
+      solver_ = static_cast<solver_t> (header[1]);
+
+      std::size_t offset = 16;
+      while (offset + 16 <= length_)
+      {
+        boost::uint32_t info[2];
+        boost::uint64_t size;
+        std::memcpy (info, data_ + offset, sizeof (info));
+        std::memcpy (&size, data_ + offset + 8, sizeof (size));
+        offset += 16;
+
+        const std::size_t bytes =
+          static_cast<std::size_t> (size) * elementSize (info[1]);
+        if (offset + bytes > length_)
+          throw std::runtime_error ("truncated snapshot");
+
+        Section s;
+        s.tag = static_cast<tag_t> (info[0]);
+        s.type = static_cast<type_t> (info[1]);
+        s.size = static_cast<std::size_t> (size);
+        s.data = data_ + offset;
+        sections_.push_back (s);
+
+        offset += (bytes + 7) / 8 * 8;
+      }
+    }
+
+    static std::size_t elementSize (boost::uint32_t type)
+    {
+      switch (type)
+      {
+        case INTEGER:
+          return sizeof (boost::int64_t);
+        case REAL:
+          return sizeof (double);
+        case TEXT:
+          return 1;
+      }
+      throw std::runtime_error ("invalid snapshot section type");
+    }
+
+    void close ()
+    {
+      if (data_) ::munmap (const_cast<char*> (data_), length_);
+      if (fd_ >= 0) ::close (fd_);
+      data_ = 0;
+      fd_ = -1;
+    }
+
+    int fd_;
+    const char* data_;
+    std::size_t length_;
+    solver_t solver_;
+    std::vector<Section> sections_;
+  };
+
+  /// \brief Write a snapshot of a NAG solve.
+  ///
+  /// Sections are streamed to the file, so that the evaluations can be
+  /// recorded as the solve goes.
+  class NagSnapshotWriter : public boost::noncopyable
+  {
+  public:
+    /// \param filename snapshot file (overwritten).
+    /// \param solver solver being recorded.
+    NagSnapshotWriter (const std::string& filename,
+                       NagSnapshot::solver_t solver)
+      : file_ (filename.c_str (), std::ios::binary | std::ios::trunc),
+        remaining_ (0),
+        bytes_ (0)
+    {
+      if (!file_) throw std::runtime_error ("cannot open " + filename);
+
+      const boost::uint32_t header[2] = {NagSnapshot::version,
+                                         static_cast<boost::uint32_t> (solver)};
+      file_.write (NagSnapshot::magic (), 8);
+      write (header, sizeof (header));
+    }
+
+    /// \brief Start a section.
+    /// \param tag content of the section.
+    /// \param type type of the elements.
+    /// \param size number of elements appended before endSection ().
+    void beginSection (NagSnapshot::tag_t tag, NagSnapshot::type_t type,
+                       std::size_t size)
+    {
+      assert (remaining_ == 0);
+      const boost::uint32_t info[2] = {static_cast<boost::uint32_t> (tag),
+                                       static_cast<boost::uint32_t> (type)};
+      const boost::uint64_t size_ = size;
+      write (info, sizeof (info));
+      write (&size_, sizeof (size_));
+      remaining_ = size;
+      bytes_ = 0;
+    }
+
+    void append (const double* data, std::size_t n)
+    {
+      assert (n <= remaining_);
+      write (data, n * sizeof (double));
+      remaining_ -= n;
+    }
+
+    void append (double value)
+    {
+      append (&value, 1);
+    }
+
+    void append (const Integer* data, std::size_t n)
+    {
+      assert (n <= remaining_);
+      for (std::size_t i = 0; i < n; ++i)
+      {
+        const boost::int64_t value = data[i];
+        write (&value, sizeof (value));
+      }
+      remaining_ -= n;
+    }
+
+    /// \brief End a section (pad the payload).
+    void endSection ()
+    {
+      assert (remaining_ == 0);
+      static const char padding[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+      write (padding, (8 - bytes_ % 8) % 8);
+      if (!file_) throw std::runtime_error ("cannot write NAG snapshot");
+    }
+
+    /// \brief Write a whole section of reals.
+    void write (NagSnapshot::tag_t tag, const double* data, std::size_t n)
+    {
+      beginSection (tag, NagSnapshot::REAL, n);
+      append (data, n);
+      endSection ();
+    }
+
+    /// \brief Write a whole section of integers.
+    void write (NagSnapshot::tag_t tag, const Integer* data, std::size_t n)
+    {
+      beginSection (tag, NagSnapshot::INTEGER, n);
+      append (data, n);
+      endSection ();
+    }
+
+    template <typename V>
+    void write (NagSnapshot::tag_t tag, const V& v)
+    {
+      write (tag, v.data (), static_cast<std::size_t> (v.size ()));
+    }
+
+    /// \brief Write a text section.
+    void write (NagSnapshot::tag_t tag, const std::string& s)
+    {
+      beginSection (tag, NagSnapshot::TEXT, s.size ());
+      write (s.data (), s.size ());
+      remaining_ = 0;
+      endSection ();
+    }
+
+    /// \brief Write one section per option string.
+    void write (const std::vector<std::string>& options)
+    {
+      for (std::size_t i = 0; i < options.size (); ++i)
+        write (NagSnapshot::OPTION, options[i]);
+    }
+
+  private:
+    void write (const void* data, std::size_t n)
+    {
+      file_.write (static_cast<const char*> (data),
+                   static_cast<std::streamsize> (n));
+      bytes_ += n;
+    }
+
+    std::ofstream file_;
+    /// \brief Elements left in the current section.
+    std::size_t remaining_;
+    /// \brief Bytes written since the beginning of the section.
+    std::size_t bytes_;
+  };
+} // end of namespace roboptim
+
+#endif //! ROBOPTIM_CORE_NAG_SNAPSHOT_HH
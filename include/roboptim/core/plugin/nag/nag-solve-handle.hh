@@ -0,0 +1,161 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef ROBOPTIM_CORE_NAG_SOLVE_HANDLE_HH
+# define ROBOPTIM_CORE_NAG_SOLVE_HANDLE_HH
+
+# include <exception>
+# include <stdexcept>
+# include <string>
+
+# include <boost/bind/bind.hpp>
+# include <boost/noncopyable.hpp>
+# include <boost/shared_ptr.hpp>
+# include <boost/thread/thread.hpp>
+# include <boost/thread/mutex.hpp>
+# include <boost/date_time/posix_time/posix_time_types.hpp>
+
+# include "roboptim/core/plugin/nag/nag-common.hh"
+
+namespace roboptim
+{
+  /// \addtogroup roboptim_solver
+  /// @{
+
+  /// \brief Handle on a solve running on a worker thread.
+  ///
+  /// The handle is returned by NagSolverCommon::solveAsync. Destroying
+  /// it cancels the solve and waits for the worker thread. The handle
+  /// itself must be used from a single thread.
+  ///
+  /// \tparam T matrix type.
+  template <typename T>
+  class NagSolveHandle : public boost::noncopyable
+  {
+  public:
+    typedef NagSolverCommon<T> solver_t;
+    typedef typename solver_t::result_t result_t;
+
+    /// \brief Start solving the problem.
+    /// \param solver solver, which must outlive the handle.
+    explicit NagSolveHandle (solver_t& solver)
+      : solver_ (solver),
+        mutex_ (),
+        done_ (false),
+        error_ (),
+        thread_ ()
+    {
+      thread_ = boost::thread (boost::bind (&NagSolveHandle::run, this));
+    }
+
+    ~NagSolveHandle ()
+    {
+      cancel ();
+      wait ();
+    }
+
+    /// \brief Ask the solve to stop and return the last iterate.
+    void cancel ()
+    {
+      boost::mutex::scoped_lock lock (mutex_);
+      if (!done_) solver_.cancel ();
+    }
+
+    /// \brief Whether the solve is over.
+    bool ready () const
+    {
+      boost::mutex::scoped_lock lock (mutex_);
+      return done_;
+    }
+
+    /// \brief Wait for the end of the solve.
+    void wait ()
+    {
+      if (thread_.joinable ()) thread_.join ();
+    }
+
+    /// \brief Wait for the end of the solve, for a limited time.
+    /// \param seconds maximum waiting time.
+    /// \return whether the solve is over.
+    bool waitFor (double seconds)
+    {
+      if (!thread_.joinable ()) return true;
+      return thread_.timed_join (boost::posix_time::microseconds
+                                   (static_cast<long> (seconds * 1e6)));
+    }
+
+    /// \brief Wait for the end of the solve and return its result.
+    ///
+    /// Exceptions raised during the solve (e.g. invalid parameters) are
+    /// rethrown as std::runtime_error.
+    const result_t& get ()
+    {
+      wait ();
+      if (!error_.empty ()) throw std::runtime_error (error_);
+      return solver_.minimum ();
+    }
+
+  private:
+    /// \brief Worker thread function.
+    void run ()
+    {
+      try
+      {
+        solver_.solve ();
+      }
+      catch (const std::exception& e)
+      {
+        error_ = e.what ();
+      }
+      catch (...)
+      {
+        error_ = "unknown error";
+      }
+
+      boost::mutex::scoped_lock lock (mutex_);
+      done_ = true;
+    }
+
+    /// \brief Solver running the solve.
+    solver_t& solver_;
+
+    /// \brief Mutex protecting the completion flag.
+    mutable boost::mutex mutex_;
+
+    /// \brief Whether the solve is over.
+    bool done_;
+
+    /// \brief Exception raised by the solve, empty if none.
+    std::string error_;
+
+    /// \brief Worker thread.
+    boost::thread thread_;
+  };
+
+  template <typename T>
+  boost::shared_ptr<NagSolveHandle<T> >
+  NagSolverCommon<T>::solveAsync (double timeLimit)
+  {
+    if (timeLimit > 0.) setTimeLimit (timeLimit);
+    return boost::shared_ptr<NagSolveHandle<T> >
+      (new NagSolveHandle<T> (*this));
+  }
+
+  /// @}
+} // end of namespace roboptim
+
+#endif //! ROBOPTIM_CORE_NAG_SOLVE_HANDLE_HH
@@ -0,0 +1,212 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef ROBOPTIM_CORE_NAG_SPARSE_ADAPTER_HH
+# define ROBOPTIM_CORE_NAG_SPARSE_ADAPTER_HH
+
+# include <algorithm>
+
+# include <roboptim/core/portability.hh>
+# include <roboptim/core/differentiable-function.hh>
+
+# include "roboptim/core/plugin/nag/nag-hooks.hh"
+
+namespace roboptim
+{
+  /// \addtogroup roboptim_function
+  /// @{
+
+  /// \brief Sparse view of a dense differentiable function.
+  ///
+  /// This allows dense problems to be solved by the sparse solver. The
+  /// dense function does not provide any sparsity information, so the
+  /// Jacobian is returned with a full structure (explicit zeros
+  /// included): its sparsity pattern does not depend on the point where
+  /// it is first evaluated.
+  ///
+  /// The wrapped function must outlive the adapter.
+  class NagSparseAdapter
+    : public GenericDifferentiableFunction<EigenMatrixSparse>
+  {
+  public:
+    typedef GenericDifferentiableFunction<EigenMatrixSparse> parent_t;
+    typedef GenericDifferentiableFunction<EigenMatrixDense> denseFunction_t;
+
+    explicit NagSparseAdapter (const denseFunction_t& f)
+      : parent_t (f.inputSize (), f.outputSize (), f.getName ()),
+        f_ (f),
+        gradient_ (f.inputSize ()),
+        jacobian_ (f.outputSize (), f.inputSize ())
+    {
+    }
+
+    /// \brief Wrapped dense function.
+    const denseFunction_t& function () const
+    {
+      return f_;
+    }
+
+  protected:
+    void impl_compute (result_ref result, const_argument_ref x) const
+    {
+      f_ (result, x);
+    }
+
+    void impl_gradient (gradient_ref gradient, const_argument_ref x,
+                        size_type i) const
+    {
+      gradient_.setZero ();
+      f_.gradient (gradient_, x, i);
+      gradient = gradient_.sparseView ();
+    }
+
+    void impl_jacobian (jacobian_ref jacobian, const_argument_ref x) const
+    {
+      jacobian_.setZero ();
+      f_.jacobian (jacobian_, x);
+
+      const size_type rows = jacobian_.rows ();
+      const size_type cols = jacobian_.cols ();
+      const size_type outer = jacobian.IsRowMajor ? rows : cols;
+      const size_type inner = jacobian.IsRowMajor ? cols : rows;
+
+      // Build the full structure once, then only copy the values.
+      if (!hasFullStructure (jacobian))
+      {
+        jacobian.resize (rows, cols);
+        jacobian.setZero ();
+        jacobian.reserve (Eigen::VectorXi::Constant (outer, inner));
+        for (size_type k = 0; k < outer; ++k)
+          for (size_type i = 0; i < inner; ++i)
+            jacobian.insertBackByOuterInner (k, i) = 0.;
+        jacobian.makeCompressed ();
+      }
+
+      value_type* values = jacobian.valuePtr ();
+      for (size_type k = 0; k < outer; ++k)
+        for (size_type i = 0; i < inner; ++i)
+          *values++ = jacobian.IsRowMajor ? jacobian_ (k, i) : jacobian_ (i, k);
+    }
+
+  private:
+    /// \brief Whether a matrix stores all its entries.
+    bool hasFullStructure (const jacobian_t& jacobian) const
+    {
+      return jacobian.isCompressed () &&
+             jacobian.rows () == jacobian_.rows () &&
+             jacobian.cols () == jacobian_.cols () &&
+             jacobian.nonZeros () == jacobian_.rows () * jacobian_.cols ();
+    }
+
+    /// \brief Wrapped dense function.
+    const denseFunction_t& f_;
+
+    /// \brief Dense gradient buffer.
+    mutable denseFunction_t::gradient_t gradient_;
+
+    /// \brief Dense Jacobian buffer.
+    mutable denseFunction_t::jacobian_t jacobian_;
+  };
+
+  /// \brief Sparse view of a dense function with a known pattern.
+  ///
+  /// Unlike NagSparseAdapter, only the entries of the given pattern are
+  /// passed to the sparse solver (see NagJacobianPattern): the dense
+  /// Jacobian must be zero outside of it.
+  ///
+  /// The wrapped function must outlive the adapter.
+  class NagSparsePatternAdapter
+    : public GenericDifferentiableFunction<EigenMatrixSparse>,
+      public NagJacobianPattern<EigenMatrixSparse>
+  {
+  public:
+    typedef GenericDifferentiableFunction<EigenMatrixSparse> parent_t;
+    typedef GenericDifferentiableFunction<EigenMatrixDense> denseFunction_t;
+
+    /// \param f dense function.
+    /// \param pattern matrix whose structure is the Jacobian pattern.
+    NagSparsePatternAdapter (const denseFunction_t& f,
+                             const parent_t::jacobian_t& pattern)
+      : parent_t (f.inputSize (), f.outputSize (), f.getName ()),
+        f_ (f),
+        pattern_ (pattern),
+        gradient_ (f.inputSize ()),
+        jacobian_ (f.outputSize (), f.inputSize ())
+    {
+      pattern_.makeCompressed ();
+    }
+
+    /// \brief Wrapped dense function.
+    const denseFunction_t& function () const
+    {
+      return f_;
+    }
+
+    parent_t::jacobian_t jacobianPattern () const
+    {
+      return pattern_;
+    }
+
+  protected:
+    void impl_compute (result_ref result, const_argument_ref x) const
+    {
+      f_ (result, x);
+    }
+
+    void impl_gradient (gradient_ref gradient, const_argument_ref x,
+                        size_type i) const
+    {
+      gradient_.setZero ();
+      f_.gradient (gradient_, x, i);
+      gradient = gradient_.sparseView ();
+    }
+
+    void impl_jacobian (jacobian_ref jacobian, const_argument_ref x) const
+    {
+      jacobian_.setZero ();
+      f_.jacobian (jacobian_, x);
+
+      // Use the structure of the pattern, then only copy the values.
+      if (!jacobian.isCompressed () ||
+          jacobian.nonZeros () != pattern_.nonZeros () ||
+          jacobian.rows () != pattern_.rows () ||
+          jacobian.cols () != pattern_.cols ())
+        jacobian = pattern_;
+
+      for (size_type k = 0; k < jacobian.outerSize (); ++k)
+        for (parent_t::jacobian_t::InnerIterator it (jacobian, k); it; ++it)
+          it.valueRef () = jacobian_ (it.row (), it.col ());
+    }
+
+  private:
+    /// \brief Wrapped dense function.
+    const denseFunction_t& f_;
+
+    /// \brief Jacobian pattern.
+    parent_t::jacobian_t pattern_;
+
+    /// \brief Dense gradient buffer.
+    mutable denseFunction_t::gradient_t gradient_;
+
+    /// \brief Dense Jacobian buffer.
+    mutable denseFunction_t::jacobian_t jacobian_;
+  };
+
+  /// @}
+} // end of namespace roboptim
+
+#endif //! ROBOPTIM_CORE_NAG_SPARSE_ADAPTER_HH
@@ -0,0 +1,173 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef ROBOPTIM_CORE_NAG_SPARSE_BLOCK_HH
+# define ROBOPTIM_CORE_NAG_SPARSE_BLOCK_HH
+
+# include <algorithm>
+# include <cassert>
+
+# include <roboptim/core/portability.hh>
+# include <roboptim/core/differentiable-function.hh>
+
+namespace roboptim
+{
+  /// \brief Sparse matrix with a fixed sparsity pattern.
+  ///
+  /// The block keeps a preallocated matrix sharing the cached sparsity
+  /// pattern. Functions are evaluated directly into this buffer, then
+  /// the nonzero values are scattered into a flat NAG array following
+  /// the order of the pattern (i.e. the compressed storage order).
+  ///
+  /// If the function returned exactly the cached pattern, the values
+  /// are copied contiguously. Otherwise, each value is looked up in
+  /// the pattern: entries missing from the evaluation are set to zero,
+  /// and entries missing from the pattern are dropped.
+  ///
+  /// The block itself never reallocates the buffer, but only functions
+  /// writing through coeffRef into the existing structure are evaluated
+  /// without allocation. Functions calling setZero or inserting new
+  /// entries allocate in Eigen, and use the slow path of scatter.
+  class NagSparseBlock
+  {
+  public:
+    typedef GenericDifferentiableFunction<EigenMatrixSparse>::jacobian_t
+      matrix_t;
+    typedef matrix_t::Index index_t;
+
+    NagSparseBlock ()
+      : pattern_ (),
+        buffer_ ()
+    {
+    }
+
+    explicit NagSparseBlock (const matrix_t& pattern)
+      : pattern_ (),
+        buffer_ ()
+    {
+      setPattern (pattern);
+    }
+
+    /// \brief Set the sparsity pattern of the block.
+    /// \param pattern matrix whose structure defines the pattern.
+    void setPattern (const matrix_t& pattern)
+    {
+      pattern_ = pattern;
+      pattern_.makeCompressed ();
+      buffer_ = pattern_;
+    }
+
+    /// \brief Sparsity pattern of the block.
+    const matrix_t& pattern () const
+    {
+      return pattern_;
+    }
+
+    /// \brief Number of nonzeros of the pattern.
+    index_t nonZeros () const
+    {
+      return pattern_.nonZeros ();
+    }
+
+    /// \brief Buffer to evaluate into, with values reset to zero.
+    ///
+    /// The structure of the buffer is kept so that functions filling
+    /// their Jacobian with coeffRef do not allocate. If a function
+    /// changed it, the new structure is kept as well: values are then
+    /// scattered by lookup instead of restoring the pattern at each
+    /// call.
+    matrix_t& buffer ()
+    {
+      if (!buffer_.isCompressed ()) buffer_.makeCompressed ();
+      std::fill (buffer_.valuePtr (),
+                 buffer_.valuePtr () + buffer_.nonZeros (), 0.);
+      return buffer_;
+    }
+
+    /// \brief Scatter the buffer values into a flat array.
+    /// \param out array of size nonZeros ().
+    void scatter (double* out)
+    {
+      if (!buffer_.isCompressed ()) buffer_.makeCompressed ();
+
+      // Fast path: unchanged structure.
+      if (hasPatternStructure (buffer_))
+      {
+        std::copy (buffer_.valuePtr (),
+                   buffer_.valuePtr () + buffer_.nonZeros (), out);
+        return;
+      }
+
+      // Slow path: look for each value in the pattern.
+      std::fill (out, out + pattern_.nonZeros (), 0.);
+      for (index_t k = 0; k < buffer_.outerSize (); ++k)
+        for (matrix_t::InnerIterator it (buffer_, k); it; ++it)
+        {
+          index_t pos = find (k, it.index ());
+          if (pos >= 0) out[pos] = it.value ();
+        }
+    }
+
+    /// \brief Position of an entry in the pattern.
+    /// \param outer outer index (column for column-major matrices).
+    /// \param inner inner index (row for column-major matrices).
+    /// \return position of the entry, -1 if not in the pattern.
+    index_t find (index_t outer, index_t inner) const
+    {
+      assert (0 <= outer && outer < pattern_.outerSize ());
+      const index_t start = pattern_.outerIndexPtr ()[outer];
+      const index_t end = pattern_.outerIndexPtr ()[outer + 1];
+      index_t pos = findInner (pattern_.innerIndexPtr () + start,
+                               pattern_.innerIndexPtr () + end, inner);
+      return (pos < 0) ? -1 : start + pos;
+    }
+
+  private:
+    /// \brief Position of an inner index in a sorted range.
+    template <typename I>
+    static index_t findInner (const I* first, const I* last, index_t inner)
+    {
+      const I* it = std::lower_bound (first, last, static_cast<I> (inner));
+      if (it == last || *it != inner) return -1;
+      return static_cast<index_t> (it - first);
+    }
+
+    /// \brief Whether a matrix has exactly the cached structure.
+    bool hasPatternStructure (const matrix_t& m) const
+    {
+      if (!m.isCompressed () || m.nonZeros () != pattern_.nonZeros () ||
+          m.outerSize () != pattern_.outerSize () ||
+          m.innerSize () != pattern_.innerSize ())
+        return false;
+
+      return std::equal (pattern_.outerIndexPtr (),
+                         pattern_.outerIndexPtr () + pattern_.outerSize () + 1,
+                         m.outerIndexPtr ()) &&
+             std::equal (pattern_.innerIndexPtr (),
+                         pattern_.innerIndexPtr () + pattern_.nonZeros (),
+                         m.innerIndexPtr ());
+    }
+
+    /// \brief Sparsity pattern.
+    matrix_t pattern_;
+
+    /// \brief Evaluation buffer.
+    matrix_t buffer_;
+  };
+} // end of namespace roboptim
+
+#endif //! ROBOPTIM_CORE_NAG_SPARSE_BLOCK_HH
@@ -0,0 +1,243 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef ROBOPTIM_CORE_NAG_SPARSITY_PATTERN_HH
+# define ROBOPTIM_CORE_NAG_SPARSITY_PATTERN_HH
+
+# include <algorithm>
+# include <cmath>
+# include <stdexcept>
+# include <vector>
+
+# include <boost/format.hpp>
+# include <boost/random/mersenne_twister.hpp>
+# include <boost/random/uniform_real.hpp>
+# include <boost/random/variate_generator.hpp>
+
+# include <roboptim/core/portability.hh>
+# include <roboptim/core/differentiable-function.hh>
+
+# include "roboptim/core/plugin/nag/nag-hooks.hh"
+# include "roboptim/core/plugin/nag/nag-sparse-adapter.hh"
+
+namespace roboptim
+{
+  /// \brief Points used to discover sparsity patterns.
+  ///
+  /// The first point is the starting point of the problem. The other
+  /// ones are drawn around it, within the argument bounds. The random
+  /// generator has a fixed seed so that the detected structure does
+  /// not change from one run to another.
+  class NagPatternProbes
+  {
+  public:
+    typedef Function::vector_t vector_t;
+    typedef Function::intervals_t intervals_t;
+
+    /// \param x0 starting point.
+    /// \param bounds argument bounds.
+    /// \param probes number of random points in addition to x0.
+    NagPatternProbes (const vector_t& x0, const intervals_t& bounds,
+                      int probes)
+      : points_ (1, x0)
+    {
+      boost::mt19937 rng (5489u);
+      boost::uniform_real<> distribution (-1., 1.);
+      boost::variate_generator<boost::mt19937&, boost::uniform_real<> >
+        random (rng, distribution);
+
+      for (int k = 0; k < probes; ++k)
+      {
+        vector_t x (x0.size ());
+        for (vector_t::Index i = 0; i < x.size (); ++i)
+        {
+          const std::size_t i_ = static_cast<std::size_t> (i);
+          const double lower = (i_ < bounds.size ()) ? bounds[i_].first
+                                                     : -Function::infinity ();
+          const double upper = (i_ < bounds.size ()) ? bounds[i_].second
+                                                     : Function::infinity ();
+
+          if (lower > -Function::infinity () && upper < Function::infinity ())
+            x[i] = lower + (upper - lower) * (random () + 1.) / 2.;
+          else
+            x[i] = std::max (lower, std::min (upper, x0[i] + random () *
+                                              (1. + std::abs (x0[i]))));
+        }
+        points_.push_back (x);
+      }
+    }
+
+    /// \brief Number of points.
+    std::size_t size () const
+    {
+      return points_.size ();
+    }
+
+    /// \brief i-th point (0 is the starting point).
+    const vector_t& operator[] (std::size_t i) const
+    {
+      return points_[i];
+    }
+
+  private:
+    std::vector<vector_t> points_;
+  };
+
+  /// \brief Union of the structures of several sparse matrices.
+  template <typename M>
+  class NagPatternUnion
+  {
+  public:
+    typedef M matrix_t;
+    typedef typename matrix_t::Index index_t;
+    typedef Eigen::Triplet<typename matrix_t::Scalar> triplet_t;
+
+    NagPatternUnion (index_t rows, index_t cols)
+      : rows_ (rows),
+        cols_ (cols),
+        triplets_ ()
+    {
+    }
+
+    /// \brief Add the structure of a matrix (explicit zeros included).
+    void add (const matrix_t& m)
+    {
+      if (m.rows () != rows_ || m.cols () != cols_)
+        throw std::runtime_error
+          ((boost::format ("invalid sparsity pattern size: %1%x%2% "
+                           "instead of %3%x%4%")
+            % m.rows () % m.cols () % rows_ % cols_).str ());
+
+      for (index_t k = 0; k < m.outerSize (); ++k)
+        for (typename matrix_t::InnerIterator it (m, k); it; ++it)
+          triplets_.push_back (triplet_t (it.row (), it.col (), 1.));
+    }
+
+    /// \brief Matrix whose structure is the union of the added ones.
+    matrix_t pattern () const
+    {
+      matrix_t m (rows_, cols_);
+      m.setFromTriplets (triplets_.begin (), triplets_.end ());
+      m.makeCompressed ();
+      return m;
+    }
+
+  private:
+    index_t rows_;
+    index_t cols_;
+    std::vector<triplet_t> triplets_;
+  };
+
+  /// \brief Matrix storing all its entries.
+  /// \param rows number of rows.
+  /// \param cols number of columns.
+  template <typename M>
+  M fullPattern (typename M::Index rows, typename M::Index cols)
+  {
+    typedef typename M::Index index_t;
+    const index_t outer = M::IsRowMajor ? rows : cols;
+    const index_t inner = M::IsRowMajor ? cols : rows;
+
+    M m (rows, cols);
+    m.reserve (Eigen::VectorXi::Constant (outer, static_cast<int> (inner)));
+    for (index_t k = 0; k < outer; ++k)
+      for (index_t i = 0; i < inner; ++i)
+        m.insertBackByOuterInner (k, i) = 0.;
+    m.makeCompressed ();
+    return m;
+  }
+
+  /// \brief Sparsity pattern detected from the values of a function.
+  ///
+  /// Each variable is perturbed at each probe point, and the outputs
+  /// whose value changed are part of the pattern. This is used for the
+  /// functions without Jacobian (NagFiniteDifferenceJacobian).
+  /// \param f function.
+  /// \param probes evaluation points.
+  /// \param epsilon relative perturbation.
+  inline GenericDifferentiableFunction<EigenMatrixSparse>::jacobian_t
+  valuePattern (const GenericDifferentiableFunction<EigenMatrixSparse>& f,
+                const NagPatternProbes& probes, double epsilon)
+  {
+    typedef GenericDifferentiableFunction<EigenMatrixSparse> function_t;
+    typedef function_t::jacobian_t jacobian_t;
+    typedef Eigen::Triplet<double> triplet_t;
+
+    std::vector<triplet_t> triplets;
+    function_t::vector_t f0 (f.outputSize ());
+    function_t::vector_t fj (f.outputSize ());
+    for (std::size_t p = 0; p < probes.size (); ++p)
+    {
+      function_t::vector_t x = probes[p];
+      f (f0, x);
+      for (function_t::size_type j = 0; j < f.inputSize (); ++j)
+      {
+        const double xj = x[j];
+        x[j] += epsilon * std::max (1., std::abs (xj));
+        f (fj, x);
+        x[j] = xj;
+
+        for (function_t::size_type i = 0; i < f.outputSize (); ++i)
+          if (fj[i] != f0[i]) triplets.push_back (triplet_t (i, j, 1.));
+      }
+    }
+
+    jacobian_t m (f.outputSize (), f.inputSize ());
+    m.setFromTriplets (triplets.begin (), triplets.end ());
+    m.makeCompressed ();
+    return m;
+  }
+
+  /// \brief Sparsity pattern of the Jacobian of a sparse function.
+  ///
+  /// The pattern declared through NagJacobianPattern is used if
+  /// available, and dense functions wrapped by NagSparseAdapter have a
+  /// full pattern. The pattern of functions without Jacobian
+  /// (NagFiniteDifferenceJacobian) is detected from their values.
+  /// Otherwise, the patterns of the Jacobians evaluated at the probe
+  /// points are merged.
+  /// \param f function.
+  /// \param probes evaluation points.
+  inline GenericDifferentiableFunction<EigenMatrixSparse>::jacobian_t
+  jacobianPattern (const GenericDifferentiableFunction<EigenMatrixSparse>& f,
+                   const NagPatternProbes& probes)
+  {
+    typedef GenericDifferentiableFunction<EigenMatrixSparse>::jacobian_t
+      jacobian_t;
+
+    if (dynamic_cast<const NagSparseAdapter*> (&f))
+      return fullPattern<jacobian_t> (f.outputSize (), f.inputSize ());
+
+    NagPatternUnion<jacobian_t> pattern (f.outputSize (), f.inputSize ());
+
+    const NagJacobianPattern<EigenMatrixSparse>* hook =
+      dynamic_cast<const NagJacobianPattern<EigenMatrixSparse>*> (&f);
+    const NagFiniteDifferenceJacobian* differences =
+      dynamic_cast<const NagFiniteDifferenceJacobian*> (&f);
+    if (hook)
+      pattern.add (hook->jacobianPattern ());
+    else if (differences)
+      return valuePattern (f, probes, differences->finiteDifferenceStep ());
+    else
+      for (std::size_t i = 0; i < probes.size (); ++i)
+        pattern.add (f.jacobian (probes[i]));
+
+    return pattern.pattern ();
+  }
+} // end of namespace roboptim
+
+#endif //! ROBOPTIM_CORE_NAG_SPARSITY_PATTERN_HH
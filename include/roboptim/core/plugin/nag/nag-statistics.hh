@@ -0,0 +1,191 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef ROBOPTIM_CORE_NAG_STATISTICS_HH
+# define ROBOPTIM_CORE_NAG_STATISTICS_HH
+
+# include <string>
+# include <cstddef>
+
+# include <boost/noncopyable.hpp>
+# include <boost/date_time/posix_time/posix_time_types.hpp>
+
+namespace roboptim
+{
+  /// \brief Evaluation statistics of a NAG solve.
+  ///
+  /// Statistics are only collected if the "nag.statistics" parameter is
+  /// enabled. Otherwise, timers are not even started.
+  struct NagStatistics
+  {
+    /// \brief Number of calls and cumulative wall time (in seconds).
+    struct Counter
+    {
+      Counter ()
+        : count (0),
+          time (0.),
+          allocations (0)
+      {
+      }
+
+      void add (const Counter& other)
+      {
+        count += other.count;
+        time += other.time;
+        allocations += other.allocations;
+      }
+
+      std::size_t count;
+      double time;
+      /// \brief Heap allocations (see nag-allocation-audit.hh).
+      std::size_t allocations;
+    };
+
+    NagStatistics ()
+      : enabled (false)
+    {
+    }
+
+    /// \brief Reset the counters (enabled is kept).
+    void reset ()
+    {
+      cost = Counter ();
+      constraints = Counter ();
+      jacobian = Counter ();
+      hessian = Counter ();
+      callback = Counter ();
+      evaluation = Counter ();
+      setup = Counter ();
+      solve = Counter ();
+    }
+
+    /// \brief Add the evaluation counters of another instance.
+    ///
+    /// This is used to gather the counters of blocks evaluated by
+    /// different threads.
+    void merge (const NagStatistics& other)
+    {
+      cost.add (other.cost);
+      constraints.add (other.constraints);
+      jacobian.add (other.jacobian);
+      hessian.add (other.hessian);
+      callback.add (other.callback);
+      evaluation.add (other.evaluation);
+    }
+
+    /// \brief Publish the statistics as solver state parameters.
+    ///
+    /// Keys are of the form "nag.statistics.<counter>.count" and
+    /// "nag.statistics.<counter>.time". Builds auditing allocations
+    /// also publish "nag.statistics.evaluation.allocations".
+    /// \param state solver state.
+    template <typename S>
+    void publish (S& state) const
+    {
+      publish (state, "cost", "cost function evaluations", cost);
+      publish (state, "constraints", "constraint evaluations", constraints);
+      publish (state, "jacobian", "jacobian/gradient evaluations", jacobian);
+      publish (state, "hessian", "hessian evaluations", hessian);
+      publish (state, "callback", "user callback calls", callback);
+      publish (state, "evaluation", "NAG evaluation callbacks", evaluation);
+      publish (state, "setup", "problem setup", setup);
+      publish (state, "solve", "complete solve", solve);
+
+# ifdef ROBOPTIM_NAG_ALLOCATION_AUDIT
+      const std::string key = "nag.statistics.evaluation.allocations";
+      state.parameters ()[key].description =
+        "heap allocations in NAG evaluation callbacks";
+      state.parameters ()[key].value =
+        static_cast<int> (evaluation.allocations);
+# endif //! ROBOPTIM_NAG_ALLOCATION_AUDIT
+    }
+
+    /// \brief Whether statistics are collected.
+    bool enabled;
+
+    /// \brief Cost function evaluations.
+    Counter cost;
+    /// \brief Constraint evaluations.
+    Counter constraints;
+    /// \brief Jacobian (or gradient) evaluations.
+    Counter jacobian;
+    /// \brief Hessian evaluations.
+    Counter hessian;
+    /// \brief User callback calls.
+    Counter callback;
+    /// \brief Callbacks called by NAG (they include the evaluations).
+    Counter evaluation;
+    /// \brief Setup of the NAG structures.
+    Counter setup;
+    /// \brief Complete solve (including setup and evaluations).
+    Counter solve;
+
+  private:
+    template <typename S>
+    static void publish (S& state, const std::string& name,
+                         const std::string& description,
+                         const Counter& counter)
+    {
+      const std::string prefix = "nag.statistics." + name;
+
+      state.parameters ()[prefix + ".count"].description =
+        "number of " + description;
+      state.parameters ()[prefix + ".count"].value =
+        static_cast<int> (counter.count);
+
+      state.parameters ()[prefix + ".time"].description =
+        "wall time (s) of " + description;
+      state.parameters ()[prefix + ".time"].value = counter.time;
+    }
+  };
+
+  /// \brief Scoped timer updating a statistics counter.
+  ///
+  /// Nothing is done if statistics are disabled.
+  class NagScopedTimer : private boost::noncopyable
+  {
+  public:
+    NagScopedTimer (bool enabled, NagStatistics::Counter& counter)
+      : counter_ (enabled ? &counter : 0),
+        start_ ()
+    {
+      if (counter_) start_ = now ();
+    }
+
+    ~NagScopedTimer ()
+    {
+      if (!counter_) return;
+      counter_->count++;
+      counter_->time +=
+        static_cast<double> ((now () - start_).total_microseconds ()) * 1e-6;
+    }
+
+  private:
+    static boost::posix_time::ptime now ()
+    {
+      return boost::posix_time::microsec_clock::universal_time ();
+    }
+
+    /// \brief Updated counter, null if disabled.
+    NagStatistics::Counter* counter_;
+
+    /// \brief Start time.
+    boost::posix_time::ptime start_;
+  };
+} // end of namespace roboptim
+
+#endif //! ROBOPTIM_CORE_NAG_STATISTICS_HH
@@ -0,0 +1,199 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef ROBOPTIM_CORE_NAG_THREAD_POOL_HH
+# define ROBOPTIM_CORE_NAG_THREAD_POOL_HH
+
+# include <string>
+# include <stdexcept>
+
+# include <boost/bind/bind.hpp>
+# include <boost/function.hpp>
+# include <boost/noncopyable.hpp>
+# include <boost/thread/thread.hpp>
+# include <boost/thread/mutex.hpp>
+# include <boost/thread/condition_variable.hpp>
+
+namespace roboptim
+{
+  /// \brief Fixed-size pool of threads running parallel loops.
+  ///
+  /// This is used by the solver callbacks to evaluate independent
+  /// blocks of functions concurrently. The calling thread takes part
+  /// in the computation, so a pool of size n spawns n - 1 threads.
+  ///
+  /// Tasks must write to disjoint outputs. Exceptions thrown by a task
+  /// are caught and rethrown as std::runtime_error by run ().
+  class NagThreadPool : private boost::noncopyable
+  {
+  public:
+    /// \brief Task type: called with the index of the block to process.
+    typedef boost::function<void (std::size_t)> task_t;
+
+    /// \brief Create the pool.
+    /// \param size number of threads (including the calling thread).
+    explicit NagThreadPool (std::size_t size)
+      : threads_ (),
+        mutex_ (),
+        start_ (),
+        done_ (),
+        task_ (0),
+        size_ (0),
+        next_ (0),
+        pending_ (0),
+        generation_ (0),
+        stop_ (false),
+        error_ ()
+    {
+      for (std::size_t i = 1; i < size; ++i)
+        threads_.create_thread (boost::bind (&NagThreadPool::loop, this));
+    }
+
+    ~NagThreadPool ()
+    {
+      {
+        boost::unique_lock<boost::mutex> lock (mutex_);
+        stop_ = true;
+      }
+      start_.notify_all ();
+      threads_.join_all ();
+    }
+
+    /// \brief Number of threads, including the calling thread.
+    std::size_t size () const
+    {
+      return threads_.size () + 1;
+    }
+
+    /// \brief Run task (i) for i in [0, n) and wait for completion.
+    /// \param n number of blocks.
+    /// \param task task run on each block.
+    void run (std::size_t n, const task_t& task)
+    {
+      // Do not pay for synchronization if there is nothing to share.
+      if (threads_.size () == 0 || n <= 1)
+      {
+        for (std::size_t i = 0; i < n; ++i) task (i);
+        return;
+      }
+
+      {
+        boost::unique_lock<boost::mutex> lock (mutex_);
+        task_ = &task;
+        size_ = n;
+        next_ = 0;
+        pending_ = threads_.size ();
+        error_.clear ();
+        ++generation_;
+      }
+      start_.notify_all ();
+
+      work ();
+
+      boost::unique_lock<boost::mutex> lock (mutex_);
+      while (pending_ > 0) done_.wait (lock);
+      task_ = 0;
+
+      if (!error_.empty ()) throw std::runtime_error (error_);
+    }
+
+  private:
+    /// \brief Process blocks until none is left.
+    void work ()
+    {
+      for (;;)
+      {
+        std::size_t i;
+        {
+          boost::unique_lock<boost::mutex> lock (mutex_);
+          if (next_ >= size_) return;
+          i = next_++;
+        }
+
+        try
+        {
+          (*task_) (i);
+        }
+        catch (const std::exception& e)
+        {
+          boost::unique_lock<boost::mutex> lock (mutex_);
+          if (error_.empty ()) error_ = e.what ();
+        }
+        catch (...)
+        {
+          boost::unique_lock<boost::mutex> lock (mutex_);
+          if (error_.empty ()) error_ = "unknown error in parallel task";
+        }
+      }
+    }
+
+    /// \brief Main loop of the worker threads.
+    void loop ()
+    {
+      std::size_t generation = 0;
+      for (;;)
+      {
+        {
+          boost::unique_lock<boost::mutex> lock (mutex_);
+          while (generation_ == generation && !stop_) start_.wait (lock);
+          if (stop_) return;
+          generation = generation_;
+        }
+
+        work ();
+
+        boost::unique_lock<boost::mutex> lock (mutex_);
+        if (--pending_ == 0) done_.notify_one ();
+      }
+    }
+
+    /// \brief Worker threads.
+    boost::thread_group threads_;
+
+    /// \brief Mutex protecting the shared state.
+    boost::mutex mutex_;
+
+    /// \brief Notified when a new loop starts (or on destruction).
+    boost::condition_variable start_;
+
+    /// \brief Notified when all worker threads are done.
+    boost::condition_variable done_;
+
+    /// \brief Current task.
+    const task_t* task_;
+
+    /// \brief Number of blocks of the current loop.
+    std::size_t size_;
+
+    /// \brief Next block to process.
+    std::size_t next_;
+
+    /// \brief Number of worker threads still running the current loop.
+    std::size_t pending_;
+
+    /// \brief Loop counter used to wake up the worker threads.
+    std::size_t generation_;
+
+    /// \brief Whether the worker threads should exit.
+    bool stop_;
+
+    /// \brief First error raised by a task.
+    std::string error_;
+  };
+} // end of namespace roboptim
+
+#endif //! ROBOPTIM_CORE_NAG_THREAD_POOL_HH
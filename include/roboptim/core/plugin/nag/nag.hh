@@ -39,6 +39,10 @@ namespace roboptim
   /// it will usually work if the derivative has occasional
   /// discontinuities).
   ///
+  /// If "nag.grid-points" is set, the function is first evaluated on a
+  /// uniform grid of the interval (see NagBatchEvaluation), and the
+  /// search is restricted to the neighbourhood of the best grid point.
+  ///
   /// \see http://www.nag.com/numeric/CL/nagdoc_cl23/html/E04/e04abc.html
   class ROBOPTIM_DLLEXPORT NagSolver : public NagSolverCommon<EigenMatrixDense>
   {
@@ -52,7 +56,25 @@ namespace roboptim
     /// \brief Solve the problem.
     void solve ();
 
+    void setIterationCallback (callback_t callback)
+    {
+      callback_ = callback;
+    }
+
+    const callback_t& callback () const
+    {
+      return callback_;
+    }
+
+    solverState_t& solverState ()
+    {
+      return solverState_;
+    }
+
   private:
+    /// \brief Solve the problem (without statistics bookkeeping).
+    void impl_solve ();
+
     /// \brief Relative accuracy.
     double e1_;
     /// \brief Absolute accuracy.
@@ -65,6 +87,16 @@ namespace roboptim
     vector_t x_;
     /// \brief Current cost.
     vector_t f_;
+    /// \brief Grid bracketing the minimum.
+    Function::matrix_t grid_;
+    /// \brief Cost on the grid.
+    Function::matrix_t gridValues_;
+
+    /// \brief Per-iteration callback function.
+    callback_t callback_;
+
+    /// \brief Solver state
+    solverState_t solverState_;
   };
 
   /// @}
@@ -0,0 +1,471 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+// Must come before Eigen (see nag-allocation-audit.hh).
+#include <roboptim/core/plugin/nag/nag-allocation-audit.hh>
+
+#include <algorithm>
+#include <stdexcept>
+#include <typeinfo>
+
+#include <boost/bind.hpp>
+#include <boost/format.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include <roboptim/core/numeric-linear-function.hh>
+#include <roboptim/core/differentiable-function.hh>
+
+#include <roboptim/core/plugin/nag/nag-auto.hh>
+#include <roboptim/core/plugin/nag/nag-hooks.hh>
+#include <roboptim/core/plugin/nag/nag-sparse-adapter.hh>
+#include <roboptim/core/plugin/nag/nag-sparsity-pattern.hh>
+
+#define DEFINE_PARAMETER(KEY, DESCRIPTION, VALUE)     \
+  do                                                  \
+  {                                                   \
+    this->parameters_[KEY].description = DESCRIPTION; \
+    this->parameters_[KEY].value = VALUE;             \
+  } while (0)
+
+namespace roboptim
+{
+  namespace
+  {
+    /// \brief Size from which the sparse solver is always used.
+    const Function::size_type sparseSize = 1000;
+
+    /// \brief Size from which sparse constraints use the sparse solver.
+    const Function::size_type sparseConstraintSize = 100;
+
+    /// \brief Constraint Jacobian density below which it is sparse.
+    const double sparseDensity = .1;
+
+    /// \brief Number of random points used to sample the Jacobians.
+    const int probes = 2;
+
+    typedef GenericDifferentiableFunction<EigenMatrixSparse>::jacobian_t
+      sparseJacobian_t;
+
+    /// \brief Density of a Jacobian block (0 if it is empty).
+    double density (Function::size_type nonZeros, Function::size_type rows,
+                    Function::size_type cols)
+    {
+      if (rows == 0 || cols == 0)
+        return 0.;
+      return static_cast<double> (nonZeros)
+        / (static_cast<double> (rows) * static_cast<double> (cols));
+    }
+
+    /// \brief Whether all the bounds are finite.
+    bool finite (const Function::intervals_t& bounds)
+    {
+      for (std::size_t i = 0; i < bounds.size (); ++i)
+        if (bounds[i].first <= -Function::infinity ()
+            || bounds[i].second >= Function::infinity ())
+          return false;
+      return true;
+    }
+
+    /// \brief Whether all the bounds are infinite.
+    bool unbounded (const Function::intervals_t& bounds)
+    {
+      for (std::size_t i = 0; i < bounds.size (); ++i)
+        if (bounds[i].first > -Function::infinity ()
+            || bounds[i].second < Function::infinity ())
+          return false;
+      return true;
+    }
+  } // end of unnamed namespace
+
+  NagSolverAuto::NagSolverAuto (const problem_t& pb)
+    : parent_t (pb),
+      backend_ (),
+      denseFactory_ (),
+      sparseCost_ (),
+      sparseProblem_ (),
+      sparseFactory_ (),
+      forwardedParameters_ (),
+      callback_ (),
+      solverState_ (pb)
+  {
+    chooseBackend ();
+  }
+
+  NagSolverAuto::~NagSolverAuto ()
+  {
+  }
+
+  void NagSolverAuto::chooseBackend ()
+  {
+    const Function::size_type n = problem ().function ().inputSize ();
+    const bool constrained = !problem ().constraints ().empty ();
+    std::string reason;
+    double jacobianDensity = 0.;
+    double linearDensity = 0.;
+    double nonlinearDensity = 0.;
+
+    if (!problem ().function ().asType<DifferentiableFunction> ())
+    {
+      // Only the derivative-free plugins can be used.
+      if (constrained)
+        throw std::runtime_error
+          ("constraints require a differentiable cost function");
+
+      if (n == 1 && finite (argumentBounds ()))
+      {
+        backend_ = "nag";
+        reason = "cost function without gradient of one bounded variable";
+      }
+      else if (unbounded (argumentBounds ()))
+      {
+        const bool batch = !!dynamic_cast<const NagBatchEvaluation*>
+          (&problem ().function ());
+        backend_ = batch ? "nag-simplex-parallel" : "nag-simplex";
+        reason = batch ? "cost function without gradient, batch evaluation"
+                       : "cost function without gradient";
+      }
+      else
+        throw std::runtime_error
+          ("bounds require a differentiable cost function, or a single"
+           " variable with finite bounds");
+    }
+    else if (n == 1 && !constrained && finite (argumentBounds ()))
+    {
+      backend_ = "nag-differentiable";
+      reason = "differentiable cost function of one bounded variable";
+    }
+    else
+    {
+      // Sample the constraint Jacobians around the starting point.
+      Function::vector_t x0 (n);
+      if (problem ().startingPoint ())
+        x0 = *problem ().startingPoint ();
+      else
+        for (Function::size_type i = 0; i < n; ++i)
+          x0[i] = std::max (argumentBounds ()[static_cast<std::size_t> (i)]
+                            .first, std::min (argumentBounds ()
+                                              [static_cast<std::size_t> (i)]
+                                              .second, 0.));
+      NagPatternProbes points (x0, argumentBounds (), probes);
+
+      // The sampled patterns only guide the choice: they may miss
+      // entries that are zero at these points.
+      // Linear and nonlinear rows are counted apart (index 1 for the
+      // linear ones).
+      Function::size_type rows[2] = {0, 0};
+      Function::size_type nonZeros[2] = {0, 0};
+      for (std::size_t i = 0; i < problem ().constraints ().size (); ++i)
+      {
+        const boost::shared_ptr<Function>& cstr =
+          problem ().constraints ()[i];
+        if (!cstr->asType<DifferentiableFunction> ())
+          throw (std::runtime_error
+                 ((boost::format ("constraint %1% is not differentiable")
+                   % i).str ()));
+        const DifferentiableFunction* g =
+          cstr->castInto<DifferentiableFunction> ();
+
+        const bool linear = cstr->asType<LinearFunction> ();
+        NagPatternUnion<sparseJacobian_t> pattern (g->outputSize (),
+                                                   g->inputSize ());
+        for (std::size_t p = 0; p < points.size (); ++p)
+        {
+          // Linear constraints are constant: one point is enough.
+          if (p > 0 && linear) break;
+          sparseJacobian_t jacobian (g->jacobian (points[p]).sparseView ());
+          pattern.add (jacobian);
+        }
+
+        rows[linear] += g->outputSize ();
+        nonZeros[linear] += pattern.pattern ().nonZeros ();
+      }
+
+      const Function::size_type allRows = rows[0] + rows[1];
+      jacobianDensity = density (nonZeros[0] + nonZeros[1], allRows, n);
+      nonlinearDensity = density (nonZeros[0], rows[0], n);
+      linearDensity = density (nonZeros[1], rows[1], n);
+
+      // A dense nonlinear part is not worth a sparse solver, even with
+      // many sparse linear rows (and conversely).
+      const bool sparse = allRows > 0
+        && (rows[0] == 0 || nonlinearDensity <= sparseDensity)
+        && (rows[1] == 0 || linearDensity <= sparseDensity);
+
+      if (n >= sparseSize)
+      {
+        backend_ = "nag-nlp-sparse";
+        reason = (boost::format ("%1% variables") % n).str ();
+      }
+      else if (n >= sparseConstraintSize && sparse)
+      {
+        backend_ = "nag-nlp-sparse";
+        reason = (boost::format ("%1% variables, sparse constraints"
+                                 " (%2% linear, %3% nonlinear rows)")
+                  % n % rows[1] % rows[0]).str ();
+      }
+      else
+      {
+        backend_ = "nag-nlp";
+        reason = (boost::format ("%1% variables, %2% linear and %3%"
+                                 " nonlinear constraint rows")
+                  % n % rows[1] % rows[0]).str ();
+      }
+
+      if (backend_ == "nag-nlp-sparse")
+        convertToSparse ();
+    }
+
+    if (sparseFactory_)
+    {
+      // Dense Hessians do not fit large problems (as in nag-nlp).
+      sparseSolver_t& solver = (*sparseFactory_) ();
+      solver.parameters ()["nag.Hessian"].description =
+        "Hessian approximation";
+      solver.parameters ()["nag.Hessian"].value =
+        std::string ("Limited Memory");
+      copyBackendParameters (solver.parameters ());
+    }
+    else
+    {
+      denseFactory_.reset (new SolverFactory<solver_t> (backend_, problem ()));
+      copyBackendParameters ((*denseFactory_) ().parameters ());
+
+      // The choice is already made: do not forward again.
+      if (backend_ == "nag-nlp")
+        DEFINE_PARAMETER ("nag.sparse-threshold",
+                          "size from which the sparse limited-memory solver"
+                          " is used (0 to disable)", 0);
+    }
+
+    DEFINE_PARAMETER ("nag.auto.backend", "chosen plugin", backend_);
+    DEFINE_PARAMETER ("nag.auto.reason", "reason of the choice", reason);
+    DEFINE_PARAMETER ("nag.auto.density",
+                      "sampled density of the constraint Jacobian",
+                      jacobianDensity);
+    DEFINE_PARAMETER ("nag.auto.linear-density",
+                      "density of the linear constraint rows",
+                      linearDensity);
+    DEFINE_PARAMETER ("nag.auto.nonlinear-density",
+                      "sampled density of the nonlinear constraint rows",
+                      nonlinearDensity);
+  }
+
+  void NagSolverAuto::convertToSparse ()
+  {
+    typedef sparseSolver_t::problem_t sparseProblem_t;
+    typedef GenericNumericLinearFunction<EigenMatrixSparse>
+      sparseLinearFunction_t;
+
+    sparseCost_.reset (new NagSparseAdapter
+                       (*problem ().function ()
+                        .castInto<DifferentiableFunction> ()));
+    sparseProblem_.reset (new sparseProblem_t (*sparseCost_));
+    sparseProblem_->argumentBounds () = problem ().argumentBounds ();
+    if (problem ().startingPoint ())
+      sparseProblem_->startingPoint () = *problem ().startingPoint ();
+
+    for (std::size_t i = 0; i < problem ().constraints ().size (); ++i)
+    {
+      const boost::shared_ptr<Function>& cstr = problem ().constraints ()[i];
+
+      if (cstr->asType<LinearFunction> ())
+      {
+        const NumericLinearFunction* g;
+        boost::scoped_ptr<NumericLinearFunction> g_;
+        if (cstr->asType<NumericLinearFunction> ())
+          g = cstr->castInto<NumericLinearFunction> ();
+        else
+        {
+          g_.reset (new NumericLinearFunction
+                    (*cstr->castInto<LinearFunction> ()));
+          g = g_.get ();
+        }
+
+        // Linear constraints are constant: drop the zeros.
+        boost::shared_ptr<sparseLinearFunction_t> sg
+          (new sparseLinearFunction_t (g->A ().sparseView (), g->b ()));
+        sparseProblem_->addConstraint (sg, problem ().boundsVector ()[i]);
+      }
+      else
+      {
+        const DifferentiableFunction& g =
+          *cstr->castInto<DifferentiableFunction> ();
+
+        // Only a declared pattern is known to hold for every point:
+        // the other constraints are passed as dense blocks.
+        const NagJacobianPattern<EigenMatrixDense>* declared =
+          dynamic_cast<const NagJacobianPattern<EigenMatrixDense>*> (&g);
+        boost::shared_ptr<GenericDifferentiableFunction<EigenMatrixSparse> >
+          sg;
+        if (declared)
+          sg.reset (new NagSparsePatternAdapter
+                    (g, declared->jacobianPattern ().sparseView ()));
+        else
+          sg.reset (new NagSparseAdapter (g));
+        sparseProblem_->addConstraint (sg, problem ().boundsVector ()[i]);
+      }
+    }
+
+    sparseFactory_.reset (new SolverFactory<sparseSolver_t>
+                          (backend_, *sparseProblem_));
+  }
+
+  void NagSolverAuto::copyBackendParameters (const parameters_t& parameters)
+  {
+    for (parameters_t::const_iterator it = parameters.begin ();
+         it != parameters.end (); ++it)
+      parameters_[it->first] = it->second;
+  }
+
+  template <typename T>
+  void NagSolverAuto::forwardUpdates (Solver<T>& solver)
+  {
+    // Forward the parameters of the plugin, and every other NAG option
+    // added by the user, except the ones specific to this solver.
+    typedef typename Solver<T>::parameters_t::iterator iter_t;
+    const std::string prefix = "nag.";
+    const std::string autoPrefix = "nag.auto.";
+    for (parameters_t::const_iterator param = parameters_.begin ();
+         param != parameters_.end (); ++param)
+    {
+      if (param->first.compare (0, autoPrefix.size (), autoPrefix) == 0)
+        continue;
+
+      iter_t it = solver.parameters ().find (param->first);
+      if (it != solver.parameters ().end ()
+          && !forwardedParameters_.count (param->first))
+        it->second.value = param->second.value;
+      else if (param->first.compare (0, prefix.size (), prefix) == 0
+               && param->first != "nag.sparse-threshold")
+      {
+        solver.parameters ()[param->first] = param->second;
+        forwardedParameters_.insert (param->first);
+      }
+    }
+
+    // Options erased from this solver are erased from the plugin.
+    for (std::set<std::string>::iterator it = forwardedParameters_.begin ();
+         it != forwardedParameters_.end ();)
+      if (parameters_.find (*it) == parameters_.end ())
+      {
+        solver.parameters ().erase (*it);
+        forwardedParameters_.erase (it++);
+      }
+      else
+        ++it;
+
+    NagSolverCommon<T>* nag = dynamic_cast<NagSolverCommon<T>*> (&solver);
+    if (!nag) return;
+
+    nag->updateArgumentBounds (argumentBounds ());
+    for (std::size_t i = 0; i < boundsVector ().size (); ++i)
+      nag->updateConstraintBounds (i, boundsVector ()[i]);
+    if (startingPoint ())
+      nag->updateStartingPoint (*startingPoint ());
+  }
+
+  template <typename T>
+  void NagSolverAuto::solveWith (Solver<T>& solver)
+  {
+    typedef typename Solver<T>::problem_t backendProblem_t;
+    typedef typename Solver<T>::solverState_t backendState_t;
+
+    forwardUpdates (solver);
+
+    if (callback_)
+      solver.setIterationCallback
+        (boost::bind (&NagSolverAuto::forwardCallback<backendProblem_t,
+                                                      backendState_t>,
+                      this, _1, _2));
+    else
+      solver.setIterationCallback (typename Solver<T>::callback_t ());
+
+    solver.solve ();
+    result_ = solver.minimum ();
+
+    NagSolverCommon<T>* nag = dynamic_cast<NagSolverCommon<T>*> (&solver);
+    if (!nag) return;
+
+    statistics_ = nag->statistics ();
+    if (statistics_.enabled)
+      statistics_.publish (solverState_);
+  }
+
+  template <typename P, typename S>
+  void NagSolverAuto::forwardCallback (const P&, S& state)
+  {
+    solverState_.x () = state.x ();
+    solverState_.cost () = state.cost ();
+    callback_ (problem (), solverState_);
+  }
+
+  void NagSolverAuto::solve ()
+  {
+    if (sparseFactory_)
+      solveWith ((*sparseFactory_) ());
+    else
+      solveWith ((*denseFactory_) ());
+  }
+
+  void NagSolverAuto::cancel ()
+  {
+    if (sparseFactory_)
+    {
+      NagSolverCommon<EigenMatrixSparse>* nag =
+        dynamic_cast<NagSolverCommon<EigenMatrixSparse>*>
+        (&(*sparseFactory_) ());
+      if (nag) nag->cancel ();
+    }
+    else
+    {
+      NagSolverCommon<EigenMatrixDense>* nag =
+        dynamic_cast<NagSolverCommon<EigenMatrixDense>*>
+        (&(*denseFactory_) ());
+      if (nag) nag->cancel ();
+    }
+  }
+} // end of namespace roboptim
+
+extern "C" {
+  typedef roboptim::NagSolverAuto NagSolverAuto;
+  typedef roboptim::Solver<roboptim::EigenMatrixDense> solver_t;
+
+  ROBOPTIM_DLLEXPORT unsigned getSizeOfProblem ();
+  ROBOPTIM_DLLEXPORT const char* getTypeIdOfConstraintsList ();
+  ROBOPTIM_DLLEXPORT solver_t* create (const NagSolverAuto::problem_t& pb);
+  ROBOPTIM_DLLEXPORT void destroy (solver_t* p);
+
+  ROBOPTIM_DLLEXPORT unsigned getSizeOfProblem ()
+  {
+    return sizeof (NagSolverAuto::problem_t);
+  }
+
+  ROBOPTIM_DLLEXPORT const char* getTypeIdOfConstraintsList ()
+  {
+    return typeid (NagSolverAuto::problem_t::constraintsList_t).name ();
+  }
+
+  ROBOPTIM_DLLEXPORT solver_t* create (const NagSolverAuto::problem_t& pb)
+  {
+    return new NagSolverAuto (pb);
+  }
+
+  ROBOPTIM_DLLEXPORT void destroy (solver_t* p)
+  {
+    delete p;
+  }
+}
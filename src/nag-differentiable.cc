@@ -15,6 +15,9 @@
 // You should have received a copy of the GNU Lesser General Public License
 // along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
 
+// Must come before Eigen (see nag-allocation-audit.hh).
+#include <roboptim/core/plugin/nag/nag-allocation-audit.hh>
+
 #include <cassert>
 #include <cstring>
 
@@ -24,6 +27,7 @@
 #include <nage04.h>
 
 #include <roboptim/core/plugin/nag/nag-differentiable.hh>
+#include <roboptim/core/plugin/nag/nag-grid-search.hh>
 
 #define DEFINE_PARAMETER(KEY, DESCRIPTION, VALUE)     \
   do                                                  \
@@ -54,20 +58,40 @@ namespace roboptim
       Eigen::Map<differentiableFunction_t::gradient_t> gc_ (
         gc, solver->problem ().function ().inputSize ());
 
-      const function_t& fun = solver->problem ().function ();
-
-      if (!fun.asType<differentiableFunction_t> ())
-        throw std::runtime_error ("cost function is not differentiable");
-
-      const differentiableFunction_t* dfun =
-        fun.castInto<differentiableFunction_t> ();
-      (*dfun) (fc_, x_);
-
-      dfun->gradient (gc_, x_, 0);
-
-      if (!solver->callback ()) return;
-      solver->solverState ().x () = x_;
-      solver->callback () (solver->problem (), solver->solverState ());
+      // NAG cannot be interrupted: once a function evaluation failed
+      // or the solve was stopped, the remaining evaluations are skipped.
+      if (solver->hasCallbackError () || solver->stopRequested ())
+      {
+        fc_.setConstant (function_t::infinity ());
+        gc_.setZero ();
+        return;
+      }
+
+      try
+      {
+        const differentiableFunction_t& cost = solver->cost ();
+        NagStatistics& stats = solver->statistics ();
+        NagScopedTimer evaluationTimer (stats.enabled, stats.evaluation);
+        NagAllocationScope audit (stats.evaluation);
+        {
+          NagScopedTimer timer (stats.enabled, stats.cost);
+          cost (fc_, x_);
+        }
+        solver->recordEvaluation (x_, fc_[0]);
+
+        {
+          NagScopedTimer timer (stats.enabled, stats.jacobian);
+          cost.gradient (gc_, x_, 0);
+        }
+
+        if (!solver->callback () || !solver->throttleCallback ()) return;
+        NagScopedTimer timer (stats.enabled, stats.callback);
+        solver->solverState ().x () = x_;
+        solver->callback () (solver->problem (), solver->solverState ());
+      }
+      ROBOPTIM_NAG_CATCH_CALLBACK (solver,
+                                   fc_.setConstant (function_t::infinity ());
+                                   gc_.setZero ())
     }
   } // end of namespace detail
 
@@ -80,6 +104,9 @@ namespace roboptim
       x_ (1),
       f_ (problem ().function ().outputSize ()),
       g_ (problem ().function ().inputSize ()),
+      cost_ (0),
+      grid_ (),
+      gridValues_ (),
       callback_ (),
       solverState_ (pb)
   {
@@ -87,14 +114,19 @@ namespace roboptim
       throw std::runtime_error (
         "this solver only support cost function which input size is 1");
 
+    // The type is checked once, not at each evaluation.
+    if (!problem ().function ().asType<DifferentiableFunction> ())
+      throw std::runtime_error ("cost function is not differentiable");
+    cost_ = problem ().function ().castInto<DifferentiableFunction> ();
+
     // Argument lower (a) and upper (b) bounds.
     assert (static_cast<DifferentiableFunction::size_type> (
-              problem ().argumentBounds ().size ()) ==
+              argumentBounds ().size ()) ==
             problem ().function ().inputSize ());
 
-    for (unsigned i = 0; i < problem ().argumentBounds ().size (); ++i)
-      a_[i] = problem ().argumentBounds ()[i].first,
-      b_[i] = problem ().argumentBounds ()[i].second;
+    for (unsigned i = 0; i < argumentBounds ().size (); ++i)
+      a_[i] = argumentBounds ()[i].first,
+      b_[i] = argumentBounds ()[i].second;
 
     x_.setZero ();
     f_.setZero ();
@@ -102,10 +134,18 @@ namespace roboptim
 
     // Shared parameters.
     DEFINE_PARAMETER ("max-iterations", "number of iterations", 30);
+    DEFINE_PARAMETER ("max-time", "time limit (s), 0 means none", 0.);
 
     // Custom parameters
     DEFINE_PARAMETER ("nag.e1", "relative accuracy (0 means default)", 0.);
     DEFINE_PARAMETER ("nag.e2", "absolute accuracy (0 means default)", 0.);
+    DEFINE_PARAMETER ("nag.grid-points",
+                      "grid points bracketing the minimum (0 means none)", 0);
+    DEFINE_PARAMETER ("nag.statistics", "collect evaluation statistics", 0);
+    DEFINE_PARAMETER ("nag.callback-every",
+                      "call the user callback every n evaluations", 1);
+    DEFINE_PARAMETER ("nag.callback-period",
+                      "minimum time (s) between user callbacks", 0.);
   }
 
   NagSolverDifferentiable::~NagSolverDifferentiable ()
@@ -113,6 +153,21 @@ namespace roboptim
   }
 
   void NagSolverDifferentiable::solve ()
+  {
+    resetStatistics ();
+    resetCallbackThrottle ();
+    resetCallbackError ();
+    resetInterruption ();
+    {
+      NagScopedTimer timer (statistics_.enabled, statistics_.solve);
+      impl_solve ();
+    }
+    checkCallbackError ();
+    checkInterruption ();
+    if (statistics_.enabled) statistics_.publish (solverState_);
+  }
+
+  void NagSolverDifferentiable::impl_solve ()
   {
     // e1 and e2
     e1_ = boost::get<double> (this->parameters_["nag.e1"].value);
@@ -123,7 +178,21 @@ namespace roboptim
       boost::get<int> (this->parameters_["max-iterations"].value);
 
     // Solution.
-    if (problem ().startingPoint ()) x_ = *(problem ().startingPoint ());
+    if (startingPoint ()) x_ = *(startingPoint ());
+
+    // NAG returns the final interval in a and b.
+    a_[0] = argumentBounds ()[0].first;
+    b_[0] = argumentBounds ()[0].second;
+
+    // Bracket the minimum on a grid evaluated at once.
+    int gridPoints =
+      boost::get<int> (this->parameters_["nag.grid-points"].value);
+    try
+    {
+      NagScopedTimer timer (statistics_.enabled, statistics_.cost);
+      gridBracket (*cost_, gridPoints, a_[0], b_[0], grid_, gridValues_);
+    }
+    ROBOPTIM_NAG_CATCH_CALLBACK (this, result_ = NoSolution (); return)
 
     // Nag communication object.
     Nag_Comm comm;
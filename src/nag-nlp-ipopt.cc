@@ -0,0 +1,866 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+// Must come before Eigen (see nag-allocation-audit.hh).
+#include <roboptim/core/plugin/nag/nag-allocation-audit.hh>
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include <boost/foreach.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/variant/apply_visitor.hpp>
+#include <boost/variant/static_visitor.hpp>
+
+#include <roboptim/core/debug.hh>
+#include <roboptim/core/numeric-linear-function.hh>
+
+#include <nag.h>
+#include <nage04.h>
+
+#include <roboptim/core/plugin/nag/nag-nlp-ipopt.hh>
+
+#define DEFINE_PARAMETER(KEY, DESCRIPTION, VALUE)     \
+  do                                                  \
+  {                                                   \
+    this->parameters_[KEY].description = DESCRIPTION; \
+    this->parameters_[KEY].value = VALUE;             \
+  } while (0)
+
+namespace roboptim
+{
+  namespace detail
+  {
+    /// \brief Bounds larger than this are considered infinite by NAG
+    /// (default "Infinite Bound Size").
+    static const double infiniteBound = 1e20;
+
+    static double clampBound (double bound)
+    {
+      return std::max (-infiniteBound, std::min (infiniteBound, bound));
+    }
+
+    static NagSolverNlpIpopt* getSolver (Nag_Comm* comm)
+    {
+      assert (!!comm);
+      assert (!!comm->p);
+      return static_cast<NagSolverNlpIpopt*> (comm->p);
+    }
+
+    /// \brief Convert a parameter value to a NAG option string.
+    struct OptionFormatter : public boost::static_visitor<std::string>
+    {
+      explicit OptionFormatter (const std::string& key)
+        : boost::static_visitor<std::string> (),
+          key_ (key)
+      {
+      }
+
+      std::string operator() (const Function::value_type& val) const
+      {
+        std::ostringstream ss;
+        ss.precision (17);
+        ss << key_ << " = " << val;
+        return ss.str ();
+      }
+
+      std::string operator() (const int& val) const
+      {
+        std::ostringstream ss;
+        ss << key_ << " = " << val;
+        return ss.str ();
+      }
+
+      std::string operator() (const std::string& val) const
+      {
+        return val.empty () ? key_ : key_ + " = " + val;
+      }
+
+      std::string operator() (const char* val) const
+      {
+        return (*this) (std::string (val));
+      }
+
+      template <typename T>
+      std::string operator() (const T&) const
+      {
+        return std::string ();
+      }
+
+    private:
+      std::string key_;
+    };
+
+    /// \brief Free the NAG handle when leaving the scope.
+    struct HandleGuard : private boost::noncopyable
+    {
+      HandleGuard ()
+        : handle (0)
+      {
+      }
+
+      ~HandleGuard ()
+      {
+        if (!handle) return;
+
+        // Errors are ignored here: we may be unwinding after an error.
+        NagError fail;
+        std::memset (&fail, 0, sizeof (NagError));
+        INIT_FAIL (fail);
+        nag_opt_handle_free (&handle, &fail);
+      }
+
+      void* handle;
+    };
+
+    /// \brief Add the weighted Hessian of a block to the Lagrangian.
+    static void addHessians (NagSolverNlpIpopt::NonlinearBlock& block,
+                             Eigen::Map<const Function::vector_t>& x,
+                             const double* weights, double hx[])
+    {
+      for (std::size_t i = 0; i < block.hessians.size (); ++i)
+      {
+        NagSolverNlpIpopt::HessianBlock& h = block.hessians[i];
+        const double w = weights[h.output];
+
+        // Inactive constraints do not contribute to the Lagrangian.
+        if (w == 0.) continue;
+
+        block.function->hessian (h.hessian.buffer (), x, h.output);
+        h.hessian.scatter (&h.values[0]);
+
+        for (std::size_t k = 0; k < h.values.size (); ++k)
+          if (h.positions[k] >= 0) hx[h.positions[k]] += w * h.values[k];
+      }
+    }
+
+    static void objfun (::Integer nvar, const double x[], double* fx,
+                        ::Integer* inform, Nag_Comm* comm)
+    {
+      NagSolverNlpIpopt* solver = getSolver (comm);
+
+      try
+      {
+        NagStatistics& stats = solver->statistics ();
+        NagScopedTimer evaluationTimer (stats.enabled, stats.evaluation);
+        NagAllocationScope audit (stats.evaluation);
+        NagScopedTimer timer (stats.enabled, stats.cost);
+
+        Eigen::Map<const Function::vector_t> x_ (x, nvar);
+        Eigen::Map<Function::vector_t> fx_ (fx, 1);
+        (*solver->costBlock ().function) (fx_, x_);
+      }
+      ROBOPTIM_NAG_CATCH_CALLBACK (solver, *inform = -1)
+    }
+
+    static void objgrd (::Integer nvar, const double x[], ::Integer nnzfd,
+                        double fdx[], ::Integer* inform, Nag_Comm* comm)
+    {
+      NagSolverNlpIpopt* solver = getSolver (comm);
+
+      try
+      {
+        NagStatistics& stats = solver->statistics ();
+        NagScopedTimer evaluationTimer (stats.enabled, stats.evaluation);
+        NagAllocationScope audit (stats.evaluation);
+        NagScopedTimer timer (stats.enabled, stats.jacobian);
+
+        NagSolverNlpIpopt::NonlinearBlock& block = solver->costBlock ();
+
+        // Constant cost function: a single zero entry is given to NAG.
+        if (block.jacobian.nonZeros () == 0)
+        {
+          std::fill (fdx, fdx + nnzfd, 0.);
+          return;
+        }
+
+        Eigen::Map<const Function::vector_t> x_ (x, nvar);
+        block.function->jacobian (block.jacobian.buffer (), x_);
+        block.jacobian.scatter (fdx);
+      }
+      ROBOPTIM_NAG_CATCH_CALLBACK (solver, *inform = -1)
+    }
+
+    static void confun (::Integer nvar, const double x[],
+                        ::Integer ROBOPTIM_DEBUG_ONLY (ncnln),
+                        double gx[], ::Integer* inform, Nag_Comm* comm)
+    {
+      NagSolverNlpIpopt* solver = getSolver (comm);
+
+      try
+      {
+        NagStatistics& stats = solver->statistics ();
+        NagScopedTimer evaluationTimer (stats.enabled, stats.evaluation);
+        NagAllocationScope audit (stats.evaluation);
+        NagScopedTimer timer (stats.enabled, stats.constraints);
+
+        Eigen::Map<const Function::vector_t> x_ (x, nvar);
+        std::vector<NagSolverNlpIpopt::NonlinearBlock>& blocks =
+          solver->constraintBlocks ();
+
+        for (std::size_t i = 0; i < blocks.size (); ++i)
+        {
+          const Function::size_type m = blocks[i].function->outputSize ();
+          assert (blocks[i].rowOffset + m <= ncnln);
+          Eigen::Map<Function::vector_t> gx_ (gx + blocks[i].rowOffset, m);
+          (*blocks[i].function) (gx_, x_);
+        }
+      }
+      ROBOPTIM_NAG_CATCH_CALLBACK (solver, *inform = -1)
+    }
+
+    static void congrd (::Integer nvar, const double x[],
+                        ::Integer ROBOPTIM_DEBUG_ONLY (nnzgd), double gdx[],
+                        ::Integer* inform, Nag_Comm* comm)
+    {
+      NagSolverNlpIpopt* solver = getSolver (comm);
+
+      try
+      {
+        NagStatistics& stats = solver->statistics ();
+        NagScopedTimer evaluationTimer (stats.enabled, stats.evaluation);
+        NagAllocationScope audit (stats.evaluation);
+        NagScopedTimer timer (stats.enabled, stats.jacobian);
+
+        Eigen::Map<const Function::vector_t> x_ (x, nvar);
+        std::vector<NagSolverNlpIpopt::NonlinearBlock>& blocks =
+          solver->constraintBlocks ();
+
+        for (std::size_t i = 0; i < blocks.size (); ++i)
+        {
+          NagSparseBlock& jac = blocks[i].jacobian;
+          assert (blocks[i].gOffset + jac.nonZeros () <= nnzgd);
+          blocks[i].function->jacobian (jac.buffer (), x_);
+          jac.scatter (gdx + blocks[i].gOffset);
+        }
+      }
+      ROBOPTIM_NAG_CATCH_CALLBACK (solver, *inform = -1)
+    }
+
+    static void hess (::Integer nvar, const double x[], ::Integer,
+                      ::Integer ROBOPTIM_DEBUG_ONLY (idf), double sigma,
+                      const double lambda[], ::Integer nnzh, double hx[],
+                      ::Integer* inform, Nag_Comm* comm)
+    {
+      // Only the Hessian of the Lagrangian is defined.
+      assert (idf == -1);
+
+      NagSolverNlpIpopt* solver = getSolver (comm);
+
+      try
+      {
+        NagStatistics& stats = solver->statistics ();
+        NagScopedTimer evaluationTimer (stats.enabled, stats.evaluation);
+        NagAllocationScope audit (stats.evaluation);
+        NagScopedTimer timer (stats.enabled, stats.hessian);
+
+        Eigen::Map<const Function::vector_t> x_ (x, nvar);
+        std::fill (hx, hx + nnzh, 0.);
+
+        // H = sigma * H(f) + sum_i lambda_i * H(g_i)
+        addHessians (solver->costBlock (), x_, &sigma, hx);
+
+        std::vector<NagSolverNlpIpopt::NonlinearBlock>& blocks =
+          solver->constraintBlocks ();
+        for (std::size_t i = 0; i < blocks.size (); ++i)
+          addHessians (blocks[i], x_, lambda + blocks[i].rowOffset, hx);
+      }
+      ROBOPTIM_NAG_CATCH_CALLBACK (solver, *inform = -1)
+    }
+
+    static void monit (::Integer nvar, const double x[], ::Integer,
+                       const double[], ::Integer* inform, const double rinfo[],
+                       const double[], Nag_Comm* comm)
+    {
+      NagSolverNlpIpopt* solver = getSolver (comm);
+
+      // Stop the solve on cancellation or when the time limit is
+      // exceeded: the last iterate is returned.
+      if (solver->stopRequested ())
+      {
+        *inform = -1;
+        return;
+      }
+
+      try
+      {
+        NagStatistics& stats = solver->statistics ();
+        NagScopedTimer evaluationTimer (stats.enabled, stats.evaluation);
+        NagAllocationScope audit (stats.evaluation);
+
+        if (!solver->callback () || !solver->throttleCallback ()) return;
+        NagScopedTimer timer (stats.enabled, stats.callback);
+        solver->solverState ().x () = Eigen::Map<const Function::vector_t>
+          (x, nvar);
+        solver->solverState ().cost () = rinfo[0];
+        solver->callback () (solver->problem (), solver->solverState ());
+      }
+      ROBOPTIM_NAG_CATCH_CALLBACK (solver, *inform = -1)
+    }
+  } // end of namespace detail
+
+  NagSolverNlpIpopt::NagSolverNlpIpopt (const problem_t& pb)
+    : parent_t (pb),
+      n_ (static_cast<Integer> (pb.function ().inputSize ())),
+      nclin_ (0),
+      ncnln_ (0),
+      bl_ (),
+      bu_ (),
+      linearLower_ (),
+      linearUpper_ (),
+      linearShift_ (),
+      irowb_ (),
+      icolb_ (),
+      b_ (),
+      nonlinearLower_ (),
+      nonlinearUpper_ (),
+      irowgd_ (),
+      icolgd_ (),
+      idxfd_ (),
+      irowh_ (),
+      icolh_ (),
+      costBlock_ (),
+      constraintBlocks_ (),
+      constraintRows_ (),
+      x_ (pb.function ().inputSize ()),
+      u_ (),
+      rinfo_ (32),
+      stats_ (32),
+      callback_ (),
+      solverState_ (pb),
+      structureCached_ (false),
+      structureKey_ ()
+  {
+    this->parameters_.clear ();
+
+    // Shared parameters.
+    DEFINE_PARAMETER ("max-iterations", "number of iterations", 3000);
+    DEFINE_PARAMETER ("max-time", "time limit (s), 0 means none", 0.);
+
+    // NAG specific.
+    DEFINE_PARAMETER ("nag.Print Level", "verbosity of the solver", 0);
+
+    // Not standard NAG parameters.
+    DEFINE_PARAMETER ("nag.sparsity-probes",
+                      "random points used to detect sparsity patterns", 2);
+    DEFINE_PARAMETER ("nag.statistics", "collect evaluation statistics", 0);
+    DEFINE_PARAMETER ("nag.callback-every",
+                      "call the user callback every n evaluations", 1);
+    DEFINE_PARAMETER ("nag.callback-period",
+                      "minimum time (s) between user callbacks", 0.);
+  }
+
+  NagSolverNlpIpopt::~NagSolverNlpIpopt ()
+  {
+  }
+
+  std::string NagSolverNlpIpopt::checkProblem () const
+  {
+    if (!problem ().function ().asType<twiceDifferentiableFunction_t> ())
+      return "cost function should be twice differentiable";
+
+    typedef problem_t::constraints_t::const_iterator iter_t;
+    for (iter_t it = problem ().constraints ().begin ();
+         it != problem ().constraints ().end (); ++it)
+      if (!(*it)->asType<linearFunction_t> () &&
+          !(*it)->asType<twiceDifferentiableFunction_t> ())
+        return "nonlinear constraints should be twice differentiable";
+
+    return std::string ();
+  }
+
+  NagSolverNlpIpopt::vector_t NagSolverNlpIpopt::lookForX () const
+  {
+    if (startingPoint ()) return *(startingPoint ());
+    return vector_t::Zero (n_);
+  }
+
+  void NagSolverNlpIpopt::fill_linear ()
+  {
+    irowb_.clear ();
+    icolb_.clear ();
+    b_.clear ();
+    linearShift_.clear ();
+
+    for (std::size_t constraintId = 0;
+         constraintId < problem ().constraints ().size (); ++constraintId)
+    {
+      const boost::shared_ptr<const function_t>& cstr =
+        problem ().constraints ()[constraintId];
+
+      if (!cstr->asType<linearFunction_t> ()) continue;
+
+      const numericLinearFunction_t* g;
+      boost::scoped_ptr<numericLinearFunction_t> g_;
+
+      if (cstr->asType<numericLinearFunction_t> ())
+        g = cstr->castInto<numericLinearFunction_t> ();
+      else
+      {
+        // Create a numeric linear function from a linear function
+        g_.reset (
+          new numericLinearFunction_t (*(cstr->castInto<linearFunction_t> ())));
+        g = g_.get ();
+      }
+
+      constraintRows_[constraintId] = nclin_;
+
+      for (int k = 0; k < g->A ().outerSize (); ++k)
+        for (function_t::matrix_t::InnerIterator it (g->A (), k); it; ++it)
+        {
+          irowb_.push_back (nclin_ + static_cast<Integer> (it.row ()) + 1);
+          icolb_.push_back (static_cast<Integer> (it.col ()) + 1);
+          b_.push_back (it.value ());
+        }
+
+      // The bounds are shifted by -b (see fill_bounds).
+      for (function_t::size_type i = 0; i < g->outputSize (); ++i)
+        linearShift_.push_back (g->b ()[i]);
+
+      nclin_ += static_cast<Integer> (g->outputSize ());
+    }
+  }
+
+  void NagSolverNlpIpopt::fill_nonlinear ()
+  {
+    irowgd_.clear ();
+    icolgd_.clear ();
+    idxfd_.clear ();
+    constraintBlocks_.clear ();
+
+    // Points where the derivatives are evaluated to find their structure.
+    const NagPatternProbes probes (
+      lookForX (), argumentBounds (),
+      boost::get<int> (parameters_["nag.sparsity-probes"].value));
+
+    // Cost function gradient pattern.
+    costBlock_ = NonlinearBlock ();
+    costBlock_.function =
+      problem ().function ().castInto<twiceDifferentiableFunction_t> ();
+    costBlock_.functionId = -1;
+    costBlock_.rowOffset = 0;
+    costBlock_.gOffset = 0;
+    costBlock_.jacobian.setPattern (jacobianPattern (*costBlock_.function,
+                                                     probes));
+
+    const jacobian_t& costPattern = costBlock_.jacobian.pattern ();
+    for (int k = 0; k < costPattern.outerSize (); ++k)
+      for (jacobian_t::InnerIterator it (costPattern, k); it; ++it)
+        idxfd_.push_back (static_cast<Integer> (it.col ()) + 1);
+
+    // NAG expects at least one entry.
+    if (idxfd_.empty ()) idxfd_.push_back (1);
+
+    add_hessian_blocks (costBlock_, probes);
+
+    // Nonlinear constraints.
+    Integer gOffset = 0;
+
+    for (std::size_t constraintId = 0;
+         constraintId < problem ().constraints ().size (); ++constraintId)
+    {
+      const boost::shared_ptr<const function_t>& cstr =
+        problem ().constraints ()[constraintId];
+
+      if (cstr->asType<linearFunction_t> ()) continue;
+
+      const twiceDifferentiableFunction_t* g =
+        cstr->castInto<twiceDifferentiableFunction_t> ();
+      assert (!!g);
+
+      constraintRows_[constraintId] = nclin_ + ncnln_;
+
+      NonlinearBlock block;
+      block.function = g;
+      block.functionId = static_cast<int> (constraintId);
+      block.rowOffset = ncnln_;
+      block.gOffset = gOffset;
+      constraintBlocks_.push_back (block);
+
+      // Set the patterns once the block is stored to avoid copying them.
+      NonlinearBlock& stored = constraintBlocks_.back ();
+      stored.jacobian.setPattern (jacobianPattern (*g, probes));
+      add_hessian_blocks (stored, probes);
+
+      // Jacobian entries follow the storage order of the pattern.
+      const jacobian_t& pattern = stored.jacobian.pattern ();
+      for (int k = 0; k < pattern.outerSize (); ++k)
+        for (jacobian_t::InnerIterator it (pattern, k); it; ++it)
+        {
+          irowgd_.push_back (ncnln_ + static_cast<Integer> (it.row ()) + 1);
+          icolgd_.push_back (static_cast<Integer> (it.col ()) + 1);
+        }
+      gOffset += static_cast<Integer> (stored.jacobian.nonZeros ());
+
+      ncnln_ += static_cast<Integer> (g->outputSize ());
+    }
+  }
+
+  void NagSolverNlpIpopt::fill_bounds ()
+  {
+    bl_.resize (n_);
+    bu_.resize (n_);
+    for (std::size_t i = 0; i < static_cast<std::size_t> (n_); ++i)
+    {
+      bl_[static_cast<Function::size_type> (i)] =
+        detail::clampBound (argumentBounds ()[i].first);
+      bu_[static_cast<Function::size_type> (i)] =
+        detail::clampBound (argumentBounds ()[i].second);
+    }
+
+    linearLower_.resize (nclin_);
+    linearUpper_.resize (nclin_);
+    nonlinearLower_.resize (ncnln_);
+    nonlinearUpper_.resize (ncnln_);
+
+    for (std::size_t constraintId = 0;
+         constraintId < problem ().constraints ().size (); ++constraintId)
+    {
+      const bool linear =
+        problem ().constraints ()[constraintId]->asType<linearFunction_t> ();
+      const Integer row =
+        constraintRows_[constraintId] - (linear ? 0 : nclin_);
+      const intervals_t& bounds = boundsVector ()[constraintId];
+
+      for (std::size_t i = 0; i < bounds.size (); ++i)
+      {
+        const Integer k = row + static_cast<Integer> (i);
+        if (linear)
+        {
+          // warning: we shift bounds here.
+          const double shift = linearShift_[static_cast<std::size_t> (k)];
+          linearLower_[k] = detail::clampBound (bounds[i].first - shift);
+          linearUpper_[k] = detail::clampBound (bounds[i].second - shift);
+        }
+        else
+        {
+          nonlinearLower_[k] = detail::clampBound (bounds[i].first);
+          nonlinearUpper_[k] = detail::clampBound (bounds[i].second);
+        }
+      }
+    }
+  }
+
+  void NagSolverNlpIpopt::add_hessian_blocks (NonlinearBlock& block,
+                                              const NagPatternProbes& probes)
+  {
+    const twiceDifferentiableFunction_t& f = *block.function;
+    for (function_t::size_type i = 0; i < f.outputSize (); ++i)
+    {
+      NagPatternUnion<hessian_t> pattern (n_, n_);
+      for (std::size_t k = 0; k < probes.size (); ++k)
+        pattern.add (f.hessian (probes[k], i));
+
+      const hessian_t h = pattern.pattern ();
+      if (h.nonZeros () == 0) continue;
+
+      block.hessians.push_back (HessianBlock ());
+      HessianBlock& stored = block.hessians.back ();
+      stored.output = i;
+      stored.hessian.setPattern (h);
+      stored.values.resize (static_cast<std::size_t> (h.nonZeros ()));
+    }
+  }
+
+  void NagSolverNlpIpopt::fill_hessian ()
+  {
+    typedef Eigen::Triplet<double> triplet_t;
+    std::vector<triplet_t> triplets;
+
+    std::vector<NonlinearBlock*> blocks;
+    blocks.push_back (&costBlock_);
+    for (std::size_t i = 0; i < constraintBlocks_.size (); ++i)
+      blocks.push_back (&constraintBlocks_[i]);
+
+    // Union of the upper triangles of all the Hessians.
+    for (std::size_t b = 0; b < blocks.size (); ++b)
+      for (std::size_t i = 0; i < blocks[b]->hessians.size (); ++i)
+      {
+        const hessian_t& pattern = blocks[b]->hessians[i].hessian.pattern ();
+        for (int k = 0; k < pattern.outerSize (); ++k)
+          for (hessian_t::InnerIterator it (pattern, k); it; ++it)
+            if (it.row () <= it.col ())
+              triplets.push_back (triplet_t (it.row (), it.col (), 1.));
+      }
+
+    hessian_t lagrangian (n_, n_);
+    lagrangian.setFromTriplets (triplets.begin (), triplets.end ());
+    NagSparseBlock structure (lagrangian);
+
+    irowh_.clear ();
+    icolh_.clear ();
+    for (int k = 0; k < structure.pattern ().outerSize (); ++k)
+      for (hessian_t::InnerIterator it (structure.pattern (), k); it; ++it)
+      {
+        irowh_.push_back (static_cast<Integer> (it.row ()) + 1);
+        icolh_.push_back (static_cast<Integer> (it.col ()) + 1);
+      }
+
+    // Map the values of each Hessian to the Hessian of the Lagrangian.
+    for (std::size_t b = 0; b < blocks.size (); ++b)
+      for (std::size_t i = 0; i < blocks[b]->hessians.size (); ++i)
+      {
+        HessianBlock& h = blocks[b]->hessians[i];
+        h.positions.clear ();
+        for (int k = 0; k < h.hessian.pattern ().outerSize (); ++k)
+          for (hessian_t::InnerIterator it (h.hessian.pattern (), k); it; ++it)
+            h.positions.push_back (it.row () <= it.col ()
+                                     ? static_cast<Integer>
+                                         (structure.find (k, it.index ()))
+                                     : -1);
+      }
+  }
+
+  bool NagSolverNlpIpopt::isStructureCached () const
+  {
+    if (!structureCached_) return false;
+
+    const problem_t::constraints_t& constraints = problem ().constraints ();
+    if (structureKey_.size () != constraints.size () + 1) return false;
+    if (structureKey_[0] != &problem ().function ()) return false;
+
+    for (std::size_t i = 0; i < constraints.size (); ++i)
+      if (structureKey_[i + 1] != constraints[i].get ()) return false;
+    return true;
+  }
+
+  void NagSolverNlpIpopt::computeStructure ()
+  {
+    nclin_ = 0;
+    ncnln_ = 0;
+    constraintRows_.assign (problem ().constraints ().size (), 0);
+
+    fill_linear ();
+    fill_nonlinear ();
+    fill_hessian ();
+
+    // Remember which functions this structure corresponds to.
+    structureKey_.clear ();
+    structureKey_.push_back (&problem ().function ());
+    typedef problem_t::constraints_t::const_iterator iter_t;
+    for (iter_t it = problem ().constraints ().begin ();
+         it != problem ().constraints ().end (); ++it)
+      structureKey_.push_back (it->get ());
+
+    structureCached_ = true;
+  }
+
+  void NagSolverNlpIpopt::updateOptions (void* handle, NagError* fail)
+  {
+    // The monitor drives the user callback and the cooperative stop
+    // (it can still be overridden by "nag.Monitor Frequency").
+    nag_opt_handle_opt_set (handle, "Monitor Frequency = 1", fail);
+    detail::checkNagError (fail, "cannot set the monitor frequency");
+
+    const std::string prefix = "nag.";
+    typedef const std::pair<const std::string, Parameter> const_iterator_t;
+    BOOST_FOREACH (const_iterator_t& it, this->parameters_)
+    {
+      if (it.first.substr (0, prefix.size ()) != prefix) continue;
+
+      // Plugin parameters, not known by NAG.
+      const std::string key = it.first.substr (prefix.size ());
+      if (key == "statistics" || key == "callback-every" ||
+          key == "callback-period" || key == "sparsity-probes")
+        continue;
+
+      std::string option =
+        boost::apply_visitor (detail::OptionFormatter (key), it.second.value);
+      if (option.empty ()) continue;
+
+      nag_opt_handle_opt_set (handle, option.c_str (), fail);
+      detail::checkNagError (fail, "invalid parameter " + it.first);
+    }
+
+    // Remap standardized parameters.
+    std::string option =
+      boost::apply_visitor (detail::OptionFormatter ("Outer Iteration Limit"),
+                            this->parameters_["max-iterations"].value);
+    nag_opt_handle_opt_set (handle, option.c_str (), fail);
+    detail::checkNagError (fail, "invalid parameter max-iterations");
+  }
+
+  void NagSolverNlpIpopt::solve ()
+  {
+    resetStatistics ();
+    resetCallbackThrottle ();
+    resetCallbackError ();
+    resetInterruption ();
+    {
+      NagScopedTimer timer (statistics_.enabled, statistics_.solve);
+      impl_solve ();
+    }
+    checkCallbackError ();
+    checkInterruption ();
+
+    if (statistics_.enabled) statistics_.publish (solverState_);
+  }
+
+  void NagSolverNlpIpopt::impl_solve ()
+  {
+    const std::string error = checkProblem ();
+    if (!error.empty ())
+    {
+      this->result_ = SolverError (error);
+      return;
+    }
+
+    // Only compute the Jacobian and Hessian patterns if the problem
+    // changed since the last solve. The bounds may have been updated.
+    {
+      NagScopedTimer timer (statistics_.enabled, statistics_.setup);
+      if (!isStructureCached ()) computeStructure ();
+      fill_bounds ();
+    }
+
+    // Fill starting point.
+    x_ = lookForX ();
+
+    // Multipliers of the variable bounds, linear and nonlinear
+    // constraints (lower and upper bounds).
+    const Integer nnzu = 2 * (n_ + nclin_ + ncnln_);
+    u_.setZero (nnzu);
+
+    // Error code initialization.
+    NagError fail;
+    std::memset (&fail, 0, sizeof (NagError));
+    INIT_FAIL (fail);
+
+    // Errors of the problem definition are reported by exceptions,
+    // thrown outside of NAG calls.
+    detail::HandleGuard guard;
+    nag_opt_handle_init (&guard.handle, n_, &fail);
+    detail::checkNagError (&fail, "cannot initialize the handle");
+    nag_opt_handle_set_simplebounds (guard.handle, n_, bl_.data (),
+                                     bu_.data (), &fail);
+    detail::checkNagError (&fail, "invalid variable bounds");
+
+    if (nclin_ > 0)
+    {
+      Integer idlc = 0;
+      nag_opt_handle_set_linconstr (
+        guard.handle, nclin_, linearLower_.data (), linearUpper_.data (),
+        static_cast<Integer> (b_.size ()), irowb_.data (), icolb_.data (),
+        b_.data (), &idlc, &fail);
+      detail::checkNagError (&fail, "invalid linear constraints");
+    }
+
+    nag_opt_handle_set_nlnobj (guard.handle,
+                               static_cast<Integer> (idxfd_.size ()),
+                               idxfd_.data (), &fail);
+    detail::checkNagError (&fail, "invalid cost function structure");
+
+    if (ncnln_ > 0)
+      nag_opt_handle_set_nlnconstr (
+        guard.handle, ncnln_, nonlinearLower_.data (), nonlinearUpper_.data (),
+        static_cast<Integer> (irowgd_.size ()), irowgd_.data (),
+        icolgd_.data (), &fail);
+    detail::checkNagError (&fail, "invalid nonlinear constraints");
+
+    // Structure of the Hessian of the Lagrangian (idf = -1). Problems
+    // with an identically zero Hessian (linear costs and constraints)
+    // do not define it.
+    if (!irowh_.empty ())
+      nag_opt_handle_set_nlnhess (guard.handle, -1,
+                                  static_cast<Integer> (irowh_.size ()),
+                                  irowh_.data (), icolh_.data (), &fail);
+    detail::checkNagError (&fail, "invalid Hessian structure");
+
+    updateOptions (guard.handle, &fail);
+
+    // Nag communication object.
+    Nag_Comm comm;
+    std::memset (&comm, 0, sizeof (Nag_Comm));
+    comm.p = this;
+
+    nag_opt_handle_solve_ipopt (
+      guard.handle, detail::objfun, detail::objgrd, detail::confun,
+      detail::congrd, detail::hess, detail::monit, n_, x_.data (), nnzu,
+      u_.data (), rinfo_.data (), stats_.data (), &comm, &fail);
+
+    Result res (problem ().function ().inputSize (),
+                problem ().function ().outputSize ());
+
+    res.x = x_;
+    res.value.setZero ();
+    res.value[0] = rinfo_[0];
+
+    // Constraint values and multipliers, in the order of the problem.
+    function_t::size_type size = 0;
+    for (std::size_t i = 0; i < problem ().constraints ().size (); ++i)
+      size += problem ().constraints ()[i]->outputSize ();
+    res.constraints.resize (size);
+    res.lambda.resize (size);
+
+    function_t::size_type offset = 0;
+    for (std::size_t i = 0; i < problem ().constraints ().size (); ++i)
+    {
+      const function_t& g = *problem ().constraints ()[i];
+      const function_t::size_type m = g.outputSize ();
+      g (res.constraints.segment (offset, m), x_);
+
+      // lower bound multiplier minus upper bound multiplier.
+      for (function_t::size_type j = 0; j < m; ++j)
+      {
+        const Function::size_type row = n_ + constraintRows_[i] + j;
+        res.lambda[offset + j] = u_[2 * row] - u_[2 * row + 1];
+      }
+      offset += m;
+    }
+
+    if (fail.code == NE_NOERROR)
+    {
+      this->result_ = res;
+      return;
+    }
+
+    SolverError solverError (fail.message);
+    solverError.lastState () = res;
+    this->result_ = solverError;
+  }
+} // end of namespace roboptim.
+
+extern "C" {
+typedef roboptim::NagSolverNlpIpopt NagSolverNlpIpopt;
+typedef roboptim::Solver< ::roboptim::EigenMatrixSparse> solver_t;
+
+ROBOPTIM_DLLEXPORT unsigned getSizeOfProblem ();
+ROBOPTIM_DLLEXPORT const char* getTypeIdOfConstraintsList ();
+ROBOPTIM_DLLEXPORT solver_t* create (const NagSolverNlpIpopt::problem_t& pb);
+ROBOPTIM_DLLEXPORT void destroy (solver_t* p);
+
+ROBOPTIM_DLLEXPORT unsigned getSizeOfProblem ()
+{
+  return sizeof (NagSolverNlpIpopt::problem_t);
+}
+
+ROBOPTIM_DLLEXPORT const char* getTypeIdOfConstraintsList ()
+{
+  return typeid (NagSolverNlpIpopt::problem_t::constraintsList_t).name ();
+}
+
+ROBOPTIM_DLLEXPORT solver_t* create (const NagSolverNlpIpopt::problem_t& pb)
+{
+  return new roboptim::NagSolverNlpIpopt (pb);
+}
+
+ROBOPTIM_DLLEXPORT void destroy (solver_t* p) { delete p; }
+}
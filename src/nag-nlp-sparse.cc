@@ -15,8 +15,13 @@
 // You should have received a copy of the GNU Lesser General Public License
 // along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
 
+// Must come before Eigen (see nag-allocation-audit.hh).
+#include <roboptim/core/plugin/nag/nag-allocation-audit.hh>
+
 #include <cassert>
+#include <cmath>
 #include <cstring>
+#include <limits>
 #include <stdexcept>
 
 #include <boost/format.hpp>
@@ -30,6 +35,7 @@
 #include <nage04.h>
 
 #include <roboptim/core/plugin/nag/nag-nlp-sparse.hh>
+#include <roboptim/core/plugin/nag/nag-sparsity-pattern.hh>
 
 #ifdef ROBOPTIM_CORE_PLUGIN_NAG_CHECK_GRADIENT
 #include <roboptim/core/finite-difference-gradient.hh>
@@ -74,125 +80,353 @@ namespace roboptim
 
   namespace detail
   {
-    // Constraints Callback
-    static void usrfun (::Integer* status, ::Integer n, const double x[],
-                        ::Integer needf, ::Integer nf, double f[],
-                        ::Integer needg, ::Integer leng, double g[],
-                        Nag_Comm* comm)
+    /// \brief Evaluate a dense block for the current request.
+    ///
+    /// The pattern of the block is full, and G stores it in the storage
+    /// order of the sparse matrices, so the dense Jacobian is copied
+    /// as a whole.
+    template <typename X, typename F>
+    static void evaluateDenseBlock (NagSolverNlpSparse* solver,
+                                    NagSolverNlpSparse::JacobianBlock& block,
+                                    const X& x, F& f)
     {
-      typedef NagSolverNlpSparse::function_t function_t;
-      typedef NagSolverNlpSparse::differentiableFunction_t
-        differentiableFunction_t;
-      typedef differentiableFunction_t::jacobian_t jacobian_t;
+      typedef NagSolverNlpSparse::jacobian_t jacobian_t;
+      typedef Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic,
+                            jacobian_t::IsRowMajor ? Eigen::RowMajor
+                                                   : Eigen::ColMajor>
+        gBlock_t;
 
-      // This is the final call, we do not have anything to do.
-      if (*status >= 2) return;
+      const NagSolverNlpSparse::EvaluationRequest& request =
+        solver->evaluationRequest ();
+      const bool enabled = solver->statistics ().enabled;
 
-      assert (!!comm);
-      assert (!!comm->p);
-      NagSolverNlpSparse* solver = static_cast<NagSolverNlpSparse*> (comm->p);
-      assert (!!solver);
-
-      Eigen::Map<const DifferentiableFunction::argument_t> x_ (x, n);
+      if (request.computeF)
+      {
+        NagScopedTimer timer (enabled, (block.functionId < 0)
+                                         ? block.statistics.cost
+                                         : block.statistics.constraints);
+        (*block.dense) (f, x);
+      }
 
-      // WARNING: the real f array is bigger than that but we map only
-      // the part corresponding to the cost function.
-      Eigen::Map<DifferentiableFunction::result_t> f_ (f, nf);
+      if (request.computeG)
+      {
+        NagScopedTimer timer (enabled, block.statistics.jacobian);
+        block.denseJacobian.setZero ();
+        block.dense->jacobian (block.denseJacobian, x);
+        Eigen::Map<gBlock_t> (request.g + block.gOffset,
+                              block.denseJacobian.rows (),
+                              block.denseJacobian.cols ()) =
+          block.denseJacobian;
+      }
+    }
 
-      typedef NagSolverNlpSparse::problem_t::constraints_t::const_iterator
-        iter_t;
+    /// \brief Evaluate one nonlinear block for the current request.
+    static void evaluateBlock (NagSolverNlpSparse* solver, std::size_t i)
+    {
+      typedef NagSolverNlpSparse::function_t function_t;
 
-      // functions computation are needed
-      if (needf > 0)
-      {
-        // the cost function is evaluated first
-        f_.head<1> () = solver->problem ().function () (x_);
+      const NagSolverNlpSparse::EvaluationRequest& request =
+        solver->evaluationRequest ();
+      NagSolverNlpSparse::JacobianBlock& block = solver->jacobianBlocks ()[i];
 
-        // then the nonlinear constraints
-        unsigned offset = 1;
-        unsigned constraintId = 0;
+      Eigen::Map<const DifferentiableFunction::argument_t> x_ (request.x,
+                                                              request.n);
+      const function_t::size_type m = block.function->outputSize ();
+      Eigen::Map<DifferentiableFunction::result_t> f_ (
+        request.f + block.rowOffset, m);
 
-        for (iter_t it = solver->problem ().constraints ().begin ();
-             it != solver->problem ().constraints ().end ();
-             ++it, ++constraintId)
-        {
-          function_t::result_t res;
+      // Each block has its own statistics since blocks may be
+      // evaluated concurrently.
+      const bool enabled = solver->statistics ().enabled;
+      NagStatistics::Counter& valueCounter = (block.functionId < 0)
+                                               ? block.statistics.cost
+                                               : block.statistics.constraints;
 
-          if ((*it)->asType<NagSolverNlpSparse::linearFunction_t> ()) continue;
+      if (block.dense)
+      {
+        evaluateDenseBlock (solver, block, x_, f_);
+        return;
+      }
 
-          const NagSolverNlpSparse::nonlinearFunction_t* g =
-            (*it)->castInto<NagSolverNlpSparse::nonlinearFunction_t> ();
-          assert (!!g);
-          f_.segment (offset, g->outputSize ()) = (*g) (x_);
-          offset += static_cast<unsigned> (g->outputSize ());
+      // The Jacobian is approximated once all the values are known
+      // (see evaluateDifferences).
+      if (block.finiteDifferences)
+      {
+        {
+          NagScopedTimer timer (enabled, valueCounter);
+          (*block.function) (block.value, x_);
         }
+        if (request.computeF) f_ = block.value;
+        return;
+      }
 
-        // the linear part is not taken into account but we will
-        // have to iterate through linear constraints to fetch
-        // their output size to update the offset
-        for (iter_t it = solver->problem ().constraints ().begin ();
-             it != solver->problem ().constraints ().end ();
-             ++it, ++constraintId)
+      if (request.computeF && request.computeG && block.combined)
+      {
+        // Value and Jacobian share intermediate computations.
+        NagScopedTimer timer (enabled, block.statistics.jacobian);
+        block.combined->valueAndJacobian (f_, block.jacobian.buffer (), x_);
+      }
+      else
+      {
+        if (request.computeF)
         {
-          if (!(*it)->asType<NagSolverNlpSparse::linearFunction_t> ()) continue;
+          NagScopedTimer timer (enabled, valueCounter);
+          (*block.function) (f_, x_);
+        }
 
-          const NagSolverNlpSparse::linearFunction_t* g =
-            (*it)->castInto<NagSolverNlpSparse::linearFunction_t> ();
-          assert (!!g);
-          offset += static_cast<unsigned> (g->outputSize ());
+        if (request.computeG)
+        {
+          NagScopedTimer timer (enabled, block.statistics.jacobian);
+          block.function->jacobian (block.jacobian.buffer (), x_);
         }
+      }
 
-        assert (offset == nf);
+      // Jacobians are evaluated in preallocated buffers sharing the
+      // cached sparsity pattern, then scattered in the G array.
+      if (request.computeG)
+      {
+        checkJacobian (*block.function, block.functionId, x_);
+        block.jacobian.scatter (request.g + block.gOffset);
       }
+    }
 
-      // gradient functions computation are needed
-      if (needg > 0)
+    /// \brief Task evaluating nonlinear blocks in the thread pool.
+    struct BlockTask
+    {
+      explicit BlockTask (NagSolverNlpSparse* solver)
+        : solver_ (solver)
       {
-        Eigen::Map<DifferentiableFunction::vector_t> g_ (g, leng);
+      }
 
-        unsigned offset = 0;
-        jacobian_t j;
+      void operator() (std::size_t i) const
+      {
+        evaluateBlock (solver_, i);
+      }
+
+      NagSolverNlpSparse* solver_;
+    };
+
+    /// \brief Run one perturbed evaluation of a finite-difference block.
+    static void evaluateDifference (NagSolverNlpSparse* solver, std::size_t i)
+    {
+      const NagSolverNlpSparse::DifferenceEvaluation& e =
+        solver->differenceEvaluations ()[i];
+      NagSolverNlpSparse::JacobianBlock& block =
+        solver->jacobianBlocks ()[e.block];
+      const bool enabled = solver->statistics ().enabled;
+
+      if (block.batch)
+        block.differences.evaluate (*block.batch, enabled);
+      else
+        block.differences.evaluate (*block.function, e.color, enabled);
+    }
 
-        // retrieve objective jacobian
-        const differentiableFunction_t* obj;
-        if (!solver->problem ().function ().asType<differentiableFunction_t> ())
-          throw std::runtime_error (
-            "objective function should be differentiable");
+    /// \brief Task running perturbed evaluations in the thread pool.
+    struct DifferenceTask
+    {
+      explicit DifferenceTask (NagSolverNlpSparse* solver)
+        : solver_ (solver)
+      {
+      }
 
-        obj =
-          solver->problem ().function ().castInto<differentiableFunction_t> ();
-        j = obj->jacobian (x_);
+      void operator() (std::size_t i) const
+      {
+        evaluateDifference (solver_, i);
+      }
 
-        checkJacobian (*obj, -1, x_);
+      NagSolverNlpSparse* solver_;
+    };
+
+    /// \brief Approximate the Jacobians of the finite-difference blocks.
+    ///
+    /// The values at x have been computed by evaluateBlock. The
+    /// perturbed points of all the blocks are then evaluated, possibly
+    /// concurrently, and the differences are written to G.
+    template <typename X>
+    static void evaluateDifferences (NagSolverNlpSparse* solver, const X& x,
+                                     double g[])
+    {
+      std::vector<NagSolverNlpSparse::JacobianBlock>& blocks =
+        solver->jacobianBlocks ();
+      for (std::size_t i = 0; i < blocks.size (); ++i)
+        if (blocks[i].finiteDifferences)
+          blocks[i].differences.perturb (x, solver->argumentLowerBounds (),
+                                         solver->argumentUpperBounds ());
+
+      const std::size_t n = solver->differenceEvaluations ().size ();
+      if (solver->threadPool ())
+        solver->threadPool ()->run (n, solver->differenceTask ());
+      else
+        for (std::size_t i = 0; i < n; ++i) evaluateDifference (solver, i);
 
-        for (int k = 0; k < j.outerSize (); ++k)
-          for (function_t::matrix_t::InnerIterator it (j, k); it; ++it)
-            g_[offset++] = it.value ();
+      const bool enabled = solver->statistics ().enabled;
+      for (std::size_t i = 0; i < blocks.size (); ++i)
+      {
+        NagSolverNlpSparse::JacobianBlock& block = blocks[i];
+        if (!block.finiteDifferences) continue;
 
-        function_t::size_type constraintId = 0;
-        for (iter_t it = solver->problem ().constraints ().begin ();
-             it != solver->problem ().constraints ().end ();
-             ++it, ++constraintId)
         {
-          if (!(*it)->asType<NagSolverNlpSparse::linearFunction_t> ()) continue;
+          NagScopedTimer timer (enabled, block.statistics.jacobian);
+          block.differences.scatter (block.value, g + block.gOffset);
+        }
+        block.differences.collectStatistics (
+          (block.functionId < 0) ? block.statistics.cost
+                                 : block.statistics.constraints);
+      }
+    }
+
+    /// \brief Evaluate the nonlinear functions requested by NAG.
+    static void evaluate (NagSolverNlpSparse* solver, ::Integer n,
+                          const double x[], ::Integer needf, ::Integer nf,
+                          double f[], ::Integer needg,
+                          ::Integer ROBOPTIM_DEBUG_ONLY (leng), double g[])
+    {
+      typedef NagSolverNlpSparse::function_t function_t;
+
+      Eigen::Map<const DifferentiableFunction::argument_t> x_ (x, n);
+
+      // WARNING: the real f array is bigger than that but we map only
+      // the part corresponding to the nonlinear functions.
+      Eigen::Map<DifferentiableFunction::result_t> f_ (f, nf);
 
-          const NagSolverNlpSparse::nonlinearFunction_t* g =
-            (*it)->castInto<NagSolverNlpSparse::nonlinearFunction_t> ();
-          assert (!!g);
-          j = g->jacobian (x_);
-          checkJacobian (*g, constraintId, x_);
+      std::vector<NagSolverNlpSparse::JacobianBlock>& blocks =
+        solver->jacobianBlocks ();
+      NagSolverNlpSparse::EvaluationCache& cache = solver->evaluationCache ();
 
-          for (int k = 0; k < j.outerSize (); ++k)
-            for (function_t::matrix_t::InnerIterator it (j, k); it; ++it)
-              g_[offset++] = it.value ();
+      // Evaluations are cached for the last point.
+      if (!cache.hasF && !cache.hasG)
+        cache.x = x_;
+      else if (cache.x != x_)
+      {
+        cache.x = x_;
+        cache.hasF = false;
+        cache.hasG = false;
+      }
+
+      const function_t::size_type nfNonlinear = cache.f.size ();
+      const function_t::size_type ngNonlinear = cache.g.size ();
+      assert (nfNonlinear <= nf);
+      assert (ngNonlinear <= leng);
+
+      // the linear part (A) is handled by NAG, only the cost function and
+      // the nonlinear constraints are evaluated.
+      bool computeF = needf > 0;
+      bool computeG = needg > 0;
+
+      if (computeF && cache.hasF)
+      {
+        f_.head (nfNonlinear) = cache.f;
+        computeF = false;
+      }
+
+      if (computeG && cache.hasG)
+      {
+        Eigen::Map<Function::vector_t> (g, ngNonlinear) = cache.g;
+        computeG = false;
+      }
+
+      if (computeF || computeG)
+      {
+        NagSolverNlpSparse::EvaluationRequest& request =
+          solver->evaluationRequest ();
+        request.x = x;
+        request.n = n;
+        request.f = f;
+        request.g = g;
+        request.computeF = computeF;
+        request.computeG = computeG;
+
+        // Blocks write to disjoint parts of F and G, so they may be
+        // evaluated concurrently.
+        if (solver->threadPool ())
+          solver->threadPool ()->run (blocks.size (), solver->blockTask ());
+        else
+          for (std::size_t i = 0; i < blocks.size (); ++i)
+            evaluateBlock (solver, i);
+
+        if (computeG && !solver->differenceEvaluations ().empty ())
+          evaluateDifferences (solver, x_, g);
+
+        if (computeF)
+        {
+          cache.f = f_.head (nfNonlinear);
+          cache.hasF = true;
+        }
+
+        if (computeG)
+        {
+          cache.g = Eigen::Map<const Function::vector_t> (g, ngNonlinear);
+          cache.hasG = true;
         }
-        assert (offset == leng);
       }
 
-      if (!solver->callback ()) return;
+      if (!solver->callback () || !solver->throttleCallback ()) return;
+      NagScopedTimer timer (solver->statistics ().enabled,
+                            solver->statistics ().callback);
       solver->solverState ().x () = x_;
       solver->callback () (solver->problem (), solver->solverState ());
     }
+
+    // Constraints Callback
+    static void usrfun (::Integer* status, ::Integer n, const double x[],
+                        ::Integer needf, ::Integer nf, double f[],
+                        ::Integer needg, ::Integer leng, double g[],
+                        Nag_Comm* comm)
+    {
+      // This is the final call, we do not have anything to do.
+      if (*status >= 2) return;
+
+      assert (!!comm);
+      assert (!!comm->p);
+      NagSolverNlpSparse* solver = static_cast<NagSolverNlpSparse*> (comm->p);
+      assert (!!solver);
+
+      // Stop the solve on cancellation or when the time limit is
+      // exceeded: the last iterate is returned.
+      if (solver->stopRequested ())
+      {
+        *status = -2;
+        return;
+      }
+
+      // Exceptions must not go through NAG: stop the solve instead.
+      try
+      {
+        {
+          NagStatistics& stats = solver->statistics ();
+          NagScopedTimer evaluationTimer (stats.enabled, stats.evaluation);
+          NagAllocationScope audit (stats.evaluation);
+
+          evaluate (solver, n, x, needf, nf, f, needg, leng, g);
+        }
+
+        // Recorded once the timers are closed. Only the nonlinear rows
+        // of f and the nonlinear Jacobian entries are written by
+        // usrfun, the rest of f and g is left untouched.
+        NagSnapshotWriter* snapshot = solver->evaluationSnapshot ();
+        if (snapshot)
+        {
+          const NagSolverNlpSparse::EvaluationCache& cache =
+            solver->evaluationCache ();
+          const std::size_t n_ = static_cast<std::size_t> (n);
+          const std::size_t nf_ = (needf > 0)
+                                    ? static_cast<std::size_t> (cache.f.size ())
+                                    : 0;
+          const std::size_t ng_ = (needg > 0)
+                                    ? static_cast<std::size_t> (cache.g.size ())
+                                    : 0;
+          snapshot->beginSection (NagSnapshot::EVALUATION, NagSnapshot::REAL,
+                                  2 + n_ + nf_ + ng_);
+          snapshot->append (static_cast<double> (needf));
+          snapshot->append (static_cast<double> (needg));
+          snapshot->append (x, n_);
+          snapshot->append (f, nf_);
+          snapshot->append (g, ng_);
+          snapshot->endSection ();
+        }
+      }
+      ROBOPTIM_NAG_CATCH_CALLBACK (solver, *status = -2)
+    }
   } // end of namespace detail
 
   NagSolverNlpSparse::NagSolverNlpSparse (const problem_t& pb)
@@ -209,12 +443,24 @@ namespace roboptim
       iafun_ (),
       javar_ (),
       a_ (),
+      linearShift_ (),
       lena_ (),
       nea_ (),
       igfun_ (),
       jgvar_ (),
       leng_ (),
       neg_ (),
+      jacobianBlocks_ (),
+      evaluationCache_ (),
+      evaluationRequest_ (),
+      threadPool_ (),
+      blockTask_ (detail::BlockTask (this)),
+      differenceEvaluations_ (),
+      differenceTask_ (detail::DifferenceTask (this)),
+      snapshot_ (),
+      snapshotEvaluations_ (false),
+      state_ (),
+      stateInitialized_ (false),
       xlow_ (),
       xupp_ (),
       xnames_ (),
@@ -229,13 +475,56 @@ namespace roboptim
       ns_ (0.),
       ninf_ (0.),
       sinf_ (0.),
+      infeasibility_ (),
       callback_ (),
-      solverState_ (pb)
+      solverState_ (pb),
+      warmStartState_ (),
+      structureCached_ (false),
+      structureKey_ ()
   {
     initializeParameters ();
+
+    // Custom parameters
+    DEFINE_PARAMETER ("nag.warm-start",
+                      "reuse the basis state of the previous solve", 0);
+    DEFINE_PARAMETER ("nag.eval-threads",
+                      "number of threads evaluating the constraints", 1);
+    DEFINE_PARAMETER ("nag.names",
+                      "pass function and variable names to NAG", 0);
+    DEFINE_PARAMETER ("nag.sparsity-probes",
+                      "random points used to detect sparsity patterns", 2);
+    DEFINE_PARAMETER ("nag.statistics", "collect evaluation statistics", 0);
+    DEFINE_PARAMETER ("nag.callback-every",
+                      "call the user callback every n evaluations", 1);
+    DEFINE_PARAMETER ("nag.callback-period",
+                      "minimum time (s) between user callbacks", 0.);
+    DEFINE_PARAMETER ("nag.bounds-tolerance",
+                      "tolerance used to snap constraint bounds", 1e-6);
+    DEFINE_PARAMETER ("nag.elastic-retry",
+                      "elastic weight of a retry after an infeasible solve "
+                      "(0 means none)", 0.);
+    DEFINE_PARAMETER ("nag.finite-differences",
+                      "approximate all the Jacobians by colored finite "
+                      "differences", 0);
+    DEFINE_PARAMETER ("nag.snapshot",
+                      "snapshot file of the NAG inputs (empty means none)",
+                      std::string (""));
+    DEFINE_PARAMETER ("nag.snapshot-evaluations",
+                      "record the function evaluations in the snapshot", 1);
+
+    warmStartState_.ns = 0;
+    infeasibility_.ninf = 0;
+    infeasibility_.sinf = 0.;
+    infeasibility_.ns = 0;
+    infeasibility_.elasticRetry = false;
   }
 
   NagSolverNlpSparse::~NagSolverNlpSparse ()
+  {
+    clear_names ();
+  }
+
+  void NagSolverNlpSparse::clear_names ()
   {
     // functions and variables names are allocated by strdup so we
     // need to call free, unfortunately Nag API requires a C-array of
@@ -246,6 +535,9 @@ namespace roboptim
 
     for (std::size_t i = 0; i < fnames_.size (); ++i)
       free (const_cast<char*> (fnames_[i]));
+
+    xnames_.clear ();
+    fnames_.clear ();
   }
 
   void NagSolverNlpSparse::compute_nf ()
@@ -277,16 +569,15 @@ namespace roboptim
 
   void NagSolverNlpSparse::fill_xlow_xupp ()
   {
-    assert (problem ().argumentBounds ().size () ==
-            static_cast<std::size_t> (n_));
+    assert (argumentBounds ().size () == static_cast<std::size_t> (n_));
 
     xlow_.resize (n_);
     xupp_.resize (n_);
 
     for (unsigned i = 0; i < n_; ++i)
     {
-      xlow_[i] = problem ().argumentBounds ()[i].first;
-      xupp_[i] = problem ().argumentBounds ()[i].second;
+      xlow_[i] = argumentBounds ()[i].first;
+      xupp_[i] = argumentBounds ()[i].second;
     }
   }
 
@@ -306,54 +597,31 @@ namespace roboptim
     for (unsigned constraintId = 0;
          constraintId < problem ().constraints ().size (); ++constraintId)
     {
-      const boost::shared_ptr<const function_t>& cstr =
-        problem ().constraints ()[constraintId];
-
-      if (cstr->asType<linearFunction_t> ()) continue;
+      if (problem ().constraints ()[constraintId]->asType<linearFunction_t> ())
+        continue;
 
-      const nonlinearFunction_t* g = cstr->castInto<nonlinearFunction_t> ();
-      assert (!!g);
-
-      for (Function::size_type i = 0; i < g->outputSize (); ++i)
+      const intervals_t& bounds = boundsVector ()[constraintId];
+      for (std::size_t i = 0; i < bounds.size (); ++i)
       {
-        std::size_t i_ = static_cast<std::size_t> (i);
-        flow_[offset] = problem ().boundsVector ()[constraintId][i_].first;
-        fupp_[offset] = problem ().boundsVector ()[constraintId][i_].second;
+        flow_[offset] = bounds[i].first;
+        fupp_[offset] = bounds[i].second;
         ++offset;
       }
     }
 
-    // - bounds for linear constraints
+    // - bounds for linear constraints (last rows of F)
     for (unsigned constraintId = 0;
          constraintId < problem ().constraints ().size (); ++constraintId)
     {
-      const boost::shared_ptr<const function_t>& cstr =
-        problem ().constraints ()[constraintId];
-
-      if (!cstr->asType<linearFunction_t> ()) continue;
+      if (!problem ().constraints ()[constraintId]
+             ->asType<linearFunction_t> ())
+        continue;
 
-      const numericLinearFunction_t* g;
-      boost::scoped_ptr<numericLinearFunction_t> g_;
-
-      if (cstr->asType<numericLinearFunction_t> ())
-        g = cstr->castInto<numericLinearFunction_t> ();
-      else
+      const intervals_t& bounds = boundsVector ()[constraintId];
+      for (std::size_t i = 0; i < bounds.size (); ++i)
       {
-        // Create a numeric linear function from a linear function
-        g_.reset (
-          new numericLinearFunction_t (*(cstr->castInto<linearFunction_t> ())));
-        g = g_.get ();
-      }
-      assert (!!g);
-
-      for (function_t::size_type i = 0; i < g->outputSize (); ++i)
-      {
-        std::size_t i_ = static_cast<std::size_t> (i);
-        // warning: we shift bounds here.
-        flow_[offset] =
-          problem ().boundsVector ()[constraintId][i_].first - g->b ()[i];
-        fupp_[offset] =
-          problem ().boundsVector ()[constraintId][i_].second - g->b ()[i];
+        flow_[offset] = bounds[i].first;
+        fupp_[offset] = bounds[i].second;
         ++offset;
       }
     }
@@ -361,55 +629,28 @@ namespace roboptim
     // Make sure we fill the vector entirely.
     assert (offset == nf_);
 
-    // Make sure the bounds are consistent.
-    for (int id = 0; id < nf_; ++id)
-    {
-      if (std::abs (flow_[id]) < 1e-6) flow_[id] = 0.;
-      if (std::abs (fupp_[id]) < 1e-6) fupp_[id] = 0.;
-      if (std::abs (flow_[id] - fupp_[id]) < 1e-6) flow_[id] = fupp_[id];
-      assert (flow_[id] <= fupp_[id]);
-    }
+    // warning: we shift bounds here (b is cached with the structure).
+    flow_.tail (linearShift_.size ()) -= linearShift_;
+    fupp_.tail (linearShift_.size ()) -= linearShift_;
+
+    // Make sure the bounds are consistent: snap values close to 0, and
+    // turn nearly equal bounds into equalities.
+    const double tolerance =
+      boost::get<double> (parameters_["nag.bounds-tolerance"].value);
+    flow_ = (flow_.array ().abs () < tolerance).select (0., flow_);
+    fupp_ = (fupp_.array ().abs () < tolerance).select (0., fupp_);
+    flow_ = ((flow_ - fupp_).array ().abs () < tolerance).select (fupp_, flow_);
+    assert ((flow_.array () <= fupp_.array ()).all ());
   }
 
   NagSolverNlpSparse::function_t::vector_t NagSolverNlpSparse::lookForX ()
   {
     function_t::vector_t x (n_);
 
-    if (!problem ().startingPoint ())
+    if (!startingPoint ())
       x.setZero ();
     else
-      x = *(problem ().startingPoint ());
-    return x;
-  }
-
-  NagSolverNlpSparse::function_t::vector_t NagSolverNlpSparse::lookForX (
-    unsigned constraintId)
-  {
-    function_t::vector_t x (n_);
-
-    // Look for a place to evaluate the jacobian of the
-    // current constraint.
-    // If we do not have an initial guess...
-    if (!problem ().startingPoint ())
-      for (unsigned i = 0; i < x.size (); ++i)
-      {
-        // if constraint is in an interval, evaluate at middle.
-        if (problem ().boundsVector ()[constraintId][i].first !=
-              function_t::infinity () &&
-            problem ().boundsVector ()[constraintId][i].second !=
-              function_t::infinity ())
-          x[i] = (problem ().boundsVector ()[constraintId][i].second -
-                  problem ().boundsVector ()[constraintId][i].first) /
-                 2.;
-        // otherwise use the non-infinite bound.
-        else if (problem ().boundsVector ()[constraintId][i].first !=
-                 function_t::infinity ())
-          x[i] = problem ().boundsVector ()[constraintId][i].first;
-        else
-          x[i] = problem ().boundsVector ()[constraintId][i].second;
-      }
-    else
-      x = *(problem ().startingPoint ());
+      x = *(startingPoint ());
     return x;
   }
 
@@ -439,6 +680,10 @@ namespace roboptim
 
     nea_ = 0;
 
+    // b vectors of the linear constraints, used to shift their bounds.
+    linearShift_.resize (nf_ - offset);
+    function_t::size_type linearOffset = 0;
+
     for (unsigned constraintId = 0;
          constraintId < problem ().constraints ().size (); ++constraintId)
     {
@@ -470,7 +715,11 @@ namespace roboptim
           a_.push_back (it.value ());
         }
       offset += static_cast<int> (g->A ().rows ());
+
+      linearShift_.segment (linearOffset, g->b ().size ()) = g->b ();
+      linearOffset += g->b ().size ();
     }
+    assert (linearOffset == linearShift_.size ());
 
     lena_ = static_cast<int> (iafun_.size ());
     nea_ = lena_;
@@ -489,6 +738,7 @@ namespace roboptim
   {
     igfun_.clear ();
     jgvar_.clear ();
+    jacobianBlocks_.clear ();
 
     function_t::size_type offset = 0;
     neg_ = 0;
@@ -500,17 +750,13 @@ namespace roboptim
 
     obj = problem ().function ().castInto<differentiableFunction_t> ();
 
-    vector_t x = lookForX ();
-    jacobian_t jac = obj->jacobian (x);
-    neg_ += jac.nonZeros ();
+    // Points where the Jacobians are evaluated to find their structure.
+    NagPatternProbes probes (
+      lookForX (), argumentBounds (),
+      boost::get<int> (parameters_["nag.sparsity-probes"].value));
 
-    for (int k = 0; k < jac.outerSize (); ++k)
-      for (jacobian_t::InnerIterator it (jac, k); it; ++it)
-      {
-        igfun_.push_back (it.row () + 1);
-        jgvar_.push_back (it.col () + 1);
-      }
-    offset += jac.rows ();
+    add_jacobian_block (*obj, -1, offset, jacobianPattern (*obj, probes));
+    offset += obj->outputSize ();
 
     for (unsigned constraintId = 0;
          constraintId < problem ().constraints ().size (); ++constraintId)
@@ -524,21 +770,20 @@ namespace roboptim
       const nonlinearFunction_t* g = cstr->castInto<nonlinearFunction_t> ();
       assert (!!g);
 
-      vector_t x = lookForX (constraintId);
-      jacobian_t jac = g->jacobian (x);
-      neg_ += jac.nonZeros ();
-
-      for (int k = 0; k < jac.outerSize (); ++k)
-        for (jacobian_t::InnerIterator it (jac, k); it; ++it)
-        {
-          igfun_.push_back (offset + it.row () + 1);
-          jgvar_.push_back (it.col () + 1);
-        }
-      offset += jac.rows ();
+      add_jacobian_block (*g, static_cast<int> (constraintId), offset,
+                          jacobianPattern (*g, probes));
+      offset += g->outputSize ();
     }
 
     leng_ = static_cast<int> (igfun_.size ());
 
+    // Allocate the evaluation cache once for this structure.
+    evaluationCache_.f.resize (offset);
+    evaluationCache_.g.resize (neg_);
+    evaluationCache_.x.resize (n_);
+    evaluationCache_.hasF = false;
+    evaluationCache_.hasG = false;
+
     if (leng_ == 0)
     {
       igfun_.resize (1);
@@ -548,7 +793,107 @@ namespace roboptim
     }
   }
 
-  void NagSolverNlpSparse::fill_fnames ()
+  void NagSolverNlpSparse::add_jacobian_block (
+    const differentiableFunction_t& f, int functionId,
+    function_t::size_type offset, const jacobian_t& pattern)
+  {
+    JacobianBlock block;
+    block.function = &f;
+    block.combined =
+      dynamic_cast<const NagValueAndJacobian<EigenMatrixSparse>*> (&f);
+    const NagSparseAdapter* adapter =
+      dynamic_cast<const NagSparseAdapter*> (&f);
+    block.dense = adapter ? &adapter->function () : 0;
+    block.functionId = functionId;
+    block.rowOffset = offset;
+    block.gOffset = neg_;
+    block.finiteDifferences = false;
+    block.batch = dynamic_cast<const NagBatchEvaluation*> (&f);
+    jacobianBlocks_.push_back (block);
+
+    // Set the pattern once the block is stored to avoid copying it.
+    NagSparseBlock& jac = jacobianBlocks_.back ().jacobian;
+    jac.setPattern (pattern);
+    if (block.dense)
+    {
+      assert (jac.nonZeros () == f.outputSize () * f.inputSize ());
+      jacobianBlocks_.back ().denseJacobian.resize (f.outputSize (),
+                                                    f.inputSize ());
+    }
+    neg_ += static_cast<Integer> (jac.nonZeros ());
+
+    // G entries follow the storage order of the pattern.
+    for (int k = 0; k < jac.pattern ().outerSize (); ++k)
+      for (jacobian_t::InnerIterator it (jac.pattern (), k); it; ++it)
+      {
+        igfun_.push_back (offset + it.row () + 1);
+        jgvar_.push_back (it.col () + 1);
+      }
+  }
+
+  void NagSolverNlpSparse::updateDifferences ()
+  {
+    const bool forced =
+      boost::get<int> (parameters_["nag.finite-differences"].value) != 0;
+
+    differenceEvaluations_.clear ();
+    for (std::size_t i = 0; i < jacobianBlocks_.size (); ++i)
+    {
+      JacobianBlock& block = jacobianBlocks_[i];
+      const NagFiniteDifferenceJacobian* hook =
+        dynamic_cast<const NagFiniteDifferenceJacobian*> (block.function);
+
+      // Dense blocks are copied as a whole, and keep their Jacobian.
+      const bool differences = !block.dense && (hook || forced);
+      if (differences && !block.finiteDifferences)
+      {
+        block.differences.setPattern (
+          block.jacobian.pattern (),
+          hook ? hook->finiteDifferenceStep ()
+               : std::sqrt (std::numeric_limits<double>::epsilon ()));
+        block.value.resize (block.function->outputSize ());
+      }
+      block.finiteDifferences = differences;
+      if (!differences) continue;
+
+      DifferenceEvaluation e;
+      e.block = i;
+      for (e.color = 0; e.color < block.differences.colors (); ++e.color)
+      {
+        differenceEvaluations_.push_back (e);
+        if (block.batch) break;
+      }
+    }
+  }
+
+  bool NagSolverNlpSparse::useNames () const
+  {
+    if (boost::get<int> (parameters_.find ("nag.names")->second.value) != 0)
+      return true;
+
+    // Names are only used by NAG for printing.
+    parameters_t::const_iterator it = parameters_.find ("nag.output_file");
+    return it != parameters_.end () &&
+           !boost::get<std::string> (it->second.value).empty ();
+  }
+
+  void NagSolverNlpSparse::update_names ()
+  {
+    if (!useNames () || nf_ == 1 || n_ == 1)
+    {
+      // Only default names: the name arrays are not referenced.
+      clear_names ();
+      nfname_ = 1;
+      nxname_ = 1;
+      return;
+    }
+
+    if (fnames_.empty ()) fill_names ();
+    nfname_ = nf_;
+    nxname_ = n_;
+  }
+
+  void NagSolverNlpSparse::fill_names ()
   {
     boost::format fmt ("%1%, %2%, Ouput variable %3%");
 
@@ -591,43 +936,125 @@ namespace roboptim
     }
 
     assert (nf_ == static_cast<int> (fnames_.size ()));
+
+    for (Function::size_type i = 0; i < problem_.function ().inputSize (); ++i)
+      xnames_.push_back (strdup (
+        ((boost::format ("RobOptim variable %1%") % i).str ().c_str ())));
+  }
+
+  bool NagSolverNlpSparse::canWarmStart () const
+  {
+    if (boost::get<int> (parameters_.find ("nag.warm-start")->second.value) ==
+        0)
+      return false;
+
+    return warmStartState_.xstate.size () == static_cast<std::size_t> (n_) &&
+           warmStartState_.fstate.size () == static_cast<std::size_t> (nf_) &&
+           warmStartState_.xmul.size () ==
+             static_cast<Eigen::MatrixXd::Index> (n_) &&
+           warmStartState_.fmul.size () ==
+             static_cast<Eigen::MatrixXd::Index> (nf_);
+  }
+
+  bool NagSolverNlpSparse::isStructureCached () const
+  {
+    if (!structureCached_) return false;
+
+    const problem_t::constraints_t& constraints = problem ().constraints ();
+    if (structureKey_.size () != constraints.size () + 1) return false;
+    if (structureKey_[0] != &problem ().function ()) return false;
+
+    for (std::size_t i = 0; i < constraints.size (); ++i)
+      if (structureKey_[i + 1] != constraints[i].get ()) return false;
+    return true;
+  }
+
+  void NagSolverNlpSparse::cacheStructure ()
+  {
+    // A previously computed structure is being replaced.
+    if (structureCached_) invalidateStructure ();
+
+    compute_nf ();
+
+    // fill sparse A and G date and/or structure
+    fill_iafun_javar_lena_nea ();
+    fill_igfun_jgvar_leng_neg ();
+
+    // Names are generated on demand for this structure.
+    clear_names ();
+
+    // Remember which functions this structure corresponds to.
+    structureKey_.clear ();
+    structureKey_.push_back (&problem ().function ());
+    typedef problem_t::constraints_t::const_iterator iter_t;
+    for (iter_t it = problem ().constraints ().begin ();
+         it != problem ().constraints ().end (); ++it)
+      structureKey_.push_back (it->get ());
+
+    structureCached_ = true;
   }
 
   const char* cxxtoCString (std::string s) { return s.c_str (); }
   void NagSolverNlpSparse::solve ()
   {
-    compute_nf ();
+    resetStatistics ();
+    resetCallbackThrottle ();
+    resetCallbackError ();
+    resetInterruption ();
+    {
+      NagScopedTimer timer (statistics_.enabled, statistics_.solve);
+      impl_solve ();
+    }
+    checkCallbackError ();
+    checkInterruption ();
 
-    if (nf_ == 1 || n_ == 1)
+    if (statistics_.enabled)
     {
-      nfname_ = 1.;
-      nxname_ = 1.;
+      for (std::size_t i = 0; i < jacobianBlocks_.size (); ++i)
+        statistics_.merge (jacobianBlocks_[i].statistics);
+      statistics_.publish (solverState_);
     }
-    else
+  }
+
+  void NagSolverNlpSparse::impl_solve ()
+  {
+    // Only compute the sparsity structure if it changed since the
+    // last solve.
     {
-      nfname_ = nf_;
-      nxname_ = n_;
+      NagScopedTimer timer (statistics_.enabled, statistics_.setup);
+      if (!isStructureCached ()) cacheStructure ();
+      updateDifferences ();
     }
 
-    // fill sparse A and G date and/or structure
-    fill_iafun_javar_lena_nea ();
-    fill_igfun_jgvar_leng_neg ();
+    for (std::size_t i = 0; i < jacobianBlocks_.size (); ++i)
+      jacobianBlocks_[i].statistics.reset ();
+
+    // Functions may have changed since the last solve.
+    evaluationCache_.hasF = false;
+    evaluationCache_.hasG = false;
+
+    // Create the thread pool evaluating the nonlinear blocks.
+    std::size_t threads = static_cast<std::size_t> (
+      std::max (1, boost::get<int> (parameters_["nag.eval-threads"].value)));
+    if (threads == 1)
+      threadPool_.reset ();
+    else if (!threadPool_ || threadPool_->size () != threads)
+      threadPool_.reset (new NagThreadPool (threads));
+
+    update_names ();
 
     // Fill bounds.
     fill_xlow_xupp ();
     fill_flow_fupp ();
 
-    // Fill fnames.
-    fill_fnames ();
-
     // Fill xstate.
     x_.resize (n_);
     xstate_.resize (static_cast<std::size_t> (n_));
     xmul_.resize (static_cast<Eigen::MatrixXd::Index> (n_));
 
     // Fill starting point.
-    if (problem ().startingPoint ())
-      x_ = *problem ().startingPoint ();
+    if (startingPoint ())
+      x_ = *startingPoint ();
     else
       x_.setZero ();
 
@@ -636,31 +1063,48 @@ namespace roboptim
     fstate_.resize (static_cast<std::size_t> (nf_));
     fmul_.resize (nf_);
 
+    // Reuse the basis state of a previous solve if possible.
+    Nag_Start start = Nag_Cold;
+    if (canWarmStart ())
+    {
+      start = Nag_Warm;
+      xstate_ = warmStartState_.xstate;
+      fstate_ = warmStartState_.fstate;
+      xmul_ = warmStartState_.xmul;
+      fmul_ = warmStartState_.fmul;
+      ns_ = warmStartState_.ns;
+    }
+
     // Error code initialization.
     NagError fail;
     std::memset (&fail, 0, sizeof (NagError));
     INIT_FAIL (fail);
-    fail.handler = &errorHandler;
 
     // To print NAG errors to stdout
     // fail.print = Nag_TRUE;
 
-    Nag_E04State state;
-    std::memset (&state, 0, sizeof (Nag_E04State));
-
-    nag_opt_sparse_nlp_init (&state, &fail);
-    updateParameters (&state, &fail);
+    // The NAG state is initialized once: subsequent solves only update
+    // the options that changed.
+    if (!stateInitialized_)
+    {
+      std::memset (&state_, 0, sizeof (Nag_E04State));
+      nag_opt_sparse_nlp_init (&state_, &fail);
+      if (fail.code != NE_NOERROR)
+      {
+        this->result_ = SolverError (fail.message);
+        return;
+      }
+      invalidateParameters ();
+      stateInitialized_ = true;
+    }
+    std::vector<std::string> options;
+    updateParameters (&state_, &fail, &options);
 
     // Nag communication object.
     Nag_Comm comm;
     std::memset (&comm, 0, sizeof (Nag_Comm));
     comm.p = this;
 
-    // Solve.
-    for (Function::size_type i = 0; i < problem_.function ().inputSize (); ++i)
-      xnames_.push_back (strdup (
-        ((boost::format ("RobOptim variable %1%") % i).str ().c_str ())));
-
     // Double check that sizes are valid.
     ROBOPTIM_ASSERT (nf_ > 0);
     ROBOPTIM_ASSERT (n_ > 0);
@@ -695,13 +1139,39 @@ namespace roboptim
     ROBOPTIM_ASSERT (fmul_.size () ==
                      static_cast<Eigen::MatrixXd::Index> (nf_));
 
-    nag_opt_sparse_nlp_solve (
-      Nag_Cold, nf_, n_, nxname_, nfname_, objadd_, objrow_, "RobOptim problem",
-      detail::usrfun, iafun_.data (), javar_.data (), a_.data (), lena_, nea_,
-      igfun_.data (), jgvar_.data (), leng_, neg_, xlow_.data (), xupp_.data (),
-      xnames_.data (), flow_.data (), fupp_.data (), fnames_.data (),
-      x_.data (), xstate_.data (), xmul_.data (), f_.data (), fstate_.data (),
-      fmul_.data (), &ns_, &ninf_, &sinf_, &state, &comm, &fail);
+    startSnapshot (start, options);
+    solveNag (start, &state_, &comm, &fail);
+    snapshot_.reset ();
+
+    // Re-enter NAG from the infeasible point with a new elastic weight.
+    const double elasticWeight =
+      boost::get<double> (parameters_["nag.elastic-retry"].value);
+    infeasibility_.elasticRetry = fail.code != NE_NOERROR && ninf_ > 0 &&
+                                  elasticWeight > 0. &&
+                                  !hasCallbackError () && !stopRequested ();
+    if (infeasibility_.elasticRetry)
+    {
+      INIT_FAIL (fail);
+      // The elastic weight is not part of the parameters: the state
+      // is initialized again by the next solve.
+      stateInitialized_ = false;
+      NagParametersUpdater ("Elastic Weight", &state_, &fail) (elasticWeight);
+      detail::checkNagError (&fail, "invalid parameter nag.elastic-retry");
+      solveNag (Nag_Warm, &state_, &comm, &fail);
+    }
+
+    infeasibility_.ninf = ninf_;
+    infeasibility_.sinf = sinf_;
+    infeasibility_.ns = ns_;
+    infeasibility_.fstate = fstate_;
+    infeasibility_.fmul = fmul_;
+
+    // Save the basis state for subsequent warm starts.
+    warmStartState_.xstate = xstate_;
+    warmStartState_.fstate = fstate_;
+    warmStartState_.xmul = xmul_;
+    warmStartState_.fmul = fmul_;
+    warmStartState_.ns = ns_;
 
     Result res (problem ().function ().inputSize (),
                 problem ().function ().outputSize ());
@@ -718,10 +1188,65 @@ namespace roboptim
       return;
     }
 
-    SolverError error (fail.message);
+    std::string message = fail.message;
+    if (ninf_ > 0)
+      message += (boost::format (" (ninf = %1%, sinf = %2%)")
+                  % ninf_ % sinf_).str ();
+
+    SolverError error (message);
     error.lastState () = res;
     this->result_ = error;
   }
+
+  void NagSolverNlpSparse::startSnapshot (
+    Nag_Start start, const std::vector<std::string>& options)
+  {
+    snapshot_.reset ();
+    const std::string filename =
+      boost::get<std::string> (parameters_["nag.snapshot"].value);
+    if (filename.empty ()) return;
+
+    snapshotEvaluations_ =
+      boost::get<int> (parameters_["nag.snapshot-evaluations"].value) != 0;
+    snapshot_.reset (new NagSnapshotWriter (filename, NagSnapshot::SPARSE_NLP));
+
+    const Integer nfNonlinear =
+      static_cast<Integer> (evaluationCache_.f.size ());
+    const Integer dimensions[] = {nf_,  n_,    objrow_, lena_, nea_,
+                                  leng_, neg_, start,   ns_,   nfNonlinear};
+    snapshot_->write (NagSnapshot::DIMENSIONS, dimensions,
+                      sizeof (dimensions) / sizeof (Integer));
+    snapshot_->write (options);
+    snapshot_->write (NagSnapshot::IAFUN, iafun_);
+    snapshot_->write (NagSnapshot::JAVAR, javar_);
+    snapshot_->write (NagSnapshot::A, a_);
+    snapshot_->write (NagSnapshot::IGFUN, igfun_.data (),
+                      static_cast<std::size_t> (leng_));
+    snapshot_->write (NagSnapshot::JGVAR, jgvar_.data (),
+                      static_cast<std::size_t> (leng_));
+    snapshot_->write (NagSnapshot::XLOW, xlow_);
+    snapshot_->write (NagSnapshot::XUPP, xupp_);
+    snapshot_->write (NagSnapshot::FLOW, flow_);
+    snapshot_->write (NagSnapshot::FUPP, fupp_);
+    snapshot_->write (NagSnapshot::X, x_);
+    snapshot_->write (NagSnapshot::XSTATE, xstate_);
+    snapshot_->write (NagSnapshot::XMUL, xmul_);
+    snapshot_->write (NagSnapshot::FSTATE, fstate_);
+    snapshot_->write (NagSnapshot::FMUL, fmul_);
+  }
+
+  void NagSolverNlpSparse::solveNag (Nag_Start start, Nag_E04State* state,
+                                     Nag_Comm* comm, NagError* fail)
+  {
+    nag_opt_sparse_nlp_solve (
+      start, nf_, n_, nxname_, nfname_, objadd_, objrow_, "RobOptim problem",
+      detail::usrfun, iafun_.data (), javar_.data (), a_.data (), lena_, nea_,
+      igfun_.data (), jgvar_.data (), leng_, neg_, xlow_.data (), xupp_.data (),
+      xnames_.empty () ? 0 : xnames_.data (), flow_.data (), fupp_.data (),
+      fnames_.empty () ? 0 : fnames_.data (),
+      x_.data (), xstate_.data (), xmul_.data (), f_.data (), fstate_.data (),
+      fmul_.data (), &ns_, &ninf_, &sinf_, state, comm, fail);
+  }
 } // end of namespace roboptim.
 
 extern "C" {
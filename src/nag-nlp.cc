@@ -15,9 +15,16 @@
 // You should have received a copy of the GNU Lesser General Public License
 // along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
 
+// Must come before Eigen (see nag-allocation-audit.hh).
+#include <roboptim/core/plugin/nag/nag-allocation-audit.hh>
+
+#include <algorithm>
 #include <cassert>
 #include <cstring>
 
+#include <boost/bind.hpp>
+#include <boost/scoped_ptr.hpp>
+
 #include <roboptim/core/numeric-linear-function.hh>
 #include <roboptim/core/differentiable-function.hh>
 
@@ -37,12 +44,82 @@ namespace roboptim
 {
   namespace detail
   {
+    /// \brief Mutex serializing the plugin loads of all the solvers.
+    ///
+    /// libltdl is not thread-safe, and the sparse solver is loaded (and
+    /// unloaded) by solve () and the destructor, which may run in any
+    /// thread (e.g. NagBatchSolver workers).
+    static boost::mutex pluginMutex;
+
+    /// \brief Evaluate one nonlinear constraint for the current request.
+    static void evaluateConstraint (NagSolverNlp* solver, std::size_t i)
+    {
+      const NagSolverNlp::EvaluationRequest& request =
+	solver->evaluationRequest ();
+      NagSolverNlp::ConstraintBlock& block = solver->constraintBlocks ()[i];
+      const DifferentiableFunction* g = block.function;
+      assert (!!g);
+
+      // Skip the constraint if none of its rows is needed.
+      bool needed = false;
+      for (Function::size_type k = 0; k < g->outputSize () && !needed; ++k)
+	needed = request.needc[block.offset + k] > 0;
+      if (!needed)
+	return;
+
+      // Maps C-arrays to Eigen structures.
+      Eigen::Map<const DifferentiableFunction::argument_t> x_
+	(request.x, request.n);
+      Eigen::Map<DifferentiableFunction::result_t> ccon_
+	(request.ccon, request.ncnln);
+      Eigen::Map<Eigen::Matrix<
+	double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> > jac_
+	(request.cjac, request.ncnln, request.tdcj);
+
+      // Each block has its own statistics since blocks may be
+      // evaluated concurrently.
+      const bool enabled = solver->statistics ().enabled;
+
+      // evaluate constraint (in place, ccon rows are contiguous).
+      if (request.mode == 0 || request.mode == 2)
+	{
+	  NagScopedTimer timer (enabled, block.statistics.constraints);
+	  (*g) (ccon_.segment (block.offset, g->outputSize ()), x_);
+	}
+
+      // evaluate jacobian. cjac is row-major, so the Jacobian is
+      // evaluated in a preallocated buffer, then copied.
+      if (request.mode == 1 || request.mode == 2)
+	{
+	  NagScopedTimer timer (enabled, block.statistics.jacobian);
+	  block.jacobian.setZero ();
+	  g->jacobian (block.jacobian, x_);
+	  jac_.block (block.offset, 0, g->outputSize (), g->inputSize ()) =
+	    block.jacobian;
+	}
+    }
+
+    /// \brief Task evaluating nonlinear constraints in the thread pool.
+    struct ConstraintTask
+    {
+      explicit ConstraintTask (NagSolverNlp* solver)
+	: solver_ (solver)
+      {}
+
+      void operator() (std::size_t i) const
+      {
+	evaluateConstraint (solver_, i);
+      }
+
+      NagSolverNlp* solver_;
+    };
+
     // Constraints Callback
     static void confun (::Integer* mode,
 			::Integer ncnln,
 			::Integer n,
 			::Integer tdcj,
-			const ::Integer[] /* needc */,
+			const ::Integer needc[],
 			const double x[],
 			double ccon[],
 			double cjac[],
@@ -54,40 +131,65 @@ namespace roboptim
       NagSolverNlp* solver = static_cast<NagSolverNlp*> (comm->p);
       assert (!!solver);
 
-      // Maps C-arrays to Eigen structures.
-      Eigen::Map<const DifferentiableFunction::argument_t> x_ (x, n);
-      Eigen::Map<DifferentiableFunction::result_t> ccon_ (ccon, ncnln);
-      Eigen::Map<Eigen::Matrix<
-	double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> > jac_
-	(cjac, ncnln, tdcj);
+      // Stop the solve on cancellation or when the time limit is
+      // exceeded: the last iterate is returned.
+      if (solver->stopRequested ())
+	{
+	  *mode = -1;
+	  return;
+	}
 
-      // Iterate on constraints.
-      Function::size_type idx = 0;
-      typedef NagSolverNlp::problem_t::constraints_t::const_iterator iter_t;
-      for (iter_t it = solver->problem ().constraints ().begin ();
-	   it != solver->problem ().constraints ().end (); ++it)
+      // Exceptions must not go through NAG: stop the solve instead.
+      try
 	{
-	  DifferentiableFunction const* g;
-          if ((*it)->asType<DifferentiableFunction>())
-            g = (*it)->castInto<DifferentiableFunction>();
-          else throw std::runtime_error ("invalid constraint provided");
-	  assert (!!g);
-
-	  // evaluate constraint.
-	  if (*mode == 0 || *mode == 2)
-	    {
-	      ccon_.segment (idx, g->outputSize ()) = (*g) (x_);
-	    }
+	  {
+	    NagStatistics& stats = solver->statistics ();
+	    NagScopedTimer evaluationTimer (stats.enabled, stats.evaluation);
+	    NagAllocationScope audit (stats.evaluation);
+
+	    NagSolverNlp::EvaluationRequest& request =
+	      solver->evaluationRequest ();
+	    request.mode = *mode;
+	    request.ncnln = ncnln;
+	    request.n = n;
+	    request.tdcj = tdcj;
+	    request.needc = needc;
+	    request.x = x;
+	    request.ccon = ccon;
+	    request.cjac = cjac;
+
+	    // Constraints write to disjoint rows of ccon and cjac, so they
+	    // may be evaluated concurrently.
+	    std::size_t nBlocks = solver->constraintBlocks ().size ();
+	    if (solver->threadPool ())
+	      solver->threadPool ()->run (nBlocks, solver->constraintTask ());
+	    else
+	      for (std::size_t i = 0; i < nBlocks; ++i)
+		evaluateConstraint (solver, i);
+	  }
 
-	  // evaluate jacobian.
-	  if (*mode == 1 || *mode == 2)
+	  // Recorded once the timers are closed.
+	  NagSnapshotWriter* snapshot = solver->evaluationSnapshot ();
+	  if (snapshot)
 	    {
-	      jac_.block (idx, 0, g->outputSize (), g->inputSize ()) =
-		g->jacobian (x_);
+	      const std::size_t ncnln_ = static_cast<std::size_t> (ncnln);
+	      const std::size_t n_ = static_cast<std::size_t> (n);
+	      const std::size_t nc = (*mode == 0 || *mode == 2) ? ncnln_ : 0;
+	      const std::size_t nj = (*mode == 1 || *mode == 2)
+		? ncnln_ * static_cast<std::size_t> (tdcj) : 0;
+	      snapshot->beginSection (NagSnapshot::CONSTRAINTS_EVALUATION,
+				      NagSnapshot::REAL,
+				      1 + ncnln_ + n_ + nc + nj);
+	      snapshot->append (static_cast<double> (*mode));
+	      for (std::size_t i = 0; i < ncnln_; ++i)
+		snapshot->append (static_cast<double> (needc[i]));
+	      snapshot->append (x, n_);
+	      snapshot->append (ccon, nc);
+	      snapshot->append (cjac, nj);
+	      snapshot->endSection ();
 	    }
-
-	  idx += g->outputSize ();
 	}
+      ROBOPTIM_NAG_CATCH_CALLBACK (solver, *mode = -1)
     }
 
     // Objective callback
@@ -104,30 +206,72 @@ namespace roboptim
       NagSolverNlp* solver = static_cast<NagSolverNlp*> (comm->p);
       assert (!!solver);
 
-      // Maps C-arrays to Eigen structures.
-      Eigen::Map<const Function::argument_t> x_ (x, n);
-      Eigen::Map<Function::result_t> objf_ (objf, 1);
-      Eigen::Map<DifferentiableFunction::gradient_t> grad_ (grad, n);
+      if (solver->stopRequested ())
+	{
+	  *mode = -1;
+	  return;
+	}
 
-      DifferentiableFunction const* f;
-      if (solver->problem ().function ().asType<DifferentiableFunction>())
-        f = solver->problem ().function ().castInto<DifferentiableFunction>();
-      else throw std::runtime_error ("invalid cost function provided");
+      try
+	{
+	  NagStatistics& stats = solver->statistics ();
 
-      assert (!!mode);
-      assert (*mode >= 0 && *mode <= 2 && "should never happen");
-      if (*mode == 0 || *mode == 2) // evaluate objective
-	objf_ = (*f) (x_);
+	  // Maps C-arrays to Eigen structures.
+	  Eigen::Map<const Function::argument_t> x_ (x, n);
+	  Eigen::Map<Function::result_t> objf_ (objf, 1);
+	  Eigen::Map<DifferentiableFunction::gradient_t> grad_ (grad, n);
 
-      if (*mode == 1 || *mode == 2) // evaluate objective gradient
-	grad_ = f->gradient (x_, 0);
+	  {
+	    NagScopedTimer evaluationTimer (stats.enabled, stats.evaluation);
+	    NagAllocationScope audit (stats.evaluation);
+
+	    DifferentiableFunction const* f;
+	    if (solver->problem ().function ().asType<DifferentiableFunction>())
+	      f = solver->problem ().function ()
+		.castInto<DifferentiableFunction>();
+	    else throw std::runtime_error ("invalid cost function provided");
+
+	    assert (!!mode);
+	    assert (*mode >= 0 && *mode <= 2 && "should never happen");
+	    if (*mode == 0 || *mode == 2) // evaluate objective
+	      {
+		NagScopedTimer timer (stats.enabled, stats.cost);
+		(*f) (objf_, x_);
+	      }
+
+	    if (*mode == 1 || *mode == 2) // evaluate objective gradient
+	      {
+		NagScopedTimer timer (stats.enabled, stats.jacobian);
+		grad_.setZero ();
+		f->gradient (grad_, x_, 0);
+	      }
+	  }
 
-      if (!solver->callback ())
-	return;
-      solver->solverState ().x () = x_;
-      // TODO: support multi-objective
-      solver->solverState ().cost () = objf_[0];
-      solver->callback () (solver->problem (), solver->solverState ());
+	  // Recorded once the timers are closed.
+	  NagSnapshotWriter* snapshot = solver->evaluationSnapshot ();
+	  if (snapshot)
+	    {
+	      const std::size_t n_ = static_cast<std::size_t> (n);
+	      const std::size_t nf = (*mode == 0 || *mode == 2) ? 1 : 0;
+	      const std::size_t ng = (*mode == 1 || *mode == 2) ? n_ : 0;
+	      snapshot->beginSection (NagSnapshot::COST_EVALUATION,
+				      NagSnapshot::REAL, 1 + n_ + nf + ng);
+	      snapshot->append (static_cast<double> (*mode));
+	      snapshot->append (x, n_);
+	      snapshot->append (objf, nf);
+	      snapshot->append (grad, ng);
+	      snapshot->endSection ();
+	    }
+
+	  if (!solver->callback () || !solver->throttleCallback ())
+	    return;
+	  NagScopedTimer timer (stats.enabled, stats.callback);
+	  solver->solverState ().x () = x_;
+	  // TODO: support multi-objective
+	  solver->solverState ().cost () = objf_[0];
+	  solver->callback () (solver->problem (), solver->solverState ());
+	}
+      ROBOPTIM_NAG_CATCH_CALLBACK (solver, *mode = -1)
     }
   } // end of namespace detail
 
@@ -141,6 +285,7 @@ namespace roboptim
       tdh_ (problem ().function ().inputSize ()),
       objf_ (1),
       a_ (),
+      linearShift_ (),
       bl_ (),
       bu_ (),
       ccon_ (),
@@ -149,40 +294,278 @@ namespace roboptim
       grad_ (),
       h_ (),
       x_ (pb.function ().inputSize ()),
+      istate_ (),
+      warmStartValid_ (false),
       callback_ (),
-      solverState_ (pb)
+      solverState_ (pb),
+      constraintBlocks_ (),
+      evaluationRequest_ (),
+      threadPool_ (),
+      constraintTask_ (detail::ConstraintTask (this)),
+      snapshot_ (),
+      snapshotEvaluations_ (false),
+      sparseCost_ (),
+      sparseProblem_ (),
+      sparseFactory_ (),
+      sparseMutex_ (),
+      forwardedParameters_ ()
   {
     objf_[0] = 0.;
+
+    // Custom parameters
+    DEFINE_PARAMETER ("nag.warm-start",
+		      "reuse the Hessian and active set of the previous solve",
+		      0);
+    DEFINE_PARAMETER ("nag.eval-threads",
+		      "number of threads evaluating the constraints", 1);
+    DEFINE_PARAMETER ("nag.statistics", "collect evaluation statistics", 0);
+    DEFINE_PARAMETER ("nag.callback-every",
+		      "call the user callback every n evaluations", 1);
+    DEFINE_PARAMETER ("nag.callback-period",
+		      "minimum time (s) between user callbacks", 0.);
+    DEFINE_PARAMETER ("nag.sparse-threshold",
+		      "size from which the sparse limited-memory solver is used"
+		      " (0 to disable)", 0);
+    DEFINE_PARAMETER ("nag.snapshot",
+		      "snapshot file of the NAG inputs (empty means none)",
+		      std::string (""));
+    DEFINE_PARAMETER ("nag.snapshot-evaluations",
+		      "record the function evaluations in the snapshot", 1);
   }
 
   NagSolverNlp::~NagSolverNlp ()
-  {}
+  {
+    boost::mutex::scoped_lock lock (detail::pluginMutex);
+    sparseFactory_.reset ();
+  }
 
-  void
-  NagSolverNlp::solve ()
+  bool NagSolverNlp::useSparseSolver () const
+  {
+    int threshold = boost::get<int>
+      (parameters_.find ("nag.sparse-threshold")->second.value);
+    return threshold > 0 && n_ >= threshold;
+  }
+
+  void NagSolverNlp::solveSparse ()
+  {
+    typedef sparseSolver_t::problem_t sparseProblem_t;
+    typedef GenericNumericLinearFunction<EigenMatrixSparse>
+      sparseLinearFunction_t;
+
+    // Convert the problem once.
+    if (!sparseFactory_)
+      {
+	if (!problem ().function ().asType<DifferentiableFunction> ())
+	  throw std::runtime_error ("invalid cost function provided");
+
+	sparseCost_.reset (new NagSparseAdapter
+			   (*problem ().function ()
+			    .castInto<DifferentiableFunction> ()));
+	sparseProblem_.reset (new sparseProblem_t (*sparseCost_));
+	sparseProblem_->argumentBounds () = problem ().argumentBounds ();
+	if (problem ().startingPoint ())
+	  sparseProblem_->startingPoint () = *problem ().startingPoint ();
+
+	for (std::size_t i = 0; i < problem ().constraints ().size (); ++i)
+	  {
+	    const boost::shared_ptr<Function>& cstr =
+	      problem ().constraints ()[i];
+
+	    if (cstr->asType<LinearFunction> ())
+	      {
+		const NumericLinearFunction* g;
+		boost::scoped_ptr<NumericLinearFunction> g_;
+		if (cstr->asType<NumericLinearFunction> ())
+		  g = cstr->castInto<NumericLinearFunction> ();
+		else
+		  {
+		    g_.reset (new NumericLinearFunction
+			      (*cstr->castInto<LinearFunction> ()));
+		    g = g_.get ();
+		  }
+
+		// Linear constraints are constant: drop the zeros.
+		boost::shared_ptr<sparseLinearFunction_t> sg
+		  (new sparseLinearFunction_t (g->A ().sparseView (), g->b ()));
+		sparseProblem_->addConstraint (sg, problem ().boundsVector ()[i]);
+	      }
+	    else
+	      {
+		boost::shared_ptr<NagSparseAdapter> sg
+		  (new NagSparseAdapter
+		   (*cstr->castInto<DifferentiableFunction> ()));
+		sparseProblem_->addConstraint (sg, problem ().boundsVector ()[i]);
+	      }
+	  }
+
+	boost::mutex::scoped_lock lock (sparseMutex_);
+	boost::mutex::scoped_lock pluginLock (detail::pluginMutex);
+	sparseFactory_.reset (new SolverFactory<sparseSolver_t>
+			      ("nag-nlp-sparse", *sparseProblem_));
+      }
+
+    sparseSolver_t& solver = (*sparseFactory_) ();
+
+    // The solve may have been stopped before the sparse solver existed.
+    if (stopRequested ())
+      {
+	result_ = SolverError ("solve stopped");
+	return;
+      }
+
+    // Forward the parameters shared by both solvers, and every other
+    // NAG option: e04vh accepts most e04wd options, and rejects the
+    // other ones with an error instead of silently ignoring them.
+    typedef sparseSolver_t::parameters_t::iterator iter_t;
+    const std::string prefix = "nag.";
+    for (parameters_t::const_iterator param = parameters_.begin ();
+	 param != parameters_.end (); ++param)
+      {
+	if (param->first == "nag.sparse-threshold")
+	  continue;
+
+	iter_t it = solver.parameters ().find (param->first);
+	if (it != solver.parameters ().end ()
+	    && !forwardedParameters_.count (param->first))
+	  it->second.value = param->second.value;
+	else if (param->first.compare (0, prefix.size (), prefix) == 0)
+	  {
+	    solver.parameters ()[param->first] = param->second;
+	    forwardedParameters_.insert (param->first);
+	  }
+      }
+
+    // Options erased from this solver are erased from the sparse one.
+    for (std::set<std::string>::iterator it = forwardedParameters_.begin ();
+	 it != forwardedParameters_.end ();)
+      if (parameters_.find (*it) == parameters_.end ())
+	{
+	  solver.parameters ().erase (*it);
+	  forwardedParameters_.erase (it++);
+	}
+      else
+	++it;
+
+    // Forward the bound and starting point updates.
+    typedef NagSolverCommon<EigenMatrixSparse> nagSparseSolver_t;
+    nagSparseSolver_t* nagSolver = dynamic_cast<nagSparseSolver_t*> (&solver);
+    if (nagSolver)
+      {
+	nagSolver->updateArgumentBounds (argumentBounds ());
+	for (std::size_t i = 0; i < boundsVector ().size (); ++i)
+	  nagSolver->updateConstraintBounds (i, boundsVector ()[i]);
+	if (startingPoint ())
+	  nagSolver->updateStartingPoint (*startingPoint ());
+      }
+
+    // Dense Hessians do not fit large problems, unless asked for.
+    if (parameters_.find ("nag.Hessian") == parameters_.end ())
+      {
+	solver.parameters ()["nag.Hessian"].description =
+	  "Hessian approximation";
+	solver.parameters ()["nag.Hessian"].value =
+	  std::string ("Limited Memory");
+      }
+
+    if (callback_)
+      solver.setIterationCallback
+	(boost::bind (&NagSolverNlp::forwardCallback, this, _1, _2));
+    else
+      solver.setIterationCallback (sparseSolver_t::callback_t ());
+
+    solver.solve ();
+    result_ = solver.minimum ();
+
+    // The evaluations are counted by the sparse solver.
+    if (nagSolver && statistics_.enabled)
+      {
+	statistics_.merge (nagSolver->statistics ());
+	statistics_.setup.add (nagSolver->statistics ().setup);
+      }
+  }
+
+  void NagSolverNlp::cancel ()
   {
+    parent_t::cancel ();
+
+    boost::mutex::scoped_lock lock (sparseMutex_);
+    if (!sparseFactory_)
+      return;
+
+    typedef NagSolverCommon<EigenMatrixSparse> nagSparseSolver_t;
+    nagSparseSolver_t* solver =
+      dynamic_cast<nagSparseSolver_t*> (&(*sparseFactory_) ());
+    if (solver)
+      solver->cancel ();
+  }
+
+  void NagSolverNlp::forwardCallback (const sparseSolver_t::problem_t&,
+				      sparseSolver_t::solverState_t& state)
+  {
+    solverState_.x () = state.x ();
+    solverState_.cost () = state.cost ();
+    callback_ (problem (), solverState_);
+  }
+
+  bool NagSolverNlp::canWarmStart () const
+  {
+    if (boost::get<int> (parameters_.find ("nag.warm-start")->second.value) ==
+	0)
+      return false;
+
+    return warmStartValid_;
+  }
+
+  bool NagSolverNlp::updateWorkspace ()
+  {
+    const Integer nclin = nclin_;
+    const Integer ncnln = ncnln_;
+
     // Count constraints and compute their size.
+    nclin_ = 0;
+    ncnln_ = 0;
     typedef problem_t::constraints_t::const_iterator iter_t;
     for (iter_t it = problem ().constraints ().begin ();
 	 it != problem ().constraints ().end (); ++it)
       {
 	if ((*it)->asType<LinearFunction> ())
-	  {
-	    LinearFunction* const g = (*it)->castInto<LinearFunction> ();
-	    assert (!!g);
-	    nclin_ += g->outputSize ();
-	  }
+	  nclin_ += (*it)->outputSize ();
 	else if ((*it)->asType<DifferentiableFunction> ())
-	  {
-	    DifferentiableFunction* const g
-              = (*it)->castInto<DifferentiableFunction> ();
-	    assert (!!g);
-	    ncnln_ += g->outputSize ();
-	  }
+	  ncnln_ += (*it)->outputSize ();
 	else
 	  assert (false && "should never happen");
       }
 
+    const bool sameSize = !istate_.empty ()
+      && nclin == nclin_ && ncnln == ncnln_;
+    if (sameSize)
+      return true;
+
+    // Remember where the nonlinear constraint rows are in ccon and cjac.
+    // The blocks are built in place to allocate their Jacobian once.
+    constraintBlocks_.clear ();
+    constraintBlocks_.reserve (problem ().constraints ().size ());
+    Function::size_type offset = 0;
+    for (iter_t it = problem ().constraints ().begin ();
+	 it != problem ().constraints ().end (); ++it)
+      {
+	if ((*it)->asType<LinearFunction> ()
+	    || !(*it)->asType<DifferentiableFunction> ())
+	  continue;
+
+	DifferentiableFunction* const g
+	  = (*it)->castInto<DifferentiableFunction> ();
+	assert (!!g);
+
+	constraintBlocks_.push_back (ConstraintBlock ());
+	ConstraintBlock& block = constraintBlocks_.back ();
+	block.function = g;
+	block.offset = offset;
+	block.jacobian.resize (g->outputSize (), g->inputSize ());
+	offset += g->outputSize ();
+      }
+    assert (offset == ncnln_);
+
     // Resize matrices.
     a_.resize
       (std::max (Integer (1), nclin_), problem ().function ().inputSize ());
@@ -193,54 +576,149 @@ namespace roboptim
     clamda_.resize (n_ + nclin_ + ncnln_);
     grad_.resize (n_);
     h_.resize (n_, n_);
+    istate_.resize (static_cast<std::size_t> (n_ + nclin_ + ncnln_));
+    linearShift_.resize (nclin_);
 
-    // Fill A matrix.
+    // Fill A matrix and the b vectors. Linear constraints are constant,
+    // so this is only done once: they are never evaluated in callbacks.
+    a_.setZero ();
     Function::size_type idx = 0;
     for (iter_t it = problem ().constraints ().begin ();
-	 it != problem ().constraints ().begin (); ++it)
+	 it != problem ().constraints ().end (); ++it)
       {
-	if (!(*it)->asType<NumericLinearFunction> ())
+	if (!(*it)->asType<LinearFunction> ())
 	  continue;
-        NumericLinearFunction* const g =
-            (*it)->castInto<NumericLinearFunction> ();
-        assert (!!g);
-	a_.block (idx, 0, g->outputSize (), g->inputSize ()) = g->A();
+
+	const NumericLinearFunction* g;
+	boost::scoped_ptr<NumericLinearFunction> g_;
+	if ((*it)->asType<NumericLinearFunction> ())
+	  g = (*it)->castInto<NumericLinearFunction> ();
+	else
+	  {
+	    // Create a numeric linear function from a linear function
+	    g_.reset (new NumericLinearFunction
+		      (*((*it)->castInto<LinearFunction> ())));
+	    g = g_.get ();
+	  }
+	assert (!!g);
+
+	a_.block (idx, 0, g->outputSize (), g->inputSize ()) = g->A ();
+	linearShift_.segment (idx, g->outputSize ()) = g->b ();
 	idx += g->outputSize ();
       }
+    assert (idx == nclin_);
+
+    return false;
+  }
+
+  void
+  NagSolverNlp::solve ()
+  {
+    resetStatistics ();
+    resetCallbackThrottle ();
+    resetCallbackError ();
+    resetInterruption ();
+    {
+      NagScopedTimer timer (statistics_.enabled, statistics_.solve);
+      impl_solve ();
+    }
+    checkCallbackError ();
+    checkInterruption ();
+
+    if (statistics_.enabled)
+      {
+	for (std::size_t i = 0; i < constraintBlocks_.size (); ++i)
+	  statistics_.merge (constraintBlocks_[i].statistics);
+	statistics_.publish (solverState_);
+      }
+  }
+
+  void
+  NagSolverNlp::startSnapshot (const std::vector<std::string>& options)
+  {
+    snapshot_.reset ();
+    const std::string filename =
+      boost::get<std::string> (parameters_["nag.snapshot"].value);
+    if (filename.empty ())
+      return;
+
+    snapshotEvaluations_ =
+      boost::get<int> (parameters_["nag.snapshot-evaluations"].value) != 0;
+    snapshot_.reset (new NagSnapshotWriter (filename, NagSnapshot::DENSE_NLP));
+
+    const Integer dimensions[] = {n_, nclin_, ncnln_, tda_, tdcj_, tdh_};
+    snapshot_->write (NagSnapshot::DIMENSIONS, dimensions,
+		      sizeof (dimensions) / sizeof (Integer));
+    snapshot_->write (options);
+    snapshot_->write (NagSnapshot::A, a_);
+    snapshot_->write (NagSnapshot::BL, bl_);
+    snapshot_->write (NagSnapshot::BU, bu_);
+    snapshot_->write (NagSnapshot::ISTATE, istate_);
+    snapshot_->write (NagSnapshot::CLAMDA, clamda_);
+    snapshot_->write (NagSnapshot::H, h_);
+    snapshot_->write (NagSnapshot::X, x_);
+  }
+
+  void
+  NagSolverNlp::impl_solve ()
+  {
+    // Large problems: do not allocate the dense workspace.
+    if (useSparseSolver ())
+      {
+	solveSparse ();
+	return;
+      }
+
+    {
+      NagScopedTimer timer (statistics_.enabled, statistics_.setup);
+      if (!updateWorkspace ())
+	warmStartValid_ = false;
+    }
+
+    for (std::size_t i = 0; i < constraintBlocks_.size (); ++i)
+      constraintBlocks_[i].statistics.reset ();
+
+    // Create the thread pool evaluating the nonlinear constraints.
+    std::size_t threads = static_cast<std::size_t>
+      (std::max (1, boost::get<int> (parameters_["nag.eval-threads"].value)));
+    if (threads == 1)
+      threadPool_.reset ();
+    else if (!threadPool_ || threadPool_->size () != threads)
+      threadPool_.reset (new NagThreadPool (threads));
 
     // Fill bu and bl.
 
     // - x
-    for (unsigned i = 0; i < problem ().argumentBounds ().size (); ++i)
+    for (unsigned i = 0; i < argumentBounds ().size (); ++i)
       {
-	bl_[i] = problem ().argumentBounds ()[i].first;
-	bu_[i] = problem ().argumentBounds ()[i].second;
+	bl_[i] = argumentBounds ()[i].first;
+	bu_[i] = argumentBounds ()[i].second;
       }
 
     // - bounds for linear constraints (A)
-    idx = static_cast<Function::size_type> (problem ().argumentBounds ().size ());
+    Function::size_type idx =
+      static_cast<Function::size_type> (argumentBounds ().size ());
+    Function::size_type linearOffset = 0;
     for (unsigned constraintId = 0;
 	 constraintId < problem ().constraints ().size ();
 	 ++constraintId)
       {
-	if (!problem ().constraints ()[constraintId]->asType<NumericLinearFunction> ())
+	if (!problem ().constraints ()[constraintId]->asType<LinearFunction> ())
 	  continue;
-        NumericLinearFunction* const g =
-            problem ()
-                .constraints ()[constraintId]
-                ->castInto<NumericLinearFunction> ();
-        assert (!!g);
+	const Function::size_type m =
+	  problem ().constraints ()[constraintId]->outputSize ();
 
-	for (unsigned i = 0; i < g->outputSize (); ++i)
+	for (unsigned i = 0; i < m; ++i)
 	  {
-	    const NumericLinearFunction::vector_t& b = g->b ();
-	    // warning: we shift bounds here.
-	    bl_[idx + i] =
-	      problem ().boundsVector ()[constraintId][i].first + b[i];
-	    bu_[idx + i] =
-	      problem ().boundsVector ()[constraintId][i].second + b[i];
+	    // warning: we shift bounds here (A x + b in [l, u]
+	    // becomes A x in [l - b, u - b]).
+	    bl_[idx + i] = boundsVector ()[constraintId][i].first
+	      - linearShift_[linearOffset + i];
+	    bu_[idx + i] = boundsVector ()[constraintId][i].second
+	      - linearShift_[linearOffset + i];
 	  }
-	idx += g->outputSize ();
+	idx += m;
+	linearOffset += m;
       }
 
     // - nonlinear constraints
@@ -250,7 +728,7 @@ namespace roboptim
       {
         if (problem ()
                 .constraints ()[constraintId]
-                ->asType<NumericLinearFunction> () ||
+                ->asType<LinearFunction> () ||
             !problem ()
                  .constraints ()[constraintId]
                  ->asType<DifferentiableFunction> ())
@@ -262,15 +740,15 @@ namespace roboptim
 
 	for (unsigned i = 0; i < g->outputSize (); ++i)
 	  {
-	    bl_[idx + i] = problem ().boundsVector ()[constraintId][i].first;
-	    bu_[idx + i] = problem ().boundsVector ()[constraintId][i].second;
+	    bl_[idx + i] = boundsVector ()[constraintId][i].first;
+	    bu_[idx + i] = boundsVector ()[constraintId][i].second;
 	  }
 	idx += g->outputSize ();
       }
 
     // Fill starting point.
-    if (problem ().startingPoint ())
-      x_ = *problem ().startingPoint ();
+    if (startingPoint ())
+      x_ = *startingPoint ();
 
     // Initialization
     Nag_E04State state;
@@ -288,48 +766,66 @@ namespace roboptim
       }
 
     // Fill parameters.
+    std::vector<std::string> options;
     nag_opt_nlp_option_set_integer ("Print File", 1, &state, &fail);
+    options.push_back ("Print File = 1");
+
+    // Warm start: istate, clamda and h are kept from the last solve.
+    const bool warmStart = canWarmStart ();
+    if (warmStart)
+      {
+	nag_opt_nlp_option_set_string ("Warm Start", &state, &fail);
+	options.push_back ("Warm Start");
+      }
+    else
+      std::fill (istate_.begin (), istate_.end (), 0);
+    if (fail.code != NE_NOERROR)
+      {
+	this->result_ = SolverError (fail.message);
+	return;
+      }
 
     // Nag communication object.
     Nag_Comm comm;
     std::memset (&comm, 0, sizeof (Nag_Comm));
     comm.p = this;
 
-    ::Integer majits = 0.;
-    ::Integer* istate = new Integer[n_ + nclin_ + ncnln_];
+    ::Integer majits = 0;
 
-    std::size_t istateSize =
-      static_cast<std::size_t> ((n_ + nclin_ + ncnln_)) * sizeof (double);
-    std::memset (istate, 0, istateSize);
+    startSnapshot (options);
 
     // Solve.
     nag_opt_nlp_solve
       (n_, nclin_, ncnln_, tda_, tdcj_, tdh_, &a_ (0, 0), &bl_[0], &bu_[0],
        detail::confun,
        detail::objfun,
-       &majits, &istate[0], &ccon_[0], &cjac_ (0, 0), &clamda_[0], &objf_[0],
+       &majits, &istate_[0], &ccon_[0], &cjac_ (0, 0), &clamda_[0], &objf_[0],
        &grad_[0], &h_(0, 0), &x_[0],
        &state, &comm, &fail);
 
-    delete[] istate;
-    istate = 0;
+    snapshot_.reset ();
+    warmStartValid_ = (fail.code == NE_NOERROR);
+
+    Result res (problem ().function ().inputSize (),
+		problem ().function ().outputSize ());
+    res.x = x_;
+    res.value = objf_;
+    if (!problem ().constraints ().empty ())
+      {
+	res.constraints = ccon_;
+	res.lambda = clamda_;
+      }
 
     if (fail.code == NE_NOERROR)
       {
-	Result res (problem ().function ().inputSize (),
-		    problem ().function ().outputSize ());
-	res.x = x_;
-	res.value = objf_;
-	if (!problem ().constraints ().empty ())
-	  {
-	    res.constraints = ccon_;
-	    res.lambda = clamda_;
-	  }
 	result_ = res;
 	return;
       }
 
-    this->result_ = SolverError (fail.message);
+    // Keep the last iterate (e.g. when the solve was stopped).
+    SolverError error (fail.message);
+    error.lastState () = res;
+    this->result_ = error;
   }
 } // end of namespace roboptim.
 
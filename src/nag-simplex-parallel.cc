@@ -0,0 +1,397 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+// Must come before Eigen (see nag-allocation-audit.hh).
+#include <roboptim/core/plugin/nag/nag-allocation-audit.hh>
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+
+#include <boost/thread/thread.hpp>
+
+#include <roboptim/core/function.hh>
+
+#include <roboptim/core/plugin/nag/nag-simplex-parallel.hh>
+
+#define DEFINE_PARAMETER(KEY, DESCRIPTION, VALUE)     \
+  do                                                  \
+  {                                                   \
+    this->parameters_[KEY].description = DESCRIPTION; \
+    this->parameters_[KEY].value = VALUE;             \
+  } while (0)
+
+namespace roboptim
+{
+  namespace nag
+  {
+    namespace detail
+    {
+      struct CandidateTask
+      {
+        explicit CandidateTask (SimplexParallel* solver)
+          : solver_ (solver)
+        {}
+
+        void operator() (std::size_t i) const
+        {
+          solver_->evaluateCandidate (i);
+        }
+
+        SimplexParallel* solver_;
+      };
+    } // end of namespace detail
+
+    SimplexParallel::SimplexParallel (const problem_t& pb)
+      : parent_t (pb),
+        vertices_ (),
+        values_ (),
+        candidates_ (),
+        candidateValues_ (),
+        reflected_ (),
+        reflectedValues_ (),
+        batch_ (),
+        batchPoints_ (),
+        batchValues_ (),
+        counters_ (),
+        errors_ (),
+        evaluations_ (0),
+        threadPool_ (),
+        candidateTask_ (detail::CandidateTask (this)),
+        callback_ (),
+        solverState_ (pb)
+    {
+      // Shared parameters.
+      DEFINE_PARAMETER ("max-iterations", "number of iterations", 3000);
+      DEFINE_PARAMETER ("max-time", "time limit (s), 0 means none", 0.);
+
+      // Custom parameters
+      DEFINE_PARAMETER ("nag.tolx",
+                        "the error tolerable in the spatial values",
+                        Function::epsilon ());
+      DEFINE_PARAMETER ("nag.tolf",
+                        "the error tolerable in the function values",
+                        Function::epsilon ());
+      DEFINE_PARAMETER ("nag.initial-step",
+                        "edge length of the initial simplex", 1.);
+      DEFINE_PARAMETER ("nag.eval-threads",
+                        "number of threads evaluating the cost function, "
+                        "0 means one per core", 1);
+      DEFINE_PARAMETER ("nag.statistics", "collect evaluation statistics", 0);
+      DEFINE_PARAMETER ("nag.callback-every",
+                        "call the user callback every n iterations", 1);
+      DEFINE_PARAMETER ("nag.callback-period",
+                        "minimum time (s) between user callbacks", 0.);
+    }
+
+    SimplexParallel::~SimplexParallel ()
+    {
+    }
+
+    void SimplexParallel::solve ()
+    {
+      resetStatistics ();
+      resetCallbackThrottle ();
+      resetCallbackError ();
+      resetInterruption ();
+      {
+        NagScopedTimer timer (statistics_.enabled, statistics_.solve);
+        impl_solve ();
+      }
+      checkCallbackError ();
+      checkInterruption ();
+      if (statistics_.enabled) statistics_.publish (solverState_);
+    }
+
+    void SimplexParallel::evaluateCandidate (std::size_t i)
+    {
+      const matrix_t::Index i_ = static_cast<matrix_t::Index> (i);
+      try
+      {
+        NagScopedTimer timer (statistics_.enabled, counters_[i]);
+        candidateValues_.col (i_).setZero ();
+        problem ().function () (candidateValues_.col (i_),
+                                candidates_.col (i_));
+      }
+      catch (const std::exception& e)
+      {
+        errors_[i] = e.what ();
+      }
+      catch (...)
+      {
+        errors_[i] = "unknown exception";
+      }
+    }
+
+    bool SimplexParallel::evaluateCandidates (std::size_t count)
+    {
+      const matrix_t::Index count_ = static_cast<matrix_t::Index> (count);
+      NagScopedTimer evaluationTimer (statistics_.enabled,
+                                      statistics_.evaluation);
+      NagAllocationScope audit (statistics_.evaluation);
+
+      if (batch_)
+      {
+        // computeBatch expects exactly one column per point.
+        assert (batchPoints_.cols () == count_);
+        try
+        {
+          NagScopedTimer timer (statistics_.enabled, statistics_.cost);
+          batchPoints_ = candidates_.leftCols (count_);
+          batchValues_.setZero ();
+          batch_->computeBatch (batchValues_, batchPoints_);
+          candidateValues_.leftCols (count_) = batchValues_;
+        }
+        ROBOPTIM_NAG_CATCH_CALLBACK (this, return false)
+      }
+      else
+      {
+        std::fill (errors_.begin (), errors_.begin () + count, std::string ());
+        if (threadPool_)
+          threadPool_->run (count, candidateTask_);
+        else
+          for (std::size_t i = 0; i < count; ++i) evaluateCandidate (i);
+
+        for (std::size_t i = 0; i < count; ++i)
+        {
+          statistics_.cost.add (counters_[i]);
+          counters_[i] = NagStatistics::Counter ();
+        }
+
+        for (std::size_t i = 0; i < count; ++i)
+          if (!errors_[i].empty ())
+          {
+            setCallbackError (errors_[i]);
+            return false;
+          }
+      }
+
+      evaluations_ += static_cast<int> (count);
+      return true;
+    }
+
+    bool SimplexParallel::withinBudget (std::size_t count, int max_iter,
+                                        const Result* last)
+    {
+      if (evaluations_ + static_cast<int> (count) <= max_iter) return true;
+
+      SolverError error ("maximum number of cost evaluations reached");
+      if (last) error.lastState () = *last;
+      result_ = error;
+      return false;
+    }
+
+    void SimplexParallel::moveCandidates (double factor)
+    {
+      const matrix_t::Index n = vertices_.rows ();
+      for (matrix_t::Index i = 0; i < n; ++i)
+        candidates_.col (i) = vertices_.col (0)
+          + factor * (vertices_.col (i + 1) - vertices_.col (0));
+    }
+
+    void SimplexParallel::acceptCandidates ()
+    {
+      const matrix_t::Index n = vertices_.rows ();
+      vertices_.rightCols (n) = candidates_.leftCols (n);
+      values_.tail (n) = candidateValues_.row (0).head (n).transpose ();
+      sortVertices ();
+    }
+
+    void SimplexParallel::sortVertices ()
+    {
+      matrix_t::Index best;
+      values_.minCoeff (&best);
+      if (best == 0) return;
+      vertices_.col (0).swap (vertices_.col (best));
+      std::swap (values_[0], values_[best]);
+    }
+
+    bool SimplexParallel::converged (double tolx, double tolf) const
+    {
+      const matrix_t::Index n = vertices_.rows ();
+      if (n == 0) return true;
+
+      const double mean = values_.mean ();
+      const double deviation = std::sqrt
+        ((values_.array () - mean).square ().sum ()
+         / static_cast<double> (values_.size ()));
+      if (!(deviation <= tolf)) return false;
+
+      const double size = (vertices_.rightCols (n).colwise ()
+                           - vertices_.col (0)).cwiseAbs ().maxCoeff ();
+      return size <= tolx;
+    }
+
+    void SimplexParallel::iterationCallback ()
+    {
+      if (!callback_ || !throttleCallback ()) return;
+
+      try
+      {
+        NagScopedTimer timer (statistics_.enabled, statistics_.callback);
+        solverState_.x () = vertices_.col (0);
+        solverState_.cost () = values_[0];
+        callback_ (problem (), solverState_);
+      }
+      ROBOPTIM_NAG_CATCH_CALLBACK (this, return)
+    }
+
+    void SimplexParallel::impl_solve ()
+    {
+      const matrix_t::Index n = problem ().function ().inputSize ();
+      const matrix_t::Index m = problem ().function ().outputSize ();
+      const std::size_t n_ = static_cast<std::size_t> (n);
+
+      // Solver options.
+      double tolx = boost::get<double> (this->parameters_["nag.tolx"].value);
+      double tolf = boost::get<double> (this->parameters_["nag.tolf"].value);
+      double step =
+        boost::get<double> (this->parameters_["nag.initial-step"].value);
+      int max_iter =
+        boost::get<int> (this->parameters_["max-iterations"].value);
+
+      // Create the thread pool evaluating the candidates.
+      int threads = boost::get<int> (this->parameters_["nag.eval-threads"].value);
+      if (threads <= 0)
+        threads = static_cast<int> (boost::thread::hardware_concurrency ());
+      threads = std::max (1, std::min (threads, static_cast<int> (n_ + 1)));
+      if (threads == 1)
+        threadPool_.reset ();
+      else if (!threadPool_ ||
+               threadPool_->size () != static_cast<std::size_t> (threads))
+        threadPool_.reset (new NagThreadPool
+                           (static_cast<std::size_t> (threads)));
+
+      vertices_.resize (n, n + 1);
+      values_.resize (n + 1);
+      candidates_.resize (n, n + 1);
+      candidateValues_.resize (m, n + 1);
+      reflected_.resize (n, n + 1);
+      reflectedValues_.resize (m, n + 1);
+      batch_ =
+        dynamic_cast<const NagBatchEvaluation*> (&problem ().function ());
+      if (batch_)
+      {
+        batchPoints_.resize (n, n + 1);
+        batchValues_.resize (m, n + 1);
+      }
+      counters_.assign (n_ + 1, NagStatistics::Counter ());
+      errors_.assign (n_ + 1, std::string ());
+      evaluations_ = 0;
+
+      // Initial simplex: the starting point, moved along each axis.
+      argument_t x0 (n);
+      x0.setZero ();
+      if (startingPoint ()) x0 = *(startingPoint ());
+      candidates_ = x0.replicate (1, n + 1);
+      for (matrix_t::Index i = 0; i < n; ++i)
+        candidates_ (i, i + 1) += step;
+
+      if (!withinBudget (n_ + 1, max_iter, 0)) return;
+      if (!evaluateCandidates (n_ + 1)) return;
+      vertices_ = candidates_;
+      values_ = candidateValues_.row (0).transpose ();
+      sortVertices ();
+
+      // The next steps evaluate n points.
+      if (batch_)
+      {
+        batchPoints_.resize (n, n);
+        batchValues_.resize (m, n);
+      }
+
+      Result res (n, m);
+      for (;;)
+      {
+        res.x = vertices_.col (0);
+        res.value.setConstant (values_[0]);
+        result_ = res;
+
+        iterationCallback ();
+        if (hasCallbackError () || stopRequested ()) return;
+        if (converged (tolx, tolf)) return;
+
+        if (!withinBudget (n_, max_iter, &res)) return;
+
+        // Reflection through the best vertex.
+        moveCandidates (-1.);
+        if (!evaluateCandidates (n_)) return;
+        const double reflected =
+          candidateValues_.row (0).head (n).minCoeff ();
+
+        if (reflected < values_[0])
+        {
+          // Expansion, if the budget allows it and nothing stopped the
+          // solve in between.
+          if (evaluations_ + static_cast<int> (n_) <= max_iter
+              && !stopRequested ())
+          {
+            reflected_.swap (candidates_);
+            reflectedValues_.swap (candidateValues_);
+
+            moveCandidates (-2.);
+            if (!evaluateCandidates (n_)) return;
+            if (!(candidateValues_.row (0).head (n).minCoeff () < reflected))
+            {
+              reflected_.swap (candidates_);
+              reflectedValues_.swap (candidateValues_);
+            }
+          }
+        }
+        else
+        {
+          // Contraction towards the best vertex.
+          if (!withinBudget (n_, max_iter, &res)) return;
+          moveCandidates (.5);
+          if (!evaluateCandidates (n_)) return;
+        }
+
+        acceptCandidates ();
+      }
+    }
+  } // end of namespace nag.
+} // end of namespace roboptim.
+
+extern "C" {
+  typedef roboptim::nag::SimplexParallel SimplexParallel;
+  typedef roboptim::Solver<roboptim::EigenMatrixDense> solver_t;
+
+  ROBOPTIM_DLLEXPORT unsigned getSizeOfProblem ();
+  ROBOPTIM_DLLEXPORT const char* getTypeIdOfConstraintsList ();
+  ROBOPTIM_DLLEXPORT solver_t* create (const SimplexParallel::problem_t& pb);
+  ROBOPTIM_DLLEXPORT void destroy (solver_t* p);
+
+  ROBOPTIM_DLLEXPORT unsigned getSizeOfProblem ()
+  {
+    return sizeof (SimplexParallel::problem_t);
+  }
+
+  ROBOPTIM_DLLEXPORT const char* getTypeIdOfConstraintsList ()
+  {
+    return typeid (SimplexParallel::problem_t::constraintsList_t).name ();
+  }
+
+  ROBOPTIM_DLLEXPORT solver_t* create (const SimplexParallel::problem_t& pb)
+  {
+    return new roboptim::nag::SimplexParallel (pb);
+  }
+
+  ROBOPTIM_DLLEXPORT void destroy (solver_t* p)
+  {
+    delete p;
+  }
+}
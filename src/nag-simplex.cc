@@ -15,6 +15,9 @@
 // You should have received a copy of the GNU Lesser General Public License
 // along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
 
+// Must come before Eigen (see nag-allocation-audit.hh).
+#include <roboptim/core/plugin/nag/nag-allocation-audit.hh>
+
 #include <cassert>
 #include <cstring>
 
@@ -52,12 +55,33 @@ namespace roboptim
         Eigen::Map<Function::vector_t> fc_ (
           fc, solver->problem ().function ().outputSize ());
 
-        fc_.setZero ();
-        fc_ = solver->problem ().function () (x_);
-
-        if (!solver->callback ()) return;
-        solver->solverState ().x () = x_;
-        solver->callback () (solver->problem (), solver->solverState ());
+        // NAG cannot be interrupted: once a function evaluation failed
+        // or the solve was stopped, the remaining evaluations are skipped.
+        if (solver->hasCallbackError () || solver->stopRequested ())
+        {
+          fc_.setConstant (Function::infinity ());
+          return;
+        }
+
+        try
+        {
+          NagStatistics& stats = solver->statistics ();
+          NagScopedTimer evaluationTimer (stats.enabled, stats.evaluation);
+          NagAllocationScope audit (stats.evaluation);
+          {
+            NagScopedTimer timer (stats.enabled, stats.cost);
+            fc_.setZero ();
+            solver->problem ().function () (fc_, x_);
+          }
+          solver->recordEvaluation (x_, fc_[0]);
+
+          if (!solver->callback () || !solver->throttleCallback ()) return;
+          NagScopedTimer timer (stats.enabled, stats.callback);
+          solver->solverState ().x () = x_;
+          solver->callback () (solver->problem (), solver->solverState ());
+        }
+        ROBOPTIM_NAG_CATCH_CALLBACK (solver,
+                                     fc_.setConstant (Function::infinity ()))
       }
     } // end of namespace detail
 
@@ -73,6 +97,7 @@ namespace roboptim
 
       // Shared parameters.
       DEFINE_PARAMETER ("max-iterations", "number of iterations", 3000);
+      DEFINE_PARAMETER ("max-time", "time limit (s), 0 means none", 0.);
 
       // Custom parameters
       DEFINE_PARAMETER ("nag.tolx",
@@ -81,6 +106,11 @@ namespace roboptim
       DEFINE_PARAMETER ("nag.tolf",
                         "the error tolerable in the function values",
                         Function::epsilon ());
+      DEFINE_PARAMETER ("nag.statistics", "collect evaluation statistics", 0);
+      DEFINE_PARAMETER ("nag.callback-every",
+                        "call the user callback every n evaluations", 1);
+      DEFINE_PARAMETER ("nag.callback-period",
+                        "minimum time (s) between user callbacks", 0.);
     }
 
     Simplex::~Simplex ()
@@ -88,9 +118,24 @@ namespace roboptim
     }
 
     void Simplex::solve ()
+    {
+      resetStatistics ();
+      resetCallbackThrottle ();
+      resetCallbackError ();
+      resetInterruption ();
+      {
+        NagScopedTimer timer (statistics_.enabled, statistics_.solve);
+        impl_solve ();
+      }
+      checkCallbackError ();
+      checkInterruption ();
+      if (statistics_.enabled) statistics_.publish (solverState_);
+    }
+
+    void Simplex::impl_solve ()
     {
       // Solution.
-      if (problem ().startingPoint ()) x_ = *(problem ().startingPoint ());
+      if (startingPoint ()) x_ = *(startingPoint ());
 
       // Nag communication object.
       Nag_Comm comm;
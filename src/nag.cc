@@ -15,6 +15,9 @@
 // You should have received a copy of the GNU Lesser General Public License
 // along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
 
+// Must come before Eigen (see nag-allocation-audit.hh).
+#include <roboptim/core/plugin/nag/nag-allocation-audit.hh>
+
 #include <cassert>
 #include <cstring>
 #include <stdexcept>
@@ -25,6 +28,7 @@
 #include <nage04.h>
 
 #include <roboptim/core/plugin/nag/nag.hh>
+#include <roboptim/core/plugin/nag/nag-grid-search.hh>
 
 #define DEFINE_PARAMETER(KEY, DESCRIPTION, VALUE)	\
   do {							\
@@ -50,8 +54,33 @@ namespace roboptim
       Eigen::Map<Function::vector_t> fc_
 	(fc, solver->problem ().function ().outputSize ());
 
-      fc_.setZero ();
-      fc_ = solver->problem ().function () (x_);
+      // NAG cannot be interrupted: once a function evaluation failed
+      // or the solve was stopped, the remaining evaluations are skipped.
+      if (solver->hasCallbackError () || solver->stopRequested ())
+	{
+	  fc_.setConstant (Function::infinity ());
+	  return;
+	}
+
+      try
+	{
+	  NagStatistics& stats = solver->statistics ();
+	  NagScopedTimer evaluationTimer (stats.enabled, stats.evaluation);
+	  NagAllocationScope audit (stats.evaluation);
+	  {
+	    NagScopedTimer timer (stats.enabled, stats.cost);
+	    solver->problem ().function () (fc_, x_);
+	  }
+	  solver->recordEvaluation (x_, fc_[0]);
+
+	  if (!solver->callback () || !solver->throttleCallback ())
+	    return;
+	  NagScopedTimer timer (stats.enabled, stats.callback);
+	  solver->solverState ().x () = x_;
+	  solver->callback () (solver->problem (), solver->solverState ());
+	}
+      ROBOPTIM_NAG_CATCH_CALLBACK (solver,
+				   fc_.setConstant (Function::infinity ()))
     }
   } // end of namespace detail
 
@@ -62,7 +91,11 @@ namespace roboptim
       a_ (problem ().function ().inputSize ()),
       b_ (problem ().function ().inputSize ()),
       x_ (1),
-      f_ (problem ().function ().outputSize ())
+      f_ (problem ().function ().outputSize ()),
+      grid_ (),
+      gridValues_ (),
+      callback_ (),
+      solverState_ (pb)
   {
     if (pb.function ().inputSize () != 1)
       throw std::runtime_error
@@ -70,22 +103,30 @@ namespace roboptim
 
     // Argument lower (a) and upper (b) bounds.
     assert (static_cast<Function::size_type>
-	    (problem ().argumentBounds ().size ()) ==
+	    (argumentBounds ().size ()) ==
 	    problem ().function ().inputSize ());
 
-    for (unsigned i = 0; i < problem ().argumentBounds ().size (); ++i)
-      a_[i] = problem ().argumentBounds ()[i].first,
-	b_[i] = problem ().argumentBounds ()[i].second;
+    for (unsigned i = 0; i < argumentBounds ().size (); ++i)
+      a_[i] = argumentBounds ()[i].first,
+	b_[i] = argumentBounds ()[i].second;
 
     x_.setZero ();
     f_.setZero ();
 
     // Shared parameters.
     DEFINE_PARAMETER ("max-iterations", "number of iterations", 30);
+    DEFINE_PARAMETER ("max-time", "time limit (s), 0 means none", 0.);
 
     // Custom parameters
     DEFINE_PARAMETER ("nag.e1", "relative accuracy (0 means default)", 0.);
     DEFINE_PARAMETER ("nag.e2", "absolute accuracy (0 means default)", 0.);
+    DEFINE_PARAMETER ("nag.grid-points",
+		      "grid points bracketing the minimum (0 means none)", 0);
+    DEFINE_PARAMETER ("nag.statistics", "collect evaluation statistics", 0);
+    DEFINE_PARAMETER ("nag.callback-every",
+		      "call the user callback every n evaluations", 1);
+    DEFINE_PARAMETER ("nag.callback-period",
+		      "minimum time (s) between user callbacks", 0.);
   }
 
   NagSolver::~NagSolver ()
@@ -93,6 +134,22 @@ namespace roboptim
 
   void
   NagSolver::solve ()
+  {
+    resetStatistics ();
+    resetCallbackThrottle ();
+    resetCallbackError ();
+    resetInterruption ();
+    {
+      NagScopedTimer timer (statistics_.enabled, statistics_.solve);
+      impl_solve ();
+    }
+    checkCallbackError ();
+    checkInterruption ();
+    if (statistics_.enabled) statistics_.publish (solverState_);
+  }
+
+  void
+  NagSolver::impl_solve ()
   {
     // e1 and e2
     e1_ = boost::get<double> (this->parameters_["nag.e1"].value);
@@ -103,8 +160,23 @@ namespace roboptim
       boost::get<int> (this->parameters_["max-iterations"].value);
 
     // Solution.
-    if (problem ().startingPoint ())
-      x_ = *(problem ().startingPoint ());
+    if (startingPoint ())
+      x_ = *(startingPoint ());
+
+    // NAG returns the final interval in a and b.
+    a_[0] = argumentBounds ()[0].first;
+    b_[0] = argumentBounds ()[0].second;
+
+    // Bracket the minimum on a grid evaluated at once.
+    int gridPoints =
+      boost::get<int> (this->parameters_["nag.grid-points"].value);
+    try
+      {
+	NagScopedTimer timer (statistics_.enabled, statistics_.cost);
+	gridBracket (problem ().function (), gridPoints, a_[0], b_[0],
+		     grid_, gridValues_);
+      }
+    ROBOPTIM_NAG_CATCH_CALLBACK (this, result_ = NoSolution (); return)
 
     // Nag communication object.
     Nag_Comm comm;
@@ -0,0 +1,149 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+// Check that the NAG callbacks do not allocate. This is only built when
+// the plugins audit their allocations (NAG_ALLOCATION_AUDIT=COUNT).
+
+#define BOOST_TEST_MODULE allocations
+
+#include <string>
+
+#include <boost/mpl/list.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/variant/get.hpp>
+
+#include <roboptim/core/differentiable-function.hh>
+#include <roboptim/core/solver.hh>
+#include <roboptim/core/solver-factory.hh>
+
+#include "roboptim/core/plugin/nag/nag-common.hh"
+#include "plugin-path.hh"
+
+using namespace roboptim;
+
+namespace
+{
+  /// \brief f(x) = sum_i (x_i - i)^2.
+  template <typename T>
+  struct Square : public GenericDifferentiableFunction<T>
+  {
+    ROBOPTIM_DIFFERENTIABLE_FUNCTION_FWD_TYPEDEFS_
+    (GenericDifferentiableFunction<T>);
+
+    explicit Square (size_type n)
+      : GenericDifferentiableFunction<T> (n, 1, "square")
+    {
+    }
+
+    void impl_compute (result_ref result, const_argument_ref x) const
+    {
+      result[0] = 0.;
+      for (size_type i = 0; i < this->inputSize (); ++i)
+        result[0] += (x[i] - i) * (x[i] - i);
+    }
+
+    void impl_gradient (gradient_ref grad, const_argument_ref x,
+                        size_type) const
+    {
+      for (size_type i = 0; i < this->inputSize (); ++i)
+        grad.coeffRef (i) = 2. * (x[i] - i);
+    }
+  };
+
+  /// \brief g(x) = x_0 x_1.
+  template <typename T>
+  struct Product : public GenericDifferentiableFunction<T>
+  {
+    ROBOPTIM_DIFFERENTIABLE_FUNCTION_FWD_TYPEDEFS_
+    (GenericDifferentiableFunction<T>);
+
+    explicit Product (size_type n)
+      : GenericDifferentiableFunction<T> (n, 1, "product")
+    {
+    }
+
+    void impl_compute (result_ref result, const_argument_ref x) const
+    {
+      result[0] = x[0] * x[1];
+    }
+
+    void impl_gradient (gradient_ref grad, const_argument_ref x,
+                        size_type) const
+    {
+      grad.coeffRef (0) = x[1];
+      grad.coeffRef (1) = x[0];
+    }
+  };
+
+  template <typename T>
+  const char* pluginName ();
+
+  template <>
+  const char* pluginName<EigenMatrixDense> ()
+  {
+    return "nag-nlp";
+  }
+
+  template <>
+  const char* pluginName<EigenMatrixSparse> ()
+  {
+    return "nag-nlp-sparse";
+  }
+
+  int stateValue (const Parameter::parameterValues_t& value)
+  {
+    return boost::get<int> (value);
+  }
+
+  const int size = 10;
+} // end of unnamed namespace
+
+typedef boost::mpl::list<EigenMatrixDense, EigenMatrixSparse> matrixTypes_t;
+
+BOOST_AUTO_TEST_CASE_TEMPLATE (callbacks_do_not_allocate, T, matrixTypes_t)
+{
+  typedef Solver<T> solver_t;
+  typedef typename solver_t::problem_t problem_t;
+  typedef typename solver_t::solverState_t solverState_t;
+  typedef GenericDifferentiableFunction<T> function_t;
+
+  Square<T> f (size);
+  problem_t pb (f);
+  pb.startingPoint () = problem_t::vector_t::Zero (size);
+
+  boost::shared_ptr<function_t> g (new Product<T> (size));
+  pb.addConstraint (g, typename problem_t::intervals_t
+                    (1, Function::makeInterval (1., Function::infinity ())));
+
+  SolverFactory<solver_t> factory (pluginName<T> (), pb);
+  solver_t& solver = factory ();
+  solver.parameters ()["nag.statistics"].value = 1;
+
+  solver.solve ();
+
+  // Publish the statistics of the solve.
+  NagSolverCommon<T>* nag = dynamic_cast<NagSolverCommon<T>*> (&solver);
+  BOOST_REQUIRE (nag);
+  solverState_t state (pb);
+  nag->statistics ().publish (state);
+
+  BOOST_CHECK (stateValue (state.parameters ()
+                           ["nag.statistics.evaluation.count"].value) > 0);
+  BOOST_CHECK_EQUAL (stateValue (state.parameters ()
+                                 ["nag.statistics.evaluation.allocations"]
+                                 .value), 0);
+}
@@ -0,0 +1,364 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+// Check the plugin chosen by nag-auto for each kind of problem, and the
+// solution found through it.
+
+#define BOOST_TEST_MODULE auto
+
+#include <string>
+
+#include <boost/make_shared.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/variant/get.hpp>
+
+#include <roboptim/core/differentiable-function.hh>
+#include <roboptim/core/function.hh>
+#include <roboptim/core/numeric-linear-function.hh>
+#include <roboptim/core/solver.hh>
+#include <roboptim/core/solver-factory.hh>
+
+#include "roboptim/core/plugin/nag/nag-hooks.hh"
+#include "plugin-path.hh"
+
+using namespace roboptim;
+
+typedef Solver<EigenMatrixDense> solver_t;
+typedef solver_t::problem_t problem_t;
+
+namespace
+{
+  /// \brief f(x) = sum_i (x_i - i - 1)^2, without gradient.
+  struct Cost : public Function
+  {
+    explicit Cost (size_type n)
+      : Function (n, 1, "cost")
+    {
+    }
+
+    void impl_compute (result_ref result, const_argument_ref x) const
+    {
+      result[0] = 0.;
+      for (size_type i = 0; i < inputSize (); ++i)
+        result[0] += (x[i] - i - 1.) * (x[i] - i - 1.);
+    }
+  };
+
+  /// \brief Same cost, with a batch evaluation.
+  struct BatchCost : public Cost, public NagBatchEvaluation
+  {
+    explicit BatchCost (size_type n)
+      : Cost (n)
+    {
+    }
+
+    void computeBatch (NagBatchEvaluation::matrix_t& values,
+                       const NagBatchEvaluation::matrix_t& points) const
+    {
+      for (size_type j = 0; j < points.cols (); ++j)
+      {
+        values (0, j) = 0.;
+        for (size_type i = 0; i < inputSize (); ++i)
+        {
+          const double d = points (i, j) - i - 1.;
+          values (0, j) += d * d;
+        }
+      }
+    }
+  };
+
+  /// \brief Same cost, with its gradient.
+  struct DifferentiableCost : public DifferentiableFunction
+  {
+    explicit DifferentiableCost (size_type n)
+      : DifferentiableFunction (n, 1, "differentiable cost")
+    {
+    }
+
+    void impl_compute (result_ref result, const_argument_ref x) const
+    {
+      result[0] = 0.;
+      for (size_type i = 0; i < inputSize (); ++i)
+        result[0] += (x[i] - i - 1.) * (x[i] - i - 1.);
+    }
+
+    void impl_gradient (gradient_ref grad, const_argument_ref x,
+                        size_type) const
+    {
+      for (size_type i = 0; i < inputSize (); ++i)
+        grad[i] = 2. * (x[i] - i - 1.);
+    }
+  };
+
+  /// \brief g(x) = x_0 + x_1.
+  struct Sum : public DifferentiableFunction
+  {
+    explicit Sum (size_type n)
+      : DifferentiableFunction (n, 1, "sum")
+    {
+    }
+
+    void impl_compute (result_ref result, const_argument_ref x) const
+    {
+      result[0] = x[0] + x[1];
+    }
+
+    void impl_gradient (gradient_ref grad, const_argument_ref,
+                        size_type) const
+    {
+      grad.setZero ();
+      grad[0] = 1.;
+      grad[1] = 1.;
+    }
+  };
+
+  /// \brief g(x) = x_2^2, with a declared Jacobian pattern.
+  struct Square : public DifferentiableFunction,
+                  public NagJacobianPattern<EigenMatrixDense>
+  {
+    explicit Square (size_type n)
+      : DifferentiableFunction (n, 1, "square")
+    {
+    }
+
+    DifferentiableFunction::jacobian_t jacobianPattern () const
+    {
+      DifferentiableFunction::jacobian_t pattern =
+        DifferentiableFunction::jacobian_t::Zero (1, inputSize ());
+      pattern (0, 2) = 1.;
+      return pattern;
+    }
+
+    void impl_compute (result_ref result, const_argument_ref x) const
+    {
+      result[0] = x[2] * x[2];
+    }
+
+    void impl_gradient (gradient_ref grad, const_argument_ref x,
+                        size_type) const
+    {
+      grad.setZero ();
+      grad[2] = 2. * x[2];
+    }
+  };
+
+  /// \brief g(x) = sum_i x_i^2, a dense nonlinear constraint.
+  struct Norm : public DifferentiableFunction
+  {
+    explicit Norm (size_type n)
+      : DifferentiableFunction (n, 1, "norm")
+    {
+    }
+
+    void impl_compute (result_ref result, const_argument_ref x) const
+    {
+      result[0] = x.squaredNorm ();
+    }
+
+    void impl_gradient (gradient_ref grad, const_argument_ref x,
+                        size_type) const
+    {
+      grad = 2. * x;
+    }
+  };
+
+  /// \brief Add the linear constraints x_i <= 0 for i < rows.
+  void addBounds (problem_t& pb, Function::size_type rows)
+  {
+    const Function::size_type n = pb.function ().inputSize ();
+    NumericLinearFunction::matrix_t a =
+      NumericLinearFunction::matrix_t::Zero (rows, n);
+    for (Function::size_type i = 0; i < rows; ++i)
+      a (i, i) = 1.;
+    pb.addConstraint (boost::make_shared<NumericLinearFunction>
+                      (a, NumericLinearFunction::vector_t::Zero (rows)),
+                      problem_t::intervals_t
+                      (static_cast<std::size_t> (rows),
+                       Function::makeInterval (-Function::infinity (), 0.)));
+  }
+
+  /// \brief Plugin chosen by nag-auto.
+  std::string backend (solver_t& solver)
+  {
+    return boost::get<std::string>
+      (solver.parameters ()["nag.auto.backend"].value);
+  }
+
+  /// \brief Solve with nag-auto, and check the chosen plugin.
+  Result solve (const problem_t& pb, const std::string& backend)
+  {
+    SolverFactory<solver_t> factory ("nag-auto", pb);
+    solver_t& solver = factory ();
+    BOOST_CHECK_EQUAL
+      (boost::get<std::string> (solver.parameters ()["nag.auto.backend"]
+                                .value), backend);
+
+    const solver_t::result_t& res = solver.minimum ();
+    BOOST_REQUIRE_EQUAL (res.which (), solver_t::SOLVER_VALUE);
+    return boost::get<Result> (res);
+  }
+
+  /// \brief Add the constraints x_0 + x_1 <= 0 and x_2^2 <= 1.
+  void addConstraints (problem_t& pb)
+  {
+    const Function::size_type n = pb.function ().inputSize ();
+    const double inf = Function::infinity ();
+    pb.addConstraint (boost::make_shared<Sum> (n),
+                      problem_t::intervals_t
+                      (1, Function::makeInterval (-inf, 0.)));
+    pb.addConstraint (boost::make_shared<Square> (n),
+                      problem_t::intervals_t
+                      (1, Function::makeInterval (-inf, 1.)));
+  }
+
+  /// \brief Check the solution of a problem with constraints.
+  void checkConstrained (const Result& res)
+  {
+    // x_0 + x_1 = 0, x_2 = 1, unconstrained elsewhere.
+    BOOST_CHECK_SMALL (res.x[0] + .5, 1e-5);
+    BOOST_CHECK_SMALL (res.x[1] - .5, 1e-5);
+    BOOST_CHECK_SMALL (res.x[2] - 1., 1e-5);
+    for (Function::size_type i = 3; i < res.x.size (); ++i)
+      BOOST_CHECK_SMALL (res.x[i] - i - 1., 1e-5);
+  }
+} // end of unnamed namespace
+
+BOOST_AUTO_TEST_SUITE (auto_backend)
+
+BOOST_AUTO_TEST_CASE (bounded_variable)
+{
+  Cost f (1);
+  problem_t pb (f);
+  pb.argumentBounds ()[0] = Function::makeInterval (-2., 3.);
+
+  const Result res = solve (pb, "nag");
+  BOOST_CHECK_SMALL (res.x[0] - 1., 1e-4);
+}
+
+BOOST_AUTO_TEST_CASE (bounded_differentiable_variable)
+{
+  DifferentiableCost f (1);
+  problem_t pb (f);
+  pb.argumentBounds ()[0] = Function::makeInterval (-2., 3.);
+
+  const Result res = solve (pb, "nag-differentiable");
+  BOOST_CHECK_SMALL (res.x[0] - 1., 1e-4);
+}
+
+BOOST_AUTO_TEST_CASE (unbounded)
+{
+  Cost f (3);
+  problem_t pb (f);
+  pb.startingPoint () = problem_t::vector_t::Zero (3);
+
+  const Result res = solve (pb, "nag-simplex");
+  for (int i = 0; i < 3; ++i)
+    BOOST_CHECK_SMALL (res.x[i] - i - 1., 1e-4);
+}
+
+BOOST_AUTO_TEST_CASE (unbounded_batch)
+{
+  BatchCost f (3);
+  problem_t pb (f);
+  pb.startingPoint () = problem_t::vector_t::Zero (3);
+
+  const Result res = solve (pb, "nag-simplex-parallel");
+  for (int i = 0; i < 3; ++i)
+    BOOST_CHECK_SMALL (res.x[i] - i - 1., 1e-4);
+}
+
+BOOST_AUTO_TEST_CASE (small_constrained)
+{
+  DifferentiableCost f (5);
+  problem_t pb (f);
+  pb.startingPoint () = problem_t::vector_t::Zero (5);
+  addConstraints (pb);
+
+  checkConstrained (solve (pb, "nag-nlp"));
+}
+
+BOOST_AUTO_TEST_CASE (sparse_constrained)
+{
+  // Converted to a sparse problem: Sum is a dense block, Square keeps
+  // its declared pattern.
+  DifferentiableCost f (200);
+  problem_t pb (f);
+  pb.startingPoint () = problem_t::vector_t::Zero (200);
+  addConstraints (pb);
+
+  checkConstrained (solve (pb, "nag-nlp-sparse"));
+}
+
+BOOST_AUTO_TEST_CASE (linear_split)
+{
+  DifferentiableCost f (150);
+  problem_t pb (f);
+  pb.startingPoint () = problem_t::vector_t::Zero (150);
+
+  // Only sparse linear rows: the problem is sparse.
+  addBounds (pb, 10);
+  {
+    SolverFactory<solver_t> factory ("nag-auto", pb);
+    solver_t& solver = factory ();
+    BOOST_CHECK_EQUAL (backend (solver), "nag-nlp-sparse");
+    BOOST_CHECK_CLOSE
+      (boost::get<double> (solver.parameters ()["nag.auto.linear-density"]
+                           .value), 1. / 150., 1e-8);
+  }
+
+  // A dense nonlinear row is not diluted by the sparse linear ones,
+  // even though the whole Jacobian is below the density threshold.
+  pb.addConstraint (boost::make_shared<Norm> (150),
+                    problem_t::intervals_t
+                    (1, Function::makeInterval (-Function::infinity (),
+                                                1e6)));
+  {
+    SolverFactory<solver_t> factory ("nag-auto", pb);
+    solver_t& solver = factory ();
+    BOOST_CHECK_EQUAL (backend (solver), "nag-nlp");
+    BOOST_CHECK
+      (boost::get<double> (solver.parameters ()["nag.auto.density"].value)
+       <= .1);
+    BOOST_CHECK_EQUAL
+      (boost::get<double> (solver.parameters ()
+                           ["nag.auto.nonlinear-density"].value), 1.);
+  }
+}
+
+BOOST_AUTO_TEST_CASE (forwarded_options)
+{
+  DifferentiableCost f (200);
+  problem_t pb (f);
+  pb.startingPoint () = problem_t::vector_t::Zero (200);
+  addConstraints (pb);
+
+  SolverFactory<solver_t> factory ("nag-auto", pb);
+  solver_t& solver = factory ();
+
+  // A NAG option unknown to the plugin is given to NAG.
+  solver.parameters ()["nag.Iterations Limit"].value = 1;
+  solver.solve ();
+  BOOST_CHECK_NE (solver.minimum ().which (), solver_t::SOLVER_VALUE);
+
+  // Erasing it restores the default.
+  solver.parameters ().erase ("nag.Iterations Limit");
+  solver.solve ();
+  BOOST_REQUIRE_EQUAL (solver.minimum ().which (), solver_t::SOLVER_VALUE);
+  checkConstrained (boost::get<Result> (solver.minimum ()));
+}
+
+BOOST_AUTO_TEST_SUITE_END ()
@@ -0,0 +1,128 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+// Stress test: solve problems with several instances of the sparse
+// solver running concurrently, and check their solutions. One of the
+// instances uses a cost function throwing an exception, which must
+// only affect that instance.
+
+#define BOOST_TEST_MODULE concurrent
+
+#include <stdexcept>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/variant/get.hpp>
+
+#include <roboptim/core/differentiable-function.hh>
+#include <roboptim/core/solver.hh>
+#include <roboptim/core/solver-factory.hh>
+
+#include "plugin-path.hh"
+
+using namespace roboptim;
+
+typedef Solver<EigenMatrixSparse> solver_t;
+typedef solver_t::problem_t problem_t;
+
+namespace
+{
+  /// \brief f(x) = sum_i (x_i - c_i)^2 with c_i = offset + i.
+  struct Shifted : public GenericDifferentiableFunction<EigenMatrixSparse>
+  {
+    Shifted (size_type n, double offset, bool fail)
+      : GenericDifferentiableFunction<EigenMatrixSparse> (n, 1, "shifted"),
+        offset_ (offset),
+        fail_ (fail)
+    {
+    }
+
+    void impl_compute (result_ref result, const_argument_ref x) const
+    {
+      if (fail_) throw std::runtime_error ("evaluation failure");
+
+      result[0] = 0.;
+      for (size_type i = 0; i < inputSize (); ++i)
+        result[0] += (x[i] - offset_ - i) * (x[i] - offset_ - i);
+    }
+
+    void impl_gradient (gradient_ref grad, const_argument_ref x,
+                        size_type) const
+    {
+      for (size_type i = 0; i < inputSize (); ++i)
+        grad.coeffRef (i) = 2. * (x[i] - offset_ - i);
+    }
+
+    double offset_;
+    bool fail_;
+  };
+
+  void solve (solver_t* solver)
+  {
+    solver->solve ();
+  }
+
+  const int size = 20;
+  const int instances = 16;
+} // end of unnamed namespace
+
+BOOST_AUTO_TEST_CASE (concurrent)
+{
+  std::vector<boost::shared_ptr<Shifted> > functions;
+  std::vector<boost::shared_ptr<problem_t> > problems;
+  std::vector<boost::shared_ptr<SolverFactory<solver_t> > > factories;
+
+  // Plugins are loaded serially.
+  for (int k = 0; k < instances; ++k)
+  {
+    functions.push_back (boost::shared_ptr<Shifted>
+                         (new Shifted (size, k, k == instances / 2)));
+    problems.push_back (boost::shared_ptr<problem_t>
+                        (new problem_t (*functions.back ())));
+    problems.back ()->startingPoint () = problem_t::vector_t::Zero (size);
+    factories.push_back (boost::shared_ptr<SolverFactory<solver_t> >
+                         (new SolverFactory<solver_t>
+                          ("nag-nlp-sparse", *problems.back ())));
+  }
+
+  boost::thread_group threads;
+  for (int k = 0; k < instances; ++k)
+    threads.create_thread (boost::bind (&solve, &(*factories[k]) ()));
+  threads.join_all ();
+
+  for (int k = 0; k < instances; ++k)
+  {
+    const solver_t::result_t& res = (*factories[k]) ().minimum ();
+
+    // The failing instance reports the exception as a solver error.
+    if (k == instances / 2)
+    {
+      BOOST_REQUIRE_EQUAL (res.which (), solver_t::SOLVER_ERROR);
+      BOOST_CHECK (std::string (boost::get<SolverError> (res).what ())
+                   .find ("evaluation failure") != std::string::npos);
+      continue;
+    }
+
+    BOOST_REQUIRE_EQUAL (res.which (), solver_t::SOLVER_VALUE);
+    const Result& result = boost::get<Result> (res);
+    for (int i = 0; i < size; ++i)
+      BOOST_CHECK_SMALL (result.x[i] - k - i, 1e-6);
+  }
+}
@@ -0,0 +1,169 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+// Compare the Jacobian approximated by colored finite differences with
+// the analytic one, with a variable at its upper bound and one in an
+// interval narrower than the step.
+
+#define BOOST_TEST_MODULE finite_differences
+
+#include <cmath>
+#include <limits>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+#include <roboptim/core/differentiable-function.hh>
+
+#include "roboptim/core/plugin/nag/nag-finite-differences.hh"
+
+using namespace roboptim;
+
+typedef NagColoredDifferences::jacobian_t jacobian_t;
+typedef NagColoredDifferences::vector_t vector_t;
+
+namespace
+{
+  /// \brief f(x) = (x_0^2 + x_1, sin (x_1) x_2, x_0 + x_3^2).
+  ///
+  /// The last row is not defined for x_3 > 1, the second one for x_2
+  /// outside [lower2, upper2].
+  struct Sparse : public GenericDifferentiableFunction<EigenMatrixSparse>
+  {
+    Sparse ()
+      : GenericDifferentiableFunction<EigenMatrixSparse> (4, 3, "sparse")
+    {
+    }
+
+    void impl_compute (result_ref result, const_argument_ref x) const
+    {
+      result[0] = x[0] * x[0] + x[1];
+      result[1] = (x[2] < lower2 || x[2] > upper2)
+        ? std::numeric_limits<double>::quiet_NaN ()
+        : std::sin (x[1]) * x[2];
+      result[2] = x[0] + ((x[3] > 1.)
+                          ? std::numeric_limits<double>::quiet_NaN ()
+                          : x[3] * x[3]);
+    }
+
+    void impl_gradient (gradient_ref, const_argument_ref, size_type) const
+    {
+    }
+
+    /// \brief Analytic Jacobian.
+    jacobian_t analyticJacobian (const vector_t& x) const
+    {
+      typedef Eigen::Triplet<double> triplet_t;
+      std::vector<triplet_t> t;
+      t.push_back (triplet_t (0, 0, 2. * x[0]));
+      t.push_back (triplet_t (0, 1, 1.));
+      t.push_back (triplet_t (1, 1, std::cos (x[1]) * x[2]));
+      t.push_back (triplet_t (1, 2, std::sin (x[1])));
+      t.push_back (triplet_t (2, 0, 1.));
+      t.push_back (triplet_t (2, 3, 2. * x[3]));
+
+      jacobian_t jac (3, 4);
+      jac.setFromTriplets (t.begin (), t.end ());
+      jac.makeCompressed ();
+      return jac;
+    }
+
+    static const double lower2;
+    static const double upper2;
+  };
+
+  // x_2 = 2 lies in an interval narrower than the step, closer to its
+  // upper bound.
+  const double Sparse::lower2 = 2. - 1e-8;
+  const double Sparse::upper2 = 2. + 1e-9;
+
+  /// \brief Check the colored differences against the analytic Jacobian.
+  void check (const vector_t& x, const vector_t& lower,
+              const vector_t& upper, double tolerance)
+  {
+    Sparse f;
+    const jacobian_t expected = f.analyticJacobian (x);
+
+    NagColoredDifferences differences;
+    differences.setPattern (expected, 1e-7);
+    BOOST_CHECK_EQUAL (differences.colors (), 2u);
+
+    differences.perturb (x, lower, upper);
+    for (std::size_t c = 0; c < differences.colors (); ++c)
+      differences.evaluate (f, c, false);
+
+    vector_t f0 (3);
+    f (f0, x);
+    std::vector<double> values
+      (static_cast<std::size_t> (expected.nonZeros ()));
+    differences.scatter (f0, &values[0]);
+
+    std::size_t k = 0;
+    for (jacobian_t::Index j = 0; j < expected.outerSize (); ++j)
+      for (jacobian_t::InnerIterator it (expected, j); it; ++it, ++k)
+      {
+        BOOST_CHECK_MESSAGE (std::abs (values[k] - it.value ()) < tolerance,
+                             "J(" << it.row () << ", " << it.col ()
+                             << ") = " << values[k] << " instead of "
+                             << it.value ());
+      }
+  }
+} // end of unnamed namespace
+
+BOOST_AUTO_TEST_CASE (colored_differences)
+{
+  vector_t x (4);
+  x << .5, -1., 2., 1.;
+
+  // x_3 is at its upper bound, the others are free.
+  const double inf = std::numeric_limits<double>::infinity ();
+  vector_t lower = vector_t::Constant (4, -inf);
+  vector_t upper = vector_t::Constant (4, inf);
+  lower[2] = Sparse::lower2;
+  upper[2] = Sparse::upper2;
+  upper[3] = 1.;
+
+  // The step of x_2 is shrunk to its lower side, 1e-8.
+  check (x, lower, upper, 1e-5);
+}
+
+BOOST_AUTO_TEST_CASE (fixed_variable)
+{
+  vector_t x (4);
+  x << .5, -1., 2., 1.;
+
+  // x_2 cannot move: its derivatives are left to zero.
+  vector_t lower = vector_t::Constant (4, -10.);
+  vector_t upper = vector_t::Constant (4, 10.);
+  lower[2] = upper[2] = 2.;
+  upper[3] = 1.;
+
+  Sparse f;
+  const jacobian_t pattern = f.analyticJacobian (x);
+  NagColoredDifferences differences;
+  differences.setPattern (pattern, 1e-7);
+  differences.perturb (x, lower, upper);
+  for (std::size_t c = 0; c < differences.colors (); ++c)
+    differences.evaluate (f, c, false);
+
+  vector_t f0 (3);
+  f (f0, x);
+  std::vector<double> values (static_cast<std::size_t> (pattern.nonZeros ()));
+  differences.scatter (f0, &values[0]);
+  for (std::size_t k = 0; k < values.size (); ++k)
+    BOOST_CHECK (values[k] == values[k]);
+}
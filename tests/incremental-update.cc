@@ -0,0 +1,156 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+// Change the bounds and the starting point of a problem between two
+// solves of the same solver instance.
+
+#define BOOST_TEST_MODULE incremental_update
+
+#include <boost/make_shared.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/variant/get.hpp>
+
+#include <roboptim/core/differentiable-function.hh>
+#include <roboptim/core/solver.hh>
+#include <roboptim/core/solver-factory.hh>
+
+#include "roboptim/core/plugin/nag/nag-common.hh"
+#include "plugin-path.hh"
+
+using namespace roboptim;
+
+typedef Solver<EigenMatrixSparse> solver_t;
+typedef solver_t::problem_t problem_t;
+typedef NagSolverCommon<EigenMatrixSparse> nagSolver_t;
+
+namespace
+{
+  /// \brief f(x) = sum_i (x_i - i)^2.
+  struct Cost : public GenericDifferentiableFunction<EigenMatrixSparse>
+  {
+    explicit Cost (size_type n)
+      : GenericDifferentiableFunction<EigenMatrixSparse> (n, 1, "cost")
+    {
+    }
+
+    void impl_compute (result_ref result, const_argument_ref x) const
+    {
+      result[0] = 0.;
+      for (size_type i = 0; i < inputSize (); ++i)
+        result[0] += (x[i] - i) * (x[i] - i);
+    }
+
+    void impl_gradient (gradient_ref grad, const_argument_ref x,
+                        size_type) const
+    {
+      for (size_type i = 0; i < inputSize (); ++i)
+        grad.coeffRef (i) = 2. * (x[i] - i);
+    }
+  };
+
+  /// \brief g(x) = x_0 + x_1.
+  struct Sum : public GenericDifferentiableFunction<EigenMatrixSparse>
+  {
+    explicit Sum (size_type n)
+      : GenericDifferentiableFunction<EigenMatrixSparse> (n, 1, "sum")
+    {
+    }
+
+    void impl_compute (result_ref result, const_argument_ref x) const
+    {
+      result[0] = x[0] + x[1];
+    }
+
+    void impl_gradient (gradient_ref grad, const_argument_ref,
+                        size_type) const
+    {
+      grad.coeffRef (0) = 1.;
+      grad.coeffRef (1) = 1.;
+    }
+  };
+
+  const Result& solution (solver_t& solver)
+  {
+    solver.solve ();
+    const solver_t::result_t& res = solver.minimum ();
+    BOOST_REQUIRE_EQUAL (res.which (), solver_t::SOLVER_VALUE);
+    return boost::get<Result> (res);
+  }
+
+  const int size = 4;
+} // end of unnamed namespace
+
+BOOST_AUTO_TEST_CASE (incremental_update)
+{
+  Cost cost (size);
+  problem_t pb (cost);
+  pb.startingPoint () = problem_t::vector_t::Zero (size);
+  pb.addConstraint (boost::make_shared<Sum> (size),
+                    problem_t::intervals_t
+                    (1, Function::makeInterval (-10., 10.)));
+
+  SolverFactory<solver_t> factory ("nag-nlp-sparse", pb);
+  nagSolver_t* solver = dynamic_cast<nagSolver_t*> (&factory ());
+  BOOST_REQUIRE (solver);
+
+  // Unconstrained minimum: x_i = i.
+  const Result& res0 = solution (*solver);
+  for (int i = 0; i < size; ++i)
+    BOOST_CHECK_SMALL (res0.x[i] - i, 1e-6);
+
+  // Argument bound active at the solution.
+  solver->updateArgumentBounds (2, Function::makeInterval (-1., 1.));
+  solver->updateStartingPoint (problem_t::vector_t::Ones (size));
+  const Result& res1 = solution (*solver);
+  BOOST_CHECK_SMALL (res1.x[2] - 1., 1e-6);
+  BOOST_CHECK_SMALL (res1.x[3] - 3., 1e-6);
+
+  // Constraint bound active at the solution: x_0 + x_1 = 0.
+  solver->updateConstraintBounds (0, 0, Function::makeInterval (-10., 0.));
+  const Result& res2 = solution (*solver);
+  BOOST_CHECK_SMALL (res2.x[0] + .5, 1e-6);
+  BOOST_CHECK_SMALL (res2.x[1] - .5, 1e-6);
+  BOOST_CHECK_SMALL (res2.x[2] - 1., 1e-6);
+
+  // Back to the original problem.
+  solver->resetUpdates ();
+  const Result& res3 = solution (*solver);
+  for (int i = 0; i < size; ++i)
+    BOOST_CHECK_SMALL (res3.x[i] - i, 1e-6);
+
+  // An erased NAG option is reset to its default value.
+  solver->parameters ()["nag.Iterations Limit"].value = 1;
+  solver->updateStartingPoint (problem_t::vector_t::Ones (size));
+  solver->solve ();
+  BOOST_CHECK_NE (solver->minimum ().which (), solver_t::SOLVER_VALUE);
+
+  solver->parameters ().erase ("nag.Iterations Limit");
+  const Result& res4 = solution (*solver);
+  for (int i = 0; i < size; ++i)
+    BOOST_CHECK_SMALL (res4.x[i] - i, 1e-6);
+
+  // Invalid updates.
+  BOOST_CHECK_THROW (solver->updateArgumentBounds
+                     (size, Function::makeInterval (0., 1.)),
+                     std::runtime_error);
+  BOOST_CHECK_THROW (solver->updateConstraintBounds
+                     (0, 0, Function::makeInterval (1., 0.)),
+                     std::runtime_error);
+  BOOST_CHECK_THROW (solver->updateStartingPoint
+                     (problem_t::vector_t::Zero (size + 1)),
+                     std::runtime_error);
+}
@@ -0,0 +1,167 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+// Check that solves stopped by the time limit or by a cancellation
+// return the last iterate (or the best evaluated point for the solvers
+// NAG cannot interrupt) with a warning.
+
+#define BOOST_TEST_MODULE interruption
+
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/variant/get.hpp>
+
+#include <roboptim/core/differentiable-function.hh>
+#include <roboptim/core/solver.hh>
+#include <roboptim/core/solver-factory.hh>
+
+#include "roboptim/core/plugin/nag/nag-common.hh"
+#include "plugin-path.hh"
+
+using namespace roboptim;
+
+typedef Solver<EigenMatrixSparse> solver_t;
+typedef solver_t::problem_t problem_t;
+
+namespace
+{
+  /// \brief Slow f(x) = sum_i (x_i - i)^2.
+  struct Slow : public GenericDifferentiableFunction<EigenMatrixSparse>
+  {
+    explicit Slow (size_type n)
+      : GenericDifferentiableFunction<EigenMatrixSparse> (n, 1, "slow")
+    {
+    }
+
+    void impl_compute (result_ref result, const_argument_ref x) const
+    {
+      boost::this_thread::sleep (boost::posix_time::milliseconds (20));
+
+      result[0] = 0.;
+      for (size_type i = 0; i < inputSize (); ++i)
+        result[0] += (x[i] - i) * (x[i] - i);
+    }
+
+    void impl_gradient (gradient_ref grad, const_argument_ref x,
+                        size_type) const
+    {
+      for (size_type i = 0; i < inputSize (); ++i)
+        grad.coeffRef (i) = 2. * (x[i] - i);
+    }
+  };
+
+  /// \brief Slow f(x) = sum_i (x_i - i)^2, without gradient.
+  struct SlowDense : public Function
+  {
+    explicit SlowDense (size_type n)
+      : Function (n, 1, "slow dense")
+    {
+    }
+
+    void impl_compute (result_ref result, const_argument_ref x) const
+    {
+      boost::this_thread::sleep (boost::posix_time::milliseconds (20));
+
+      result[0] = 0.;
+      for (size_type i = 0; i < inputSize (); ++i)
+        result[0] += (x[i] - i) * (x[i] - i);
+    }
+  };
+
+  /// \brief Check that a result was interrupted for the given reason.
+  template <typename S>
+  void checkInterrupted (const typename S::result_t& res,
+                         const std::string& reason)
+  {
+    BOOST_REQUIRE_EQUAL (res.which (), S::SOLVER_VALUE_WARNINGS);
+    const ResultWithWarnings& result = boost::get<ResultWithWarnings> (res);
+    BOOST_REQUIRE_EQUAL (result.warnings.size (), 1u);
+    BOOST_CHECK_EQUAL (std::string (result.warnings[0].what ()), reason);
+  }
+
+  const int size = 20;
+} // end of unnamed namespace
+
+struct Fixture
+{
+  Fixture ()
+    : f (size),
+      pb (f)
+  {
+    pb.startingPoint () = problem_t::vector_t::Zero (size);
+  }
+
+  Slow f;
+  problem_t pb;
+};
+
+BOOST_FIXTURE_TEST_SUITE (interruption, Fixture)
+
+BOOST_AUTO_TEST_CASE (time_limit)
+{
+  SolverFactory<solver_t> factory ("nag-nlp-sparse", pb);
+  solver_t& solver = factory ();
+  solver.parameters ()["max-time"].value = 0.05;
+
+  checkInterrupted<solver_t> (solver.minimum (), "time limit exceeded");
+}
+
+BOOST_AUTO_TEST_CASE (cancel)
+{
+  SolverFactory<solver_t> factory ("nag-nlp-sparse", pb);
+  NagSolverCommon<EigenMatrixSparse>* solver =
+    dynamic_cast<NagSolverCommon<EigenMatrixSparse>*> (&factory ());
+  BOOST_REQUIRE (solver);
+
+  // Cancelling before the solve stops it at the first evaluation.
+  solver->cancel ();
+  boost::shared_ptr<NagSolveHandle<EigenMatrixSparse> > handle =
+    solver->solveAsync ();
+  const solver_t::result_t& res = handle->get ();
+  BOOST_CHECK (handle->ready ());
+
+  checkInterrupted<solver_t> (res, "solve cancelled");
+}
+
+BOOST_AUTO_TEST_SUITE_END ()
+
+BOOST_AUTO_TEST_CASE (simplex_time_limit)
+{
+  typedef Solver<EigenMatrixDense> denseSolver_t;
+  typedef denseSolver_t::problem_t denseProblem_t;
+
+  SlowDense f (size);
+  denseProblem_t pb (f);
+  pb.startingPoint () = denseProblem_t::vector_t::Zero (size);
+
+  SolverFactory<denseSolver_t> factory ("nag-simplex", pb);
+  denseSolver_t& solver = factory ();
+  solver.parameters ()["max-time"].value = 0.1;
+
+  const denseSolver_t::result_t& res = solver.minimum ();
+  checkInterrupted<denseSolver_t> (res, "time limit exceeded");
+
+  // NAG is fed infinite values once stopped: the best evaluated point
+  // is returned, with its actual cost.
+  const ResultWithWarnings& result = boost::get<ResultWithWarnings> (res);
+  BOOST_REQUIRE_EQUAL (result.value.size (), 1);
+  BOOST_CHECK (result.value[0] < Function::infinity ());
+  BOOST_CHECK_CLOSE (result.value[0], f (result.x)[0], 1e-8);
+  BOOST_CHECK (result.value[0] <= f (*pb.startingPoint ())[0]);
+}
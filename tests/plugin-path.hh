@@ -0,0 +1,40 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef ROBOPTIM_CORE_NAG_TESTS_PLUGIN_PATH_HH
+# define ROBOPTIM_CORE_NAG_TESTS_PLUGIN_PATH_HH
+
+# include <cstdlib>
+
+# include <boost/test/unit_test.hpp>
+
+/// \brief Load the plugins from the build tree (see NAG_UNIT_TEST).
+///
+/// An existing LTDL_LIBRARY_PATH is kept.
+struct PluginPath
+{
+  PluginPath ()
+  {
+# ifdef PLUGIN_PATH
+    setenv ("LTDL_LIBRARY_PATH", PLUGIN_PATH, 0);
+# endif //! PLUGIN_PATH
+  }
+};
+
+BOOST_GLOBAL_FIXTURE (PluginPath);
+
+#endif //! ROBOPTIM_CORE_NAG_TESTS_PLUGIN_PATH_HH
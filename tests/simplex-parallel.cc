@@ -0,0 +1,212 @@
+// Copyright (C) 2016 by Benjamin Chrétien, CNRS-AIST JRL.
+//
+// This file is part of the roboptim.
+//
+// roboptim is free software: you can redistribute it and/or modify
+// it under the terms of the GNU Lesser General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// roboptim is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU Lesser General Public License for more details.
+//
+// You should have received a copy of the GNU Lesser General Public License
+// along with roboptim.  If not, see <http://www.gnu.org/licenses/>.
+
+// Solve a problem with the parallel simplex solver, with a thread pool
+// and with a batch evaluation of the cost.
+
+#define BOOST_TEST_MODULE simplex_parallel
+
+#include <string>
+
+#include <boost/test/unit_test.hpp>
+#include <boost/variant/get.hpp>
+
+#include <roboptim/core/function.hh>
+#include <roboptim/core/solver.hh>
+#include <roboptim/core/solver-factory.hh>
+
+#include "roboptim/core/plugin/nag/nag-hooks.hh"
+#include "plugin-path.hh"
+
+using namespace roboptim;
+
+typedef Solver<EigenMatrixDense> solver_t;
+typedef solver_t::problem_t problem_t;
+
+namespace
+{
+  /// \brief f(x) = sum_i (x_i - i)^2.
+  struct Cost : public Function
+  {
+    explicit Cost (size_type n)
+      : Function (n, 1, "cost")
+    {
+    }
+
+    void impl_compute (result_ref result, const_argument_ref x) const
+    {
+      result[0] = 0.;
+      for (size_type i = 0; i < inputSize (); ++i)
+        result[0] += (x[i] - i) * (x[i] - i);
+    }
+  };
+
+  /// \brief Same cost, counting its evaluations (not thread-safe).
+  struct CountedCost : public Cost
+  {
+    explicit CountedCost (size_type n)
+      : Cost (n),
+        evaluations (0)
+    {
+    }
+
+    void impl_compute (result_ref result, const_argument_ref x) const
+    {
+      ++evaluations;
+      Cost::impl_compute (result, x);
+    }
+
+    mutable int evaluations;
+  };
+
+  /// \brief Same cost, evaluated on all the points of a step at once.
+  struct BatchCost : public Cost, public NagBatchEvaluation
+  {
+    explicit BatchCost (size_type n)
+      : Cost (n),
+        batches (0)
+    {
+    }
+
+    void computeBatch (NagBatchEvaluation::matrix_t& values,
+                       const NagBatchEvaluation::matrix_t& points) const
+    {
+      ++batches;
+      for (size_type j = 0; j < points.cols (); ++j)
+      {
+        values (0, j) = 0.;
+        for (size_type i = 0; i < inputSize (); ++i)
+          values (0, j) += (points (i, j) - i) * (points (i, j) - i);
+      }
+    }
+
+    mutable int batches;
+  };
+
+  const Result& solution (solver_t& solver)
+  {
+    const solver_t::result_t& res = solver.minimum ();
+    BOOST_REQUIRE_EQUAL (res.which (), solver_t::SOLVER_VALUE);
+    return boost::get<Result> (res);
+  }
+
+  void setParameters (solver_t& solver, int threads)
+  {
+    solver.parameters ()["nag.tolx"].value = 1e-8;
+    solver.parameters ()["nag.tolf"].value = 1e-12;
+    solver.parameters ()["max-iterations"].value = 100000;
+    solver.parameters ()["nag.eval-threads"].value = threads;
+  }
+
+  const int size = 4;
+} // end of unnamed namespace
+
+BOOST_AUTO_TEST_SUITE (simplex_parallel)
+
+BOOST_AUTO_TEST_CASE (convergence)
+{
+  Cost f (size);
+  problem_t pb (f);
+  pb.startingPoint () = problem_t::vector_t::Zero (size);
+
+  SolverFactory<solver_t> factory ("nag-simplex-parallel", pb);
+  solver_t& solver = factory ();
+  setParameters (solver, 1);
+  const Result res = solution (solver);
+  for (int i = 0; i < size; ++i)
+    BOOST_CHECK_SMALL (res.x[i] - i, 1e-6);
+
+  // The pool evaluates the same points: the iterates are identical.
+  SolverFactory<solver_t> parallelFactory ("nag-simplex-parallel", pb);
+  solver_t& parallel = parallelFactory ();
+  setParameters (parallel, 3);
+  const Result& parallelRes = solution (parallel);
+  BOOST_CHECK (parallelRes.x == res.x);
+  BOOST_CHECK_EQUAL (parallelRes.value[0], res.value[0]);
+}
+
+BOOST_AUTO_TEST_CASE (default_threads)
+{
+  // The cost is not thread-safe: it is only evaluated serially unless
+  // more threads are requested.
+  CountedCost f (size);
+  problem_t pb (f);
+  pb.startingPoint () = problem_t::vector_t::Zero (size);
+
+  SolverFactory<solver_t> factory ("nag-simplex-parallel", pb);
+  solver_t& solver = factory ();
+  BOOST_CHECK_EQUAL
+    (boost::get<int> (solver.parameters ()["nag.eval-threads"].value), 1);
+  solver.parameters ()["nag.tolx"].value = 1e-8;
+  solver.parameters ()["nag.tolf"].value = 1e-12;
+  solver.parameters ()["max-iterations"].value = 100000;
+
+  const Result& res = solution (solver);
+  BOOST_CHECK (f.evaluations > 0);
+  for (int i = 0; i < size; ++i)
+    BOOST_CHECK_SMALL (res.x[i] - i, 1e-4);
+}
+
+BOOST_AUTO_TEST_CASE (evaluation_budget)
+{
+  CountedCost f (size);
+  problem_t pb (f);
+  pb.startingPoint () = problem_t::vector_t::Zero (size);
+  const double f0 = f (*pb.startingPoint ())[0];
+
+  // Budgets ending at each kind of step (initial simplex, reflection,
+  // expansion or contraction).
+  for (int budget = 0; budget <= 6 * size; ++budget)
+  {
+    SolverFactory<solver_t> factory ("nag-simplex-parallel", pb);
+    solver_t& solver = factory ();
+    setParameters (solver, 1);
+    solver.parameters ()["max-iterations"].value = budget;
+
+    f.evaluations = 0;
+    const solver_t::result_t& res = solver.minimum ();
+    BOOST_CHECK_LE (f.evaluations, budget);
+
+    BOOST_REQUIRE_EQUAL (res.which (), solver_t::SOLVER_ERROR);
+    const SolverError& error = boost::get<SolverError> (res);
+    BOOST_CHECK_EQUAL (std::string (error.what ()),
+                       "maximum number of cost evaluations reached");
+
+    // The best vertex found so far is kept.
+    if (budget <= size) continue;
+    BOOST_REQUIRE (error.lastState ());
+    BOOST_CHECK (error.lastState ()->value[0] <= f0);
+  }
+}
+
+BOOST_AUTO_TEST_CASE (batch)
+{
+  BatchCost batch (size);
+  problem_t batchPb (batch);
+  batchPb.startingPoint () = problem_t::vector_t::Zero (size);
+  SolverFactory<solver_t> batchFactory ("nag-simplex-parallel", batchPb);
+  solver_t& batchSolver = batchFactory ();
+  setParameters (batchSolver, 1);
+  const Result& batchRes = solution (batchSolver);
+
+  // Each step is a single batch.
+  BOOST_CHECK (batch.batches > 0);
+  for (int i = 0; i < size; ++i)
+    BOOST_CHECK_SMALL (batchRes.x[i] - i, 1e-6);
+}
+
+BOOST_AUTO_TEST_SUITE_END ()